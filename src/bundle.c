@@ -0,0 +1,698 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "bundle.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <endian.h>
+#include <libgen.h>
+#include <sysexits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/param.h>
+
+#include "sdp.h"
+#include "image.h"
+#include "stub.h"
+
+static uint32_t bundle_u32(uint8_t const *tbl, size_t idx)
+{
+	uint32_t	v;
+
+	memcpy(&v, tbl + 4 * idx, sizeof v);
+	return le32toh(v);
+}
+
+static bool is_pow2(uint64_t v)
+{
+	return v != 0 && (v & (v - 1)) == 0;
+}
+
+static size_t bundle_num_blocks(struct bundle_header const *hdr,
+				struct bundle_variant const *v)
+{
+	uint32_t	bs = le32toh(hdr->block_size);
+
+	return ((size_t)le32toh(v->size) + bs - 1) / bs;
+}
+
+bool bundle_probe(char const *file_name)
+{
+	uint32_t	magic;
+	int		fd = open(file_name, O_RDONLY);
+	bool		rc;
+
+	if (fd < 0)
+		return false;
+
+	rc = (read(fd, &magic, sizeof magic) == sizeof magic &&
+	      le32toh(magic) == BUNDLE_MAGIC);
+	close(fd);
+
+	return rc;
+}
+
+static bool bundle_validate(struct bundle *b)
+{
+	struct bundle_header const	*hdr = b->data;
+	uint64_t			ofs = sizeof *hdr;
+	uint32_t			bs;
+	uint32_t			num_variants;
+	uint32_t			index_size;
+	uint32_t			map_len;
+	uint32_t			num_blocks;
+
+	if (b->size < sizeof *hdr ||
+	    le32toh(hdr->magic) != BUNDLE_MAGIC ||
+	    le32toh(hdr->version) != BUNDLE_VERSION)
+		return false;
+
+	bs           = le32toh(hdr->block_size);
+	num_variants = le32toh(hdr->num_variants);
+	index_size   = le32toh(hdr->index_size);
+	map_len      = le32toh(hdr->map_len);
+	num_blocks   = le32toh(hdr->num_blocks);
+
+	if (!is_pow2(bs) ||
+	    le32toh(hdr->num_selectors) == 0 ||
+	    le32toh(hdr->num_selectors) > BUNDLE_MAX_SELECTORS ||
+	    !is_pow2(index_size) || index_size <= num_variants)
+		return false;
+
+	b->hdr      = hdr;
+	b->variants = b->data + ofs;
+	ofs += (uint64_t)num_variants * sizeof b->variants[0];
+	b->index    = b->data + ofs;
+	ofs += (uint64_t)index_size * 4;
+	b->map      = b->data + ofs;
+	ofs += (uint64_t)map_len * 4;
+
+	if (ofs > le32toh(hdr->data_offset) ||
+	    le32toh(hdr->data_offset) + (uint64_t)num_blocks * bs > b->size)
+		return false;
+
+	b->blocks = b->data + le32toh(hdr->data_offset);
+
+	for (size_t i = 0; i < index_size; ++i) {
+		if (bundle_u32(b->index, i) > num_variants)
+			return false;
+	}
+
+	for (size_t i = 0; i < map_len; ++i) {
+		if (bundle_u32(b->map, i) >= num_blocks)
+			return false;
+	}
+
+	for (size_t i = 0; i < num_variants; ++i) {
+		struct bundle_variant const	*v = &b->variants[i];
+
+		if (!memchr(v->name, '\0', sizeof v->name) ||
+		    le32toh(v->size) == 0 ||
+		    le32toh(v->offset) >= le32toh(v->size) ||
+		    (uint64_t)le32toh(v->map_first) +
+		    bundle_num_blocks(hdr, v) > map_len)
+			return false;
+	}
+
+	return true;
+}
+
+int bundle_open(struct bundle *b, char const *file_name)
+{
+	struct stat	st;
+	int		fd;
+	int		rc;
+
+	fd = open(file_name, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "failed to open '%s': %m\n", file_name);
+		return EX_NOINPUT;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		perror("fstat()");
+		rc = EX_OSERR;
+		goto out;
+	}
+
+	*b = (struct bundle) {
+		.size	= st.st_size,
+	};
+
+	b->data = mmap(NULL, b->size, PROT_READ, MAP_SHARED, fd, 0);
+	if (b->data == MAP_FAILED) {
+		perror("mmap()");
+		b->data = NULL;
+		rc = EX_OSERR;
+		goto out;
+	}
+
+	if (!bundle_validate(b)) {
+		fprintf(stderr, "'%s' is not a valid bundle\n", file_name);
+		bundle_close(b);
+		rc = EX_DATAERR;
+		goto out;
+	}
+
+	rc = 0;
+
+out:
+	close(fd);
+	return rc;
+}
+
+void bundle_close(struct bundle *b)
+{
+	if (b->data)
+		munmap(b->data, b->size);
+
+	b->data = NULL;
+}
+
+struct bundle_variant const *bundle_lookup(struct bundle const *b,
+					   uint32_t const key[])
+{
+	unsigned int	num_sel = le32toh(b->hdr->num_selectors);
+	uint32_t	mask = le32toh(b->hdr->index_size) - 1;
+	uint32_t	key_le[BUNDLE_MAX_SELECTORS];
+	uint32_t	h;
+
+	for (size_t i = 0; i < num_sel; ++i)
+		key_le[i] = htole32(key[i]);
+
+	h = stub_fnv1a(key_le, num_sel * sizeof key_le[0]);
+
+	for (uint32_t i = 0; i <= mask; ++i) {
+		uint32_t			slot = bundle_u32(b->index, (h + i) & mask);
+		struct bundle_variant const	*v;
+
+		if (slot == 0)
+			break;
+
+		v = &b->variants[slot - 1];
+		if (memcmp(v->key, key_le, num_sel * sizeof key_le[0]) == 0)
+			return v;
+	}
+
+	return NULL;
+}
+
+int bundle_select(struct bundle const *b, struct sdp *sdp,
+		  struct bundle_variant const **variant)
+{
+	unsigned int	num_sel = le32toh(b->hdr->num_selectors);
+	uint32_t	key[BUNDLE_MAX_SELECTORS] = { };
+
+	for (size_t i = 0; i < num_sel; ++i) {
+		struct bundle_selector const	*sel = &b->hdr->selectors[i];
+
+		if (!sdp_read_regl(sdp, le32toh(sel->addr), &key[i], 1))
+			return EX_OSERR;
+
+		key[i] &= le32toh(sel->mask);
+	}
+
+	*variant = bundle_lookup(b, key);
+	if (!*variant) {
+		fprintf(stderr, "no bundle variant for selector values");
+		for (size_t i = 0; i < num_sel; ++i)
+			fprintf(stderr, "%s%#x", i == 0 ? " " : ",",
+				(unsigned int)key[i]);
+		fprintf(stderr, "\n");
+		return EX_DATAERR;
+	}
+
+	return 0;
+}
+
+static uint8_t const *bundle_block(struct bundle const *b,
+				   struct bundle_variant const *v, size_t idx)
+{
+	size_t	blk = bundle_u32(b->map, le32toh(v->map_first) + idx);
+
+	return b->blocks + blk * le32toh(b->hdr->block_size);
+}
+
+/* copies 'len' bytes at 'ofs' of the variant; caller has to ensure that
+ * the range is within the variant */
+static void bundle_copy(struct bundle const *b, struct bundle_variant const *v,
+			size_t ofs, void *dst, size_t len)
+{
+	size_t		bs = le32toh(b->hdr->block_size);
+
+	while (len > 0) {
+		size_t	boff = ofs % bs;
+		size_t	l = MIN(bs - boff, len);
+
+		memcpy(dst, bundle_block(b, v, ofs / bs) + boff, l);
+		dst += l;
+		ofs += l;
+		len -= l;
+	}
+}
+
+/* number of leading bytes which must be available contiguously for
+ * image_parse() */
+static size_t bundle_head_len(struct bundle const *b,
+			      struct bundle_variant const *v)
+{
+	size_t		bs = le32toh(b->hdr->block_size);
+	size_t		size = le32toh(v->size);
+	size_t		offset = le32toh(v->offset);
+	size_t		need = offset + sizeof(struct ivt);
+	struct ivt	ivt;
+
+	if (need <= size) {
+		bundle_copy(b, v, offset, &ivt, sizeof ivt);
+
+		if ((le32toh(ivt.header) & 0xffu) == IVT_TAG &&
+		    ivt.dcd != 0 &&
+		    le32toh(ivt.dcd) >= le32toh(ivt.self)) {
+			uint64_t	dcd_ofs = (uint64_t)offset +
+				le32toh(ivt.dcd) - le32toh(ivt.self);
+			be32_t		dcd_hdr;
+
+			if (dcd_ofs + sizeof dcd_hdr <= size) {
+				bundle_copy(b, v, dcd_ofs, &dcd_hdr,
+					    sizeof dcd_hdr);
+				need = MAX(need, dcd_ofs +
+					   ((be32toh(dcd_hdr) >> 8) & 0xffff));
+			}
+		}
+	}
+
+	need = (need + bs - 1) / bs * bs;
+
+	return MIN(need, size);
+}
+
+int bundle_variant_image(struct bundle const *b,
+			 struct bundle_variant const *v,
+			 struct mx6_image *img)
+{
+	size_t		bs = le32toh(b->hdr->block_size);
+	size_t		size = le32toh(v->size);
+	size_t		num_blocks = bundle_num_blocks(b->hdr, v);
+	size_t		head_len = bundle_head_len(b, v);
+	/* the head is clipped to 'size' and might end within a block */
+	size_t		first_blk = (head_len + bs - 1) / bs;
+	struct iovec	*iov;
+	size_t		iov_cnt = 0;
+	void		*head;
+	int		rc;
+
+	head = malloc(head_len);
+	iov  = calloc(1 + num_blocks - first_blk, sizeof iov[0]);
+	if (!head || !iov) {
+		rc = EX_OSERR;
+		goto err;
+	}
+
+	bundle_copy(b, v, 0, head, head_len);
+
+	rc = image_parse(img, head, head_len, le32toh(v->offset));
+	if (rc)
+		goto err;
+
+	iov[iov_cnt++] = (struct iovec) {
+		.iov_base	= head,
+		.iov_len	= head_len,
+	};
+
+	for (size_t i = first_blk; i < num_blocks; ++i) {
+		uint8_t const	*blk = bundle_block(b, v, i);
+		size_t		l = MIN(bs, size - i * bs);
+		struct iovec	*prev = &iov[iov_cnt - 1];
+
+		/* merge runs of blocks which are adjacent in the bundle */
+		if (prev->iov_base + prev->iov_len == blk) {
+			prev->iov_len += l;
+			continue;
+		}
+
+		iov[iov_cnt++] = (struct iovec) {
+			.iov_base	= (void *)blk,
+			.iov_len	= l,
+		};
+	}
+
+	img->fsize    = size;
+	img->head_len = head_len;
+	img->iov      = iov;
+	img->iov_cnt  = iov_cnt;
+
+	return 0;
+
+err:
+	free(iov);
+	free(head);
+	return rc;
+}
+
+bool bundle_parse_selector(char const *spec, struct bundle_selector *sel)
+{
+	char	*end;
+
+	sel->addr = strtoul(spec, &end, 0);
+	sel->mask = 0xffffffffu;
+
+	if (end == spec)
+		return false;
+
+	if (*end == '/') {
+		spec = end + 1;
+		sel->mask = strtoul(spec, &end, 0);
+		if (end == spec)
+			return false;
+	}
+
+	return *end == '\0';
+}
+
+bool bundle_parse_variant(char const *spec, unsigned int num_selectors,
+			  struct bundle_build_variant *v)
+{
+	char	*end;
+
+	*v = (struct bundle_build_variant) { };
+
+	for (unsigned int i = 0; i < num_selectors; ++i) {
+		v->key[i] = strtoul(spec, &end, 0);
+		if (end == spec)
+			return false;
+
+		if (*end != (i + 1 == num_selectors ? '=' : ','))
+			return false;
+
+		spec = end + 1;
+	}
+
+	v->file_name = spec;
+	return *spec != '\0';
+}
+
+struct bundle_build_image {
+	char const	*file_name;
+	uint8_t		*data;
+	size_t		size;
+	uint32_t	map_first;
+};
+
+struct bundle_builder {
+	size_t		block_size;
+
+	/* dedup hash table; block number + 1 */
+	uint32_t	*table;
+	size_t		table_size;
+
+	uint8_t const	**blocks;
+	size_t		num_blocks;
+
+	uint32_t	*map;
+	size_t		map_len;
+};
+
+static uint32_t bundle_builder_add(struct bundle_builder *bb,
+				   uint8_t const *blk)
+{
+	size_t		mask = bb->table_size - 1;
+	size_t		h = stub_fnv1a(blk, bb->block_size);
+
+	for (;; ++h) {
+		uint32_t	*slot = &bb->table[h & mask];
+
+		if (*slot == 0) {
+			bb->blocks[bb->num_blocks] = blk;
+			*slot = ++bb->num_blocks;
+			return *slot - 1;
+		}
+
+		if (memcmp(bb->blocks[*slot - 1], blk, bb->block_size) == 0)
+			return *slot - 1;
+	}
+}
+
+static bool bundle_write(FILE *f, void const *data, size_t len)
+{
+	return fwrite(data, 1, len, f) == len;
+}
+
+static int bundle_write_file(struct bundle_build_opts const *opts,
+			     struct bundle_builder const *bb,
+			     struct bundle_build_image const *images,
+			     uint32_t const *index, size_t index_size)
+{
+	struct bundle_header	hdr = {
+		.magic		= htole32(BUNDLE_MAGIC),
+		.version	= htole32(BUNDLE_VERSION),
+		.block_size	= htole32(bb->block_size),
+		.num_selectors	= htole32(opts->num_selectors),
+		.num_variants	= htole32(opts->num_variants),
+		.index_size	= htole32(index_size),
+		.map_len	= htole32(bb->map_len),
+		.num_blocks	= htole32(bb->num_blocks),
+	};
+	size_t			ofs;
+	size_t			data_ofs;
+	FILE			*f;
+	bool			ok;
+
+	for (size_t i = 0; i < opts->num_selectors; ++i) {
+		hdr.selectors[i] = (struct bundle_selector) {
+			.addr	= htole32(opts->selectors[i].addr),
+			.mask	= htole32(opts->selectors[i].mask),
+		};
+	}
+
+	ofs = (sizeof hdr +
+	       opts->num_variants * sizeof(struct bundle_variant) +
+	       (index_size + bb->map_len) * 4);
+	/* align blocks so that they can be mapped page wise */
+	data_ofs = (ofs + bb->block_size - 1) / bb->block_size * bb->block_size;
+	hdr.data_offset = htole32(data_ofs);
+
+	f = fopen(opts->out_file, "wb");
+	if (!f) {
+		fprintf(stderr, "failed to create '%s': %m\n", opts->out_file);
+		return EX_CANTCREAT;
+	}
+
+	ok = bundle_write(f, &hdr, sizeof hdr);
+
+	for (size_t i = 0; i < opts->num_variants && ok; ++i) {
+		struct bundle_build_variant const	*src = &opts->variants[i];
+		struct bundle_variant			v = {
+			.offset		= htole32(opts->offset),
+			.size		= htole32(images[i].size),
+			.map_first	= htole32(images[i].map_first),
+		};
+		char					*tmp = strdup(src->file_name);
+
+		if (!tmp) {
+			ok = false;
+			break;
+		}
+
+		strncpy(v.name, basename(tmp), sizeof v.name - 1);
+		free(tmp);
+
+		for (size_t k = 0; k < opts->num_selectors; ++k)
+			v.key[k] = htole32(src->key[k] &
+					   opts->selectors[k].mask);
+
+		ok = bundle_write(f, &v, sizeof v);
+	}
+
+	for (size_t i = 0; i < index_size && ok; ++i) {
+		uint32_t	v = htole32(index[i]);
+
+		ok = bundle_write(f, &v, sizeof v);
+	}
+
+	for (size_t i = 0; i < bb->map_len && ok; ++i) {
+		uint32_t	v = htole32(bb->map[i]);
+
+		ok = bundle_write(f, &v, sizeof v);
+	}
+
+	for (; ofs < data_ofs && ok; ++ofs)
+		ok = fputc(0, f) != EOF;
+
+	for (size_t i = 0; i < bb->num_blocks && ok; ++i)
+		ok = bundle_write(f, bb->blocks[i], bb->block_size);
+
+	if (fclose(f) != 0)
+		ok = false;
+
+	if (!ok) {
+		fprintf(stderr, "failed to write '%s': %m\n", opts->out_file);
+		unlink(opts->out_file);
+		return EX_IOERR;
+	}
+
+	return 0;
+}
+
+int bundle_build(struct bundle_build_opts const *opts)
+{
+	struct bundle_builder		bb = {
+		.block_size	= opts->block_size,
+	};
+	struct bundle_build_image	*images;
+	uint32_t			*index = NULL;
+	size_t				index_size = 1;
+	size_t				total_blocks = 0;
+	uint64_t			total_size = 0;
+	int				rc;
+
+	if (!is_pow2(opts->block_size) || opts->block_size < 64) {
+		fprintf(stderr, "bad bundle block size %zu\n",
+			opts->block_size);
+		return EX_USAGE;
+	}
+
+	if (opts->num_selectors == 0 || opts->num_variants == 0) {
+		fprintf(stderr, "bundle needs at least one selector and one variant\n");
+		return EX_USAGE;
+	}
+
+	images = calloc(opts->num_variants, sizeof images[0]);
+	if (!images)
+		return EX_OSERR;
+
+	for (size_t i = 0; i < opts->num_variants; ++i) {
+		struct bundle_build_image	*img = &images[i];
+		size_t				len;
+		void				*tmp;
+
+		img->file_name = opts->variants[i].file_name;
+
+		rc = read_file(img->file_name, &tmp, &img->size);
+		if (rc)
+			goto out;
+
+		img->data = tmp;
+
+		if (img->size <= opts->offset || img->size > UINT32_MAX) {
+			fprintf(stderr, "'%s': bad image size %zu\n",
+				img->file_name, img->size);
+			rc = EX_DATAERR;
+			goto out;
+		}
+
+		/* pad the last block with zeros */
+		len = (img->size + bb.block_size - 1) / bb.block_size * bb.block_size;
+		tmp = realloc(img->data, len);
+		if (!tmp) {
+			rc = EX_OSERR;
+			goto out;
+		}
+
+		img->data = tmp;
+		memset(img->data + img->size, 0, len - img->size);
+
+		total_blocks += len / bb.block_size;
+		total_size   += img->size;
+	}
+
+	while (index_size < 2 * opts->num_variants)
+		index_size <<= 1;
+
+	bb.table_size = 1;
+	while (bb.table_size < 2 * total_blocks)
+		bb.table_size <<= 1;
+
+	index     = calloc(index_size, sizeof index[0]);
+	bb.table  = calloc(bb.table_size, sizeof bb.table[0]);
+	bb.blocks = calloc(total_blocks, sizeof bb.blocks[0]);
+	bb.map    = calloc(total_blocks, sizeof bb.map[0]);
+	if (!index || !bb.table || !bb.blocks || !bb.map) {
+		rc = EX_OSERR;
+		goto out;
+	}
+
+	for (size_t i = 0; i < opts->num_variants; ++i) {
+		struct bundle_build_image	*img = &images[i];
+		size_t				n = ((img->size + bb.block_size - 1) /
+						     bb.block_size);
+		uint32_t			key_le[BUNDLE_MAX_SELECTORS];
+		size_t				h;
+
+		for (size_t k = 0; k < opts->num_selectors; ++k)
+			key_le[k] = htole32(opts->variants[i].key[k] &
+					    opts->selectors[k].mask);
+
+		h = stub_fnv1a(key_le, opts->num_selectors * sizeof key_le[0]);
+
+		for (;; ++h) {
+			uint32_t	*slot = &index[h & (index_size - 1)];
+			size_t		other;
+			bool		same = true;
+
+			if (*slot == 0) {
+				*slot = i + 1;
+				break;
+			}
+
+			other = *slot - 1;
+			for (size_t k = 0; k < opts->num_selectors; ++k)
+				same &= (((opts->variants[other].key[k] ^
+					   opts->variants[i].key[k]) &
+					  opts->selectors[k].mask) == 0);
+
+			if (same) {
+				fprintf(stderr, "'%s' and '%s' have the same selector values\n",
+					images[other].file_name, img->file_name);
+				rc = EX_USAGE;
+				goto out;
+			}
+		}
+
+		img->map_first = bb.map_len;
+		for (size_t k = 0; k < n; ++k)
+			bb.map[bb.map_len++] =
+				bundle_builder_add(&bb, img->data + k * bb.block_size);
+	}
+
+	rc = bundle_write_file(opts, &bb, images, index, index_size);
+	if (rc)
+		goto out;
+
+	printf("%s: %zu variants, %zu of %zu blocks stored (%llu -> %zu bytes)\n",
+	       opts->out_file, opts->num_variants, bb.num_blocks, total_blocks,
+	       (unsigned long long)total_size, bb.num_blocks * bb.block_size);
+
+out:
+	for (size_t i = 0; i < opts->num_variants; ++i)
+		free(images[i].data);
+
+	free(images);
+	free(index);
+	free(bb.table);
+	free(bb.blocks);
+	free(bb.map);
+
+	return rc;
+}
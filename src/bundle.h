@@ -0,0 +1,144 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef H_ENSC_MX6_LOAD_BUNDLE_H
+#define H_ENSC_MX6_LOAD_BUNDLE_H
+
+/* Bundles contain the boot images of all variants of a product.  A
+ * variant is identified by the values of up to BUNDLE_MAX_SELECTORS
+ * registers (e.g. OCOTP fuse shadow registers or GPIO pad status) which
+ * are read by READ_REGISTER after the device was opened.  Images are
+ * split into blocks of 'block_size' bytes; identical blocks are stored
+ * only once and referenced by a per variant block map.
+ *
+ * Layout; all numbers are little endian:
+ *
+ *   struct bundle_header
+ *   struct bundle_variant	[num_variants]
+ *   uint32_t index		[index_size]	variant number + 1; 0 is free
+ *   uint32_t map		[map_len]	block numbers
+ *   <padding up to 'data_offset'>
+ *   uint8_t  blocks		[num_blocks][block_size]
+ *
+ * The index is an open addressing hash table (stub_fnv1a() over the
+ * masked selector values, linear probing).
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "util.h"
+
+struct sdp;
+struct mx6_image;
+
+#define BUNDLE_MAGIC		0x4c444e42u	/* "BNDL" */
+#define BUNDLE_VERSION		1u
+#define BUNDLE_MAX_SELECTORS	4u
+#define BUNDLE_NAME_LEN		32u
+
+struct bundle_selector {
+	uint32_t	addr;
+	uint32_t	mask;
+} __packed;
+
+struct bundle_header {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	block_size;
+	uint32_t	num_selectors;
+	struct bundle_selector	selectors[BUNDLE_MAX_SELECTORS];
+	uint32_t	num_variants;
+	uint32_t	index_size;
+	uint32_t	map_len;
+	uint32_t	num_blocks;
+	uint32_t	data_offset;
+} __packed;
+
+struct bundle_variant {
+	char		name[BUNDLE_NAME_LEN];
+	/* masked selector values */
+	uint32_t	key[BUNDLE_MAX_SELECTORS];
+	/* IVT offset as given by --offset */
+	uint32_t	offset;
+	uint32_t	size;
+	uint32_t	map_first;
+} __packed;
+
+struct bundle {
+	void				*data;
+	size_t				size;
+
+	struct bundle_header const	*hdr;
+	struct bundle_variant const	*variants;
+	uint8_t const			*index;
+	uint8_t const			*map;
+	uint8_t const			*blocks;
+};
+
+/* checks whether 'file_name' starts with the bundle magic */
+bool	bundle_probe(char const *file_name);
+
+/* maps and validates a bundle; returns 0 or a sysexits(3) code */
+int	bundle_open(struct bundle *b, char const *file_name);
+void	bundle_close(struct bundle *b);
+
+/* 'key' are the masked selector values in host byte order; returns NULL
+ * when there is no such variant */
+struct bundle_variant const	*bundle_lookup(struct bundle const *b,
+					       uint32_t const key[]);
+
+/* reads the selector registers of the device and looks up its variant;
+ * returns 0 or a sysexits(3) code */
+int	bundle_select(struct bundle const *b, struct sdp *sdp,
+		      struct bundle_variant const **variant);
+
+/* fills 'img' with a variant; only the blocks containing IVT and DCD are
+ * copied, the remaining ones are referenced by 'img->iov'.  'img' must be
+ * released by image_close() before the bundle is closed. */
+int	bundle_variant_image(struct bundle const *b,
+			     struct bundle_variant const *v,
+			     struct mx6_image *img);
+
+struct bundle_build_variant {
+	uint32_t		key[BUNDLE_MAX_SELECTORS];
+	char const		*file_name;
+};
+
+struct bundle_build_opts {
+	char const		*out_file;
+	size_t			block_size;
+	unsigned int		offset;
+
+	unsigned int		num_selectors;
+	struct bundle_selector	selectors[BUNDLE_MAX_SELECTORS];
+
+	size_t			num_variants;
+	struct bundle_build_variant const	*variants;
+};
+
+/* parses '<addr>[/<mask>]' */
+bool	bundle_parse_selector(char const *spec, struct bundle_selector *sel);
+/* parses '<val>[,<val>...]=<file>' with one value per selector */
+bool	bundle_parse_variant(char const *spec, unsigned int num_selectors,
+			     struct bundle_build_variant *v);
+
+/* returns 0 or a sysexits(3) code */
+int	bundle_build(struct bundle_build_opts const *opts);
+
+#endif	/* H_ENSC_MX6_LOAD_BUNDLE_H */
@@ -0,0 +1,723 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "cache.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <endian.h>
+#include <sysexits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "util.h"
+#include "image.h"
+
+#define HASH_PRIME1	0x9e3779b185ebca87ull
+#define HASH_PRIME2	0xc2b2ae3d27d4eb4full
+#define HASH_PRIME3	0x165667b19e3779f9ull
+#define HASH_PRIME4	0x85ebca77c2b2ae63ull
+#define HASH_PRIME5	0x27d4eb2f165667c5ull
+
+#define CACHE_IO_SIZE	(1u << 20)
+/* least recently used objects are removed above this size */
+#define CACHE_MAX_SIZE	(1ull << 30)
+/* stat/ entries which were not used for this time are removed */
+#define CACHE_STAT_MAX_AGE	(14 * 24 * 3600)
+
+/* images are parsed on every open; the sidecar only remembers that the
+ * content was rejected */
+struct cache_meta {
+	size_t		size;
+	int		result;
+};
+
+struct cache_object {
+	uint64_t	hash;
+	off_t		size;
+	time_t		mtime;
+};
+
+static uint64_t rotl64(uint64_t v, unsigned int n)
+{
+	return (v << n) | (v >> (64 - n));
+}
+
+static uint64_t read_le64(void const *p)
+{
+	uint64_t	v;
+
+	memcpy(&v, p, sizeof v);
+	return le64toh(v);
+}
+
+static uint32_t read_le32(void const *p)
+{
+	uint32_t	v;
+
+	memcpy(&v, p, sizeof v);
+	return le32toh(v);
+}
+
+static uint64_t hash_round(uint64_t acc, uint64_t input)
+{
+	acc += input * HASH_PRIME2;
+	acc  = rotl64(acc, 31);
+	return acc * HASH_PRIME1;
+}
+
+static uint64_t hash_merge(uint64_t acc, uint64_t val)
+{
+	acc ^= hash_round(0, val);
+	return acc * HASH_PRIME1 + HASH_PRIME4;
+}
+
+static void hash_stripes(struct image_hash *h, uint8_t const *p, size_t cnt)
+{
+	uint64_t	v0 = h->v[0];
+	uint64_t	v1 = h->v[1];
+	uint64_t	v2 = h->v[2];
+	uint64_t	v3 = h->v[3];
+
+	for (; cnt > 0; --cnt, p += 32) {
+		v0 = hash_round(v0, read_le64(p +  0));
+		v1 = hash_round(v1, read_le64(p +  8));
+		v2 = hash_round(v2, read_le64(p + 16));
+		v3 = hash_round(v3, read_le64(p + 24));
+	}
+
+	h->v[0] = v0;
+	h->v[1] = v1;
+	h->v[2] = v2;
+	h->v[3] = v3;
+}
+
+void image_hash_init(struct image_hash *h)
+{
+	*h = (struct image_hash) {
+		.v	= {
+			HASH_PRIME1 + HASH_PRIME2,
+			HASH_PRIME2,
+			0,
+			-HASH_PRIME1,
+		},
+	};
+}
+
+void image_hash_update(struct image_hash *h, void const *data, size_t len)
+{
+	uint8_t const	*p = data;
+
+	h->total += len;
+
+	if (h->buf_len > 0) {
+		size_t	l = sizeof h->buf - h->buf_len;
+
+		if (l > len)
+			l = len;
+
+		memcpy(h->buf + h->buf_len, p, l);
+		h->buf_len += l;
+		p   += l;
+		len -= l;
+
+		if (h->buf_len < sizeof h->buf)
+			return;
+
+		hash_stripes(h, h->buf, 1);
+		h->buf_len = 0;
+	}
+
+	hash_stripes(h, p, len / 32);
+	p   += len / 32 * 32;
+	len %= 32;
+
+	memcpy(h->buf, p, len);
+	h->buf_len = len;
+}
+
+uint64_t image_hash_final(struct image_hash const *h)
+{
+	uint8_t const	*p = h->buf;
+	size_t		len = h->buf_len;
+	uint64_t	res;
+
+	if (h->total >= 32) {
+		res = (rotl64(h->v[0], 1) + rotl64(h->v[1], 7) +
+		       rotl64(h->v[2], 12) + rotl64(h->v[3], 18));
+
+		for (size_t i = 0; i < 4; ++i)
+			res = hash_merge(res, h->v[i]);
+	} else {
+		res = HASH_PRIME5;
+	}
+
+	res += h->total;
+
+	for (; len >= 8; len -= 8, p += 8) {
+		res ^= hash_round(0, read_le64(p));
+		res  = rotl64(res, 27) * HASH_PRIME1 + HASH_PRIME4;
+	}
+
+	if (len >= 4) {
+		res ^= read_le32(p) * HASH_PRIME1;
+		res  = rotl64(res, 23) * HASH_PRIME2 + HASH_PRIME3;
+		len -= 4;
+		p   += 4;
+	}
+
+	for (; len > 0; --len, ++p) {
+		res ^= *p * HASH_PRIME5;
+		res  = rotl64(res, 11) * HASH_PRIME1;
+	}
+
+	res ^= res >> 33;
+	res *= HASH_PRIME2;
+	res ^= res >> 29;
+	res *= HASH_PRIME3;
+	res ^= res >> 32;
+
+	return res;
+}
+
+int image_cache_init(struct image_cache *cache, char const *dir)
+{
+	*cache = (struct image_cache) {
+		.dir	= strdup(dir),
+		.dir_fd	= -1,
+	};
+
+	if (!cache->dir)
+		return EX_OSERR;
+
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		fprintf(stderr, "mkdir(%s): %m\n", dir);
+		goto err;
+	}
+
+	cache->dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (cache->dir_fd < 0) {
+		fprintf(stderr, "open(%s): %m\n", dir);
+		goto err;
+	}
+
+	if ((mkdirat(cache->dir_fd, "objects", 0755) < 0 && errno != EEXIST) ||
+	    (mkdirat(cache->dir_fd, "stat", 0755) < 0 && errno != EEXIST)) {
+		fprintf(stderr, "failed to setup cache in '%s': %m\n", dir);
+		goto err;
+	}
+
+	return 0;
+
+err:
+	image_cache_destroy(cache);
+	return EX_CANTCREAT;
+}
+
+void image_cache_destroy(struct image_cache *cache)
+{
+	if (cache->dir_fd >= 0)
+		close(cache->dir_fd);
+
+	free(cache->dir);
+	cache->dir = NULL;
+	cache->dir_fd = -1;
+}
+
+/* identifies a certain version of the source file without reading it */
+static uint64_t cache_stat_key(char const *file_name, struct stat const *st)
+{
+	struct image_hash	h;
+	uint64_t		attrs[] = {
+		st->st_dev,
+		st->st_ino,
+		st->st_size,
+		st->st_mtim.tv_sec,
+		st->st_mtim.tv_nsec,
+	};
+
+	image_hash_init(&h);
+	image_hash_update(&h, attrs, sizeof attrs);
+	image_hash_update(&h, file_name, strlen(file_name));
+
+	return image_hash_final(&h);
+}
+
+static bool cache_lookup(struct image_cache const *cache, uint64_t key,
+			 uint64_t *hash)
+{
+	char		path[64];
+	char		target[32];
+	ssize_t		l;
+	char		*end;
+
+	snprintf(path, sizeof path, "stat/%016llx", (unsigned long long)key);
+
+	l = readlinkat(cache->dir_fd, path, target, sizeof target - 1);
+	if (l != 16)
+		return false;
+
+	target[l] = '\0';
+	*hash = strtoull(target, &end, 16);
+
+	return *end == '\0';
+}
+
+/* replaces 'name' atomically by a symlink to 'target' */
+static void cache_link(struct image_cache const *cache, char const *name,
+		       char const *target)
+{
+	char	tmp[64];
+
+	snprintf(tmp, sizeof tmp, "%s.%ld", name, (long)getpid());
+
+	if (symlinkat(target, cache->dir_fd, tmp) < 0)
+		return;
+
+	if (renameat(cache->dir_fd, tmp, cache->dir_fd, name) < 0)
+		unlinkat(cache->dir_fd, tmp, 0);
+}
+
+static bool write_all(int fd, void const *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t	l = write(fd, buf, len);
+
+		if (l < 0 && errno == EINTR)
+			continue;
+
+		if (l <= 0)
+			return false;
+
+		buf += l;
+		len -= l;
+	}
+
+	return true;
+}
+
+/* copies the source file into the cache; it is read only once and
+ * hashed on the fly */
+static int cache_import(struct image_cache const *cache, char const *file_name,
+			struct stat const *st, uint64_t *hash)
+{
+	struct image_hash	h;
+	char			*tmp_path = NULL;
+	char			obj[64];
+	uint8_t			*buf = NULL;
+	uint64_t		total = 0;
+	int			fd;
+	int			tmp_fd = -1;
+	int			rc;
+
+	fd = open(file_name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "failed to open '%s': %m\n", file_name);
+		return EX_NOINPUT;
+	}
+
+	/* let the kernel fetch the whole file with large requests */
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	readahead(fd, 0, st->st_size);
+
+	buf = malloc(CACHE_IO_SIZE);
+	if (!buf ||
+	    asprintf(&tmp_path, "%s/objects/.import-XXXXXX", cache->dir) < 0) {
+		tmp_path = NULL;
+		rc = EX_OSERR;
+		goto out;
+	}
+
+	tmp_fd = mkostemp(tmp_path, O_CLOEXEC);
+	if (tmp_fd < 0) {
+		fprintf(stderr, "mkostemp(%s): %m\n", tmp_path);
+		rc = EX_CANTCREAT;
+		goto out;
+	}
+
+	image_hash_init(&h);
+
+	for (;;) {
+		ssize_t	l = read(fd, buf, CACHE_IO_SIZE);
+
+		if (l < 0 && errno == EINTR)
+			continue;
+
+		if (l < 0) {
+			fprintf(stderr, "failed to read '%s': %m\n", file_name);
+			rc = EX_IOERR;
+			goto out;
+		}
+
+		if (l == 0)
+			break;
+
+		image_hash_update(&h, buf, l);
+		total += l;
+
+		if (!write_all(tmp_fd, buf, l)) {
+			fprintf(stderr, "failed to write '%s': %m\n", tmp_path);
+			rc = EX_IOERR;
+			goto out;
+		}
+	}
+
+	if (total != (uint64_t)st->st_size) {
+		fprintf(stderr, "'%s' changed while reading it\n", file_name);
+		rc = EX_TEMPFAIL;
+		goto out;
+	}
+
+	*hash = image_hash_final(&h);
+	snprintf(obj, sizeof obj, "%s/objects/%016llx.img", cache->dir,
+		 (unsigned long long)*hash);
+
+	/* same name means same content; replacing an existing object is
+	 * harmless */
+	if (rename(tmp_path, obj) < 0) {
+		fprintf(stderr, "rename(%s): %m\n", obj);
+		rc = EX_CANTCREAT;
+		goto out;
+	}
+
+	free(tmp_path);
+	tmp_path = NULL;
+	rc = 0;
+
+out:
+	if (tmp_path) {
+		unlink(tmp_path);
+		free(tmp_path);
+	}
+
+	if (tmp_fd >= 0)
+		close(tmp_fd);
+
+	free(buf);
+	close(fd);
+
+	return rc;
+}
+
+static bool cache_read_meta(struct image_cache const *cache, char const *name,
+			    struct cache_meta *meta)
+{
+	int	fd = openat(cache->dir_fd, name, O_RDONLY | O_CLOEXEC);
+	FILE	*f;
+	bool	rc;
+
+	if (fd < 0)
+		return false;
+
+	f = fdopen(fd, "r");
+	if (!f) {
+		close(fd);
+		return false;
+	}
+
+	rc = fscanf(f, "size %zu\nresult %d\n",
+		    &meta->size, &meta->result) == 2;
+	fclose(f);
+
+	return rc;
+}
+
+static void cache_write_meta(struct image_cache const *cache, char const *name,
+			     struct cache_meta const *meta)
+{
+	char	tmp[96];
+	int	fd;
+	FILE	*f;
+	bool	ok;
+
+	snprintf(tmp, sizeof tmp, "%s.%ld", name, (long)getpid());
+
+	fd = openat(cache->dir_fd, tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+		    0644);
+	if (fd < 0)
+		return;
+
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		unlinkat(cache->dir_fd, tmp, 0);
+		return;
+	}
+
+	fprintf(f, "size %zu\nresult %d\n", meta->size, meta->result);
+
+	ok = fclose(f) == 0;
+	if (!ok || renameat(cache->dir_fd, tmp, cache->dir_fd, name) < 0)
+		unlinkat(cache->dir_fd, tmp, 0);
+}
+
+/* opens the object and checks that it matches the source file */
+static int cache_open_object(struct image_cache const *cache, uint64_t hash,
+			     struct stat const *src_st)
+{
+	char		name[64];
+	struct stat	st;
+	int		fd;
+
+	snprintf(name, sizeof name, "objects/%016llx.img",
+		 (unsigned long long)hash);
+
+	fd = openat(cache->dir_fd, name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0 || st.st_size != src_st->st_size) {
+		close(fd);
+		return -1;
+	}
+
+	/* the mtime orders the objects for cache_prune() */
+	futimens(fd, NULL);
+
+	return fd;
+}
+
+static bool cache_has_object(struct image_cache const *cache, uint64_t hash)
+{
+	char	name[64];
+
+	snprintf(name, sizeof name, "objects/%016llx.img",
+		 (unsigned long long)hash);
+
+	return faccessat(cache->dir_fd, name, F_OK, 0) == 0;
+}
+
+static int cache_object_cmp(void const *a_, void const *b_)
+{
+	struct cache_object const	*a = a_;
+	struct cache_object const	*b = b_;
+
+	if (a->mtime != b->mtime)
+		return a->mtime < b->mtime ? -1 : 1;
+
+	return 0;
+}
+
+/* removes the least recently used objects until objects/ is below
+ * CACHE_MAX_SIZE, and stat/ entries which were unused for
+ * CACHE_STAT_MAX_AGE or whose object is gone.  Concurrent users keep
+ * their mappings of removed objects. */
+static void cache_prune(struct image_cache const *cache)
+{
+	struct cache_object	*objs = NULL;
+	size_t			num_objs = 0;
+	uint64_t		total = 0;
+	time_t			now = time(NULL);
+	struct dirent		*ent;
+	DIR			*dir;
+	int			fd;
+
+	fd = openat(cache->dir_fd, "objects", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	dir = fd < 0 ? NULL : fdopendir(fd);
+	if (!dir) {
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+
+	while ((ent = readdir(dir))) {
+		struct cache_object	*tmp;
+		struct stat		st;
+		uint64_t		hash;
+		char			*end;
+
+		hash = strtoull(ent->d_name, &end, 16);
+		if (end != ent->d_name + 16 || strcmp(end, ".img") != 0 ||
+		    fstatat(fd, ent->d_name, &st, 0) < 0)
+			continue;
+
+		tmp = realloc(objs, (num_objs + 1) * sizeof objs[0]);
+		if (!tmp)
+			break;
+
+		objs = tmp;
+		objs[num_objs++] = (struct cache_object) {
+			.hash	= hash,
+			.size	= st.st_size,
+			.mtime	= st.st_mtim.tv_sec,
+		};
+		total += st.st_size;
+	}
+
+	if (total > CACHE_MAX_SIZE) {
+		qsort(objs, num_objs, sizeof objs[0], cache_object_cmp);
+
+		for (size_t i = 0; i < num_objs && total > CACHE_MAX_SIZE; ++i) {
+			char	name[32];
+
+			snprintf(name, sizeof name, "%016llx.img",
+				 (unsigned long long)objs[i].hash);
+			if (unlinkat(fd, name, 0) == 0)
+				total -= objs[i].size;
+		}
+
+		/* sidecars of removed objects */
+		rewinddir(dir);
+		while ((ent = readdir(dir))) {
+			uint64_t	hash;
+			char		*end;
+
+			hash = strtoull(ent->d_name, &end, 16);
+			if (end == ent->d_name + 16 && *end == '-' &&
+			    !cache_has_object(cache, hash))
+				unlinkat(fd, ent->d_name, 0);
+		}
+	}
+
+	free(objs);
+	closedir(dir);
+
+	fd = openat(cache->dir_fd, "stat", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	dir = fd < 0 ? NULL : fdopendir(fd);
+	if (!dir) {
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+
+	while ((ent = readdir(dir))) {
+		struct stat	st;
+		char		target[32];
+		ssize_t		l;
+		uint64_t	hash;
+		char		*end;
+
+		if (ent->d_name[0] == '.' ||
+		    fstatat(fd, ent->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0 ||
+		    !S_ISLNK(st.st_mode))
+			continue;
+
+		l = readlinkat(fd, ent->d_name, target, sizeof target - 1);
+		if (l < 0)
+			continue;
+
+		target[l] = '\0';
+		hash = strtoull(target, &end, 16);
+
+		if (l != 16 || *end != '\0' || !cache_has_object(cache, hash) ||
+		    now - st.st_mtim.tv_sec > CACHE_STAT_MAX_AGE)
+			unlinkat(fd, ent->d_name, 0);
+	}
+
+	closedir(dir);
+}
+
+int image_cache_open(struct image_cache *cache, struct mx6_image *img,
+		     char const *file_name, unsigned int offset)
+{
+	struct stat		st;
+	uint64_t		key;
+	uint64_t		hash;
+	char			hash_str[17];
+	char			meta_name[64];
+	char			link_name[32];
+	struct cache_meta	meta;
+	bool			have_meta;
+	void			*data;
+	int			fd = -1;
+	int			rc;
+
+	if (stat(file_name, &st) < 0) {
+		fprintf(stderr, "failed to open '%s': %m\n", file_name);
+		return EX_NOINPUT;
+	}
+
+	key = cache_stat_key(file_name, &st);
+	snprintf(link_name, sizeof link_name, "stat/%016llx",
+		 (unsigned long long)key);
+
+	if (cache_lookup(cache, key, &hash))
+		fd = cache_open_object(cache, hash, &st);
+
+	if (fd >= 0) {
+		/* keeps the entry alive for cache_prune() */
+		utimensat(cache->dir_fd, link_name, NULL, AT_SYMLINK_NOFOLLOW);
+	} else {
+		/* make room before the cache grows */
+		cache_prune(cache);
+
+		rc = cache_import(cache, file_name, &st, &hash);
+		if (rc)
+			return rc;
+
+		fd = cache_open_object(cache, hash, &st);
+		if (fd < 0) {
+			fprintf(stderr, "failed to open cached copy of '%s'\n",
+				file_name);
+			return EX_IOERR;
+		}
+
+		snprintf(hash_str, sizeof hash_str, "%016llx",
+			 (unsigned long long)hash);
+		cache_link(cache, link_name, hash_str);
+	}
+
+	snprintf(meta_name, sizeof meta_name, "objects/%016llx-%x.meta",
+		 (unsigned long long)hash, offset);
+
+	have_meta = (cache_read_meta(cache, meta_name, &meta) &&
+		     meta.size == (size_t)st.st_size);
+
+	if (have_meta && meta.result != 0) {
+		/* the image was rejected before; don't map it again */
+		fprintf(stderr, "'%s' is not a valid image at offset %#x\n",
+			file_name, offset);
+		rc = meta.result;
+		goto out;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		    fd, 0);
+	if (data == MAP_FAILED) {
+		perror("mmap()");
+		rc = EX_OSERR;
+		goto out;
+	}
+
+	rc = image_parse(img, data, st.st_size, offset);
+
+	if (!have_meta && rc != 0)
+		cache_write_meta(cache, meta_name, &(struct cache_meta) {
+				.size		= st.st_size,
+				.result		= rc,
+			});
+
+	if (rc) {
+		munmap(data, st.st_size);
+		goto out;
+	}
+
+	image_pin(img);
+
+out:
+	close(fd);
+	return rc;
+}
@@ -0,0 +1,73 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef H_ENSC_MX6_LOAD_CACHE_H
+#define H_ENSC_MX6_LOAD_CACHE_H
+
+/* Local, content addressed copies of images which are usually located on
+ * a network share.  The cache directory contains
+ *
+ *   objects/<hash>.img             file content
+ *   objects/<hash>-<offset>.meta   marks content which is not a valid
+ *                                  image at <offset>
+ *   stat/<key>                     symlink to <hash>; <key> is derived
+ *                                  from path, device, inode, size and
+ *                                  mtime of the source file
+ *
+ * A hit costs a stat(2) of the source file only; its content is read
+ * once when it is seen the first time.  <hash> is a XXH64 digest over
+ * the content.  Entries are never modified, so the directory can be
+ * shared between processes and can be cleaned at any time.  Before a new
+ * object is imported, the least recently used objects are removed above
+ * 1 GiB and stat/ entries unused for two weeks.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+struct mx6_image;
+
+struct image_cache {
+	char		*dir;
+	int		dir_fd;
+};
+
+/* creates the directory layout; returns 0 or a sysexits(3) code */
+int	image_cache_init(struct image_cache *cache, char const *dir);
+void	image_cache_destroy(struct image_cache *cache);
+
+/* like image_open() but maps the local copy of 'file_name' and locks it
+ * into memory; the copy is created when the content is not in the
+ * cache yet */
+int	image_cache_open(struct image_cache *cache, struct mx6_image *img,
+			 char const *file_name, unsigned int offset);
+
+struct image_hash {
+	uint64_t	v[4];
+	uint8_t		buf[32];
+	size_t		buf_len;
+	uint64_t	total;
+};
+
+/* XXH64 with seed 0; the four independent lanes allow the compiler to
+ * interleave (and vectorize) the stripe processing */
+void		image_hash_init(struct image_hash *h);
+void		image_hash_update(struct image_hash *h,
+				  void const *data, size_t len);
+uint64_t	image_hash_final(struct image_hash const *h);
+
+#endif	/* H_ENSC_MX6_LOAD_CACHE_H */
@@ -0,0 +1,181 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "client.h"
+
+#include <unistd.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "server.h"
+
+static int client_connect(char const *path)
+{
+	struct sockaddr_un	addr = {
+		.sun_family	= AF_UNIX,
+	};
+	int			fd;
+
+	if (strlen(path) >= sizeof addr.sun_path) {
+		fprintf(stderr, "server socket path too long\n");
+		return -1;
+	}
+
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("socket()");
+		return -1;
+	}
+
+	if (connect(fd, (void *)&addr, sizeof addr) < 0) {
+		fprintf(stderr, "connect(%s): %m\n", path);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static bool client_send(int fd, struct client_job const *job,
+			char const *image)
+{
+	char		*req = NULL;
+	size_t		req_len = 0;
+	FILE		*f = open_memstream(&req, &req_len);
+	size_t		pos = 0;
+	bool		rc = true;
+
+	if (!f)
+		return false;
+
+	fprintf(f, "image %s\noffset %u\nretries %u\n",
+		image, job->offset, job->retries);
+
+	if (job->port)
+		fprintf(f, "port %s\n", job->port);
+
+	if (job->delta)
+		fprintf(f, "delta\n");
+
+	if (job->timeout_ms)
+		fprintf(f, "timeout %u\n", job->timeout_ms);
+
+	fprintf(f, "run\n");
+	fclose(f);
+
+	while (pos < req_len && rc) {
+		ssize_t	l = write(fd, req + pos, req_len - pos);
+
+		if (l < 0) {
+			perror("write()");
+			rc = false;
+		} else {
+			pos += l;
+		}
+	}
+
+	free(req);
+	return rc;
+}
+
+/* copies the progress output to stdout and extracts the result line */
+static int client_receive(int fd)
+{
+	char		buf[4096];
+	char		tag[64];
+	size_t		tag_len = 0;
+	bool		bol = true;
+	bool		in_tag = false;
+	int		rc = EX_PROTOCOL;
+	ssize_t		l;
+
+	while ((l = read(fd, buf, sizeof buf)) > 0) {
+		for (ssize_t i = 0; i < l; ++i) {
+			char	c = buf[i];
+
+			if (bol && c == '@') {
+				in_tag = true;
+				tag_len = 0;
+			}
+
+			if (!in_tag) {
+				putchar(c);
+			} else if (c != '\n') {
+				if (tag_len < sizeof tag - 1)
+					tag[tag_len++] = c;
+			} else {
+				int	v;
+
+				tag[tag_len] = '\0';
+				if (sscanf(tag, SERVER_RESULT_TAG " %d", &v) == 1)
+					rc = v;
+
+				in_tag = false;
+			}
+
+			bol = c == '\n';
+		}
+
+		fflush(stdout);
+	}
+
+	if (l < 0)
+		perror("read()");
+
+	return rc;
+}
+
+int client_run(struct client_job const *job)
+{
+	char	*image;
+	int	fd;
+	int	rc;
+
+	/* the server has a different working directory */
+	image = realpath(job->file_name, NULL);
+	if (!image) {
+		fprintf(stderr, "failed to open '%s': %m\n", job->file_name);
+		return EX_NOINPUT;
+	}
+
+	fd = client_connect(job->socket_path);
+	if (fd < 0) {
+		rc = EX_UNAVAILABLE;
+		goto out;
+	}
+
+	if (!client_send(fd, job, image))
+		rc = EX_IOERR;
+	else
+		rc = client_receive(fd);
+
+	close(fd);
+
+out:
+	free(image);
+	return rc;
+}
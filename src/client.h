@@ -0,0 +1,38 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_MX6_LOAD_CLIENT_H
+#define H_ENSC_MX6_LOAD_CLIENT_H
+
+#include <stdbool.h>
+
+struct client_job {
+	char const	*socket_path;
+	char const	*file_name;
+	unsigned int	offset;
+	/* NULL selects any device which is not busy */
+	char const	*port;
+	bool		delta;
+	unsigned int	retries;
+	/* 0 selects the server default */
+	unsigned int	timeout_ms;
+};
+
+/* submits 'job' to a server started by --server and copies its progress
+ * output to stdout; returns the sysexits(3) code of the job */
+int	client_run(struct client_job const *job);
+
+#endif	/* H_ENSC_MX6_LOAD_CLIENT_H */
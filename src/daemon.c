@@ -0,0 +1,447 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "daemon.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sysexits.h>
+#include <sys/select.h>
+
+#include <libudev.h>
+
+#include "sdp.h"
+#include "util.h"
+#include "upload.h"
+#include "metrics.h"
+
+/* libusb maintains its device list from its own hotplug handling which
+ * might lag slightly behind our udev event */
+#define DAEMON_OPEN_TRIES		50u
+#define DAEMON_OPEN_DELAY_US		2000u
+
+/* entries of flashed devices whose 'remove' event was missed */
+#define DAEMON_SEEN_EXPIRE_MS		10000u
+
+struct daemon_job;
+
+struct daemon_seen_dev {
+	bool				valid;
+	/* kernel name like "1-1.4" */
+	char				port[32];
+	/* the flashed device; a new board on the port gets a new address */
+	uint8_t				bus;
+	uint8_t				addr;
+	uint64_t			t_seen;
+};
+
+struct daemon {
+	struct sdp_context		ctx;
+	struct daemon_opts const	*opts;
+
+	/* devices with a running job; an 'add' event can be seen twice
+	 * when the device appears while the initial scan is running */
+	pthread_mutex_t			lock;
+	struct daemon_job		*jobs[64];
+
+	/* devices which were flashed successfully and did not vanish yet;
+	 * protected by 'lock' */
+	struct daemon_seen_dev		seen[16];
+};
+
+struct daemon_job {
+	struct sdp_context		sdp;
+	struct daemon			*d;
+	struct daemon_opts const	*opts;
+	uint8_t				bus;
+	uint8_t				addr;
+	char				port[32];
+	unsigned int			open_tries;
+	/* time when the udev event was received */
+	uint64_t			t_event;
+};
+
+static struct daemon_seen_dev *find_seen_dev(struct daemon *d,
+					     char const *port, bool create)
+{
+	struct daemon_seen_dev	*res = NULL;
+
+	for (size_t i = 0; i < ARRAY_SIZE(d->seen); ++i) {
+		struct daemon_seen_dev	*e = &d->seen[i];
+
+		if (e->valid && strcmp(e->port, port) == 0)
+			return e;
+
+		/* prefer free entries and recycle the oldest one else */
+		if (!res || (res->valid && (!e->valid || e->t_seen < res->t_seen)))
+			res = e;
+	}
+
+	if (!create)
+		return NULL;
+
+	*res = (struct daemon_seen_dev) {
+		.valid	= true,
+	};
+	snprintf(res->port, sizeof res->port, "%s", port);
+
+	return res;
+}
+
+static void expire_seen_devs(struct daemon *d, uint64_t now)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(d->seen); ++i) {
+		if (now - d->seen[i].t_seen >= DAEMON_SEEN_EXPIRE_MS * 1000000ull)
+			d->seen[i].valid = false;
+	}
+}
+
+static bool job_match(struct sdp_context *info,
+		      struct sdp_device_info const *dev)
+{
+	struct daemon_job	*job = container_of(info, struct daemon_job, sdp);
+
+	return dev->bus == job->bus && dev->addr == job->addr;
+}
+
+static bool job_wait_for_device(struct sdp_context *info)
+{
+	struct daemon_job	*job = container_of(info, struct daemon_job, sdp);
+
+	if (++job->open_tries >= DAEMON_OPEN_TRIES)
+		return false;
+
+	usleep(DAEMON_OPEN_DELAY_US);
+	return true;
+}
+
+static bool job_register(struct daemon *d, struct daemon_job *job)
+{
+	struct daemon_job	**slot = NULL;
+
+	pthread_mutex_lock(&d->lock);
+	for (size_t i = 0; i < ARRAY_SIZE(d->jobs); ++i) {
+		struct daemon_job	*j = d->jobs[i];
+
+		if (!j) {
+			if (!slot)
+				slot = &d->jobs[i];
+		} else if (j->bus == job->bus && j->addr == job->addr) {
+			slot = NULL;
+			break;
+		}
+	}
+
+	if (slot)
+		*slot = job;
+	pthread_mutex_unlock(&d->lock);
+
+	return slot != NULL;
+}
+
+static void job_unregister(struct daemon *d, struct daemon_job *job)
+{
+	pthread_mutex_lock(&d->lock);
+	for (size_t i = 0; i < ARRAY_SIZE(d->jobs); ++i) {
+		if (d->jobs[i] == job)
+			d->jobs[i] = NULL;
+	}
+	pthread_mutex_unlock(&d->lock);
+}
+
+static void *job_thread(void *job_)
+{
+	struct daemon_job		*job = job_;
+	struct daemon_opts const	*opts = job->opts;
+	char				*buf = NULL;
+	size_t				buf_len = 0;
+	FILE				*out;
+	int				rc = EX_UNAVAILABLE;
+
+	/* collect the progress output and write it at once so that the
+	 * lines of concurrent jobs are not mixed up */
+	out = open_memstream(&buf, &buf_len);
+	if (!out)
+		out = stdout;
+
+	for (unsigned int i = 0; i <= opts->max_retries && rc != 0; ++i) {
+		struct sdp	*sdp;
+
+		if (i > 0)
+			metrics_retry(METRICS_RETRY_UPLOAD);
+
+		job->open_tries = 0;
+		sdp = sdp_open(&job->sdp);
+		if (!sdp)
+			continue;
+
+		if (i == 0) {
+			uint64_t	delta = monotonic_ns() - job->t_event;
+
+			metrics_phase(METRICS_PHASE_WAIT, delta);
+			fprintf(out, "[+%.3f ms] ", delta / 1e6);
+		}
+
+		rc = upload_image(sdp, opts->img, opts->upload, out);
+		sdp_close(sdp);
+	}
+
+	if (out != stdout) {
+		fclose(out);
+		fwrite(buf, 1, buf_len, stdout);
+		fflush(stdout);
+		free(buf);
+	}
+
+	/* the 'remove' event of the device might have been handled
+	 * already; the address tells whether a later 'add' is the same
+	 * device */
+	if (rc == 0 && job->port[0]) {
+		struct daemon_seen_dev	*e;
+
+		pthread_mutex_lock(&job->d->lock);
+		e = find_seen_dev(job->d, job->port, true);
+		e->bus    = job->bus;
+		e->addr   = job->addr;
+		e->t_seen = monotonic_ns();
+		pthread_mutex_unlock(&job->d->lock);
+	}
+
+	job_unregister(job->d, job);
+	free(job);
+	return NULL;
+}
+
+static bool get_sysattr_ul(struct udev_device *dev, char const *attr,
+			   int base, unsigned long *res)
+{
+	char const	*s = udev_device_get_sysattr_value(dev, attr);
+	char		*err;
+
+	if (!s)
+		return false;
+
+	*res = strtoul(s, &err, base);
+	return err != s && (*err == '\0' || *err == '\n');
+}
+
+static void handle_device(struct daemon *d, struct udev_device *dev,
+			  uint64_t t_event)
+{
+	char const		*action = udev_device_get_action(dev);
+	char const		*port = udev_device_get_sysname(dev);
+	struct daemon_seen_dev	*seen;
+	bool			done = false;
+	unsigned long		vid;
+	unsigned long		pid;
+	unsigned long		bus;
+	unsigned long		addr;
+	struct daemon_job	*job;
+	pthread_t		thread;
+	int			rc;
+
+	/* the board was unplugged or reset; flash whatever appears next on
+	 * this port */
+	if (action && strcmp(action, "remove") == 0) {
+		if (port) {
+			pthread_mutex_lock(&d->lock);
+			seen = find_seen_dev(d, port, false);
+			if (seen)
+				seen->valid = false;
+			pthread_mutex_unlock(&d->lock);
+		}
+
+		return;
+	}
+
+	/* action is NULL for devices found by the initial enumeration */
+	if (action && strcmp(action, "add") != 0)
+		return;
+
+	if (!get_sysattr_ul(dev, "idVendor", 16, &vid) ||
+	    !get_sysattr_ul(dev, "idProduct", 16, &pid) ||
+	    !get_sysattr_ul(dev, "busnum", 10, &bus) ||
+	    !get_sysattr_ul(dev, "devnum", 10, &addr))
+		return;
+
+	if (!sdp_find_cpu_by_usb_id(vid, pid))
+		return;
+
+	if (port) {
+		pthread_mutex_lock(&d->lock);
+		expire_seen_devs(d, t_event);
+		seen = find_seen_dev(d, port, false);
+		done = seen && seen->bus == bus && seen->addr == addr;
+		pthread_mutex_unlock(&d->lock);
+	}
+
+	if (done) {
+		printf("%s: flashed already; ignoring it\n", port);
+		fflush(stdout);
+		return;
+	}
+
+	job = malloc(sizeof *job);
+	if (!job) {
+		perror("malloc()");
+		return;
+	}
+
+	*job = (struct daemon_job) {
+		.sdp	= {
+			.usb		 = d->ctx.usb,
+			.match		 = job_match,
+			.wait_for_device = job_wait_for_device,
+		},
+		.d	 = d,
+		.opts	 = d->opts,
+		.bus	 = bus,
+		.addr	 = addr,
+		.t_event = t_event,
+	};
+
+	if (port)
+		snprintf(job->port, sizeof job->port, "%s", port);
+
+	if (!job_register(d, job)) {
+		/* device is busy or too many concurrent jobs */
+		free(job);
+		return;
+	}
+
+	rc = pthread_create(&thread, NULL, job_thread, job);
+	if (rc != 0) {
+		fprintf(stderr, "pthread_create(): %s\n", strerror(rc));
+		job_unregister(d, job);
+		free(job);
+		return;
+	}
+
+	pthread_detach(thread);
+}
+
+static void scan_devices(struct daemon *d, struct udev *udev)
+{
+	struct udev_enumerate	*e = udev_enumerate_new(udev);
+	struct udev_list_entry	*l;
+
+	if (!e)
+		return;
+
+	if (udev_enumerate_add_match_subsystem(e, "usb") < 0 ||
+	    udev_enumerate_add_match_property(e, "DEVTYPE", "usb_device") < 0 ||
+	    udev_enumerate_scan_devices(e) < 0)
+		goto out;
+
+	udev_list_entry_foreach(l, udev_enumerate_get_list_entry(e)) {
+		struct udev_device	*dev;
+
+		dev = udev_device_new_from_syspath(udev,
+						   udev_list_entry_get_name(l));
+		if (!dev)
+			continue;
+
+		handle_device(d, dev, monotonic_ns());
+		udev_device_unref(dev);
+	}
+
+out:
+	udev_enumerate_unref(e);
+}
+
+int daemon_run(struct daemon_opts const *opts)
+{
+	struct daemon		d = {
+		.opts	= opts,
+		.lock	= PTHREAD_MUTEX_INITIALIZER,
+	};
+	struct udev		*udev;
+	struct udev_monitor	*mon = NULL;
+	int			fd;
+	int			rc;
+
+	udev = udev_new();
+	if (!udev) {
+		fprintf(stderr, "udev_new() failed\n");
+		return EX_OSERR;
+	}
+
+	if (!sdp_context_init(&d.ctx)) {
+		rc = EX_UNAVAILABLE;
+		goto out;
+	}
+
+	/* listen on the raw USB device instead of the later "hid" event to
+	 * start as early as possible; the "udev" source guarantees that
+	 * rules (e.g. device permissions) have been applied already */
+	mon = udev_monitor_new_from_netlink(udev, "udev");
+	if (!mon ||
+	    udev_monitor_filter_add_match_subsystem_devtype(
+		    mon, "usb", "usb_device") < 0 ||
+	    udev_monitor_enable_receiving(mon) < 0) {
+		fprintf(stderr, "failed to setup udev monitor\n");
+		rc = EX_OSERR;
+		goto out;
+	}
+
+	fd = udev_monitor_get_fd(mon);
+	if (fd < 0) {
+		rc = EX_OSERR;
+		goto out;
+	}
+
+	/* the monitor is active already so that no device is missed */
+	scan_devices(&d, udev);
+
+	for (;;) {
+		struct udev_device	*dev;
+		fd_set			fds;
+
+		FD_ZERO(&fds);
+		FD_SET(fd, &fds);
+		if (select(fd + 1, &fds, NULL, NULL, NULL) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			perror("select()");
+			rc = EX_OSERR;
+			goto out;
+		}
+
+		dev = udev_monitor_receive_device(mon);
+		if (!dev)
+			continue;
+
+		handle_device(&d, dev, monotonic_ns());
+		udev_device_unref(dev);
+	}
+
+out:
+	if (mon)
+		udev_monitor_unref(mon);
+
+	sdp_context_destroy(&d.ctx);
+	udev_unref(udev);
+
+	return rc;
+}
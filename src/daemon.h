@@ -0,0 +1,37 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_MX6_LOAD_DAEMON_H
+#define H_ENSC_MX6_LOAD_DAEMON_H
+
+struct mx6_image;
+struct upload_opts;
+
+struct daemon_opts {
+	struct upload_opts const	*upload;
+	/* opened, stripped and pinned image; shared by all uploads */
+	struct mx6_image const		*img;
+	unsigned int			max_retries;
+};
+
+/* flashes every SDP device which is present at startup or which is
+ * plugged in later; every device is handled by its own thread so that
+ * boards on different ports are flashed concurrently.  Does not return
+ * unless setting up udev or libusb failed; the result is a sysexits(3)
+ * code then. */
+int	daemon_run(struct daemon_opts const *opts);
+
+#endif	/* H_ENSC_MX6_LOAD_DAEMON_H */
@@ -0,0 +1,158 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <endian.h>
+#include <sys/param.h>
+
+#include "util.h"
+#include "dcd.h"
+
+#define DCD_TAG_HEADER		0xd2
+#define DCD_TAG_WRITE		0xcc
+#define DCD_TAG_CHECK		0xcf
+#define DCD_TAG_NOP		0xc0
+#define DCD_TAG_UNLOCK		0xb2
+
+#define DCD_VERSION		0x40
+
+static void put_be32(uint8_t *dst, uint32_t v)
+{
+	v = htobe32(v);
+	memcpy(dst, &v, sizeof v);
+}
+
+static uint8_t *sdp_dcd_add_cmd(struct sdp_dcd *dcd, uint8_t tag,
+				uint8_t param, size_t len)
+{
+	size_t			new_sz = dcd->sz + sizeof(struct sdp_dcd_hdr) + len;
+	struct sdp_dcd_hdr	*cmd;
+
+	if (new_sz > 0xffff)
+		return NULL;
+
+	if (new_sz > dcd->allocated) {
+		size_t	alloc = MAX(new_sz, 2 * dcd->allocated);
+		void	*tmp = realloc(dcd->buf, alloc);
+
+		if (!tmp)
+			return NULL;
+
+		dcd->buf = tmp;
+		dcd->allocated = alloc;
+	}
+
+	cmd = (void *)((uint8_t *)dcd->buf + dcd->sz);
+	cmd->tag = tag;
+	cmd->length = htobe16(sizeof *cmd + len);
+	cmd->version = param;
+
+	dcd->sz = new_sz;
+	dcd->buf->hdr.length = htobe16(new_sz);
+
+	return (uint8_t *)(cmd + 1);
+}
+
+bool sdp_dcd_init(struct sdp_dcd *dcd)
+{
+	dcd->allocated = 256;
+	dcd->buf = malloc(dcd->allocated);
+	if (!dcd->buf)
+		return false;
+
+	dcd->sz = sizeof dcd->buf->hdr;
+	dcd->buf->hdr = (struct sdp_dcd_hdr) {
+		.tag		= DCD_TAG_HEADER,
+		.length		= htobe16(dcd->sz),
+		.version	= DCD_VERSION,
+	};
+
+	return true;
+}
+
+bool sdp_dcd_free(struct sdp_dcd *dcd)
+{
+	free(dcd->buf);
+	dcd->buf = NULL;
+	dcd->sz = 0;
+	dcd->allocated = 0;
+
+	return true;
+}
+
+bool sdp_dcd_data(struct sdp_dcd *dcd, uint8_t flags,
+		  struct sdp_dcd_write_data const *data, size_t cnt)
+{
+	uint8_t		*ptr;
+
+	ptr = sdp_dcd_add_cmd(dcd, DCD_TAG_WRITE, flags, cnt * 8);
+	if (!ptr)
+		return false;
+
+	for (size_t i = 0; i < cnt; ++i) {
+		put_be32(ptr + 0, data[i].addr);
+		put_be32(ptr + 4, data[i].val_mask);
+		ptr += 8;
+	}
+
+	return true;
+}
+
+bool sdp_dcd_check(struct sdp_dcd *dcd, uint8_t flags,
+		   uint32_t address, uint32_t mask, uint32_t count)
+{
+	/* a 'count' of zero means polling forever which is expressed by
+	 * omitting the field */
+	uint8_t		*ptr;
+
+	ptr = sdp_dcd_add_cmd(dcd, DCD_TAG_CHECK, flags, count ? 12 : 8);
+	if (!ptr)
+		return false;
+
+	put_be32(ptr + 0, address);
+	put_be32(ptr + 4, mask);
+	if (count)
+		put_be32(ptr + 8, count);
+
+	return true;
+}
+
+bool sdp_dcd_nop(struct sdp_dcd *dcd)
+{
+	return sdp_dcd_add_cmd(dcd, DCD_TAG_NOP, 0, 0) != NULL;
+}
+
+bool sdp_dcd_unlock(struct sdp_dcd *dcd, uint8_t eng,
+		    uint32_t const values[], size_t cnt)
+{
+	uint8_t		*ptr;
+
+	ptr = sdp_dcd_add_cmd(dcd, DCD_TAG_UNLOCK, eng, cnt * 4);
+	if (!ptr)
+		return false;
+
+	for (size_t i = 0; i < cnt; ++i)
+		put_be32(ptr + 4 * i, values[i]);
+
+	return true;
+}
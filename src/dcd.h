@@ -17,6 +17,19 @@
 #ifndef H_ENSC_MX6_LOAD_DCD_H
 #define H_ENSC_MX6_LOAD_DCD_H
 
+enum {
+	SDP_DCD_WIDTH_8		= 1,
+	SDP_DCD_WIDTH_16	= 2,
+	SDP_DCD_WIDTH_32	= 4,
+
+	/* write: clear/set bits of 'val_mask'; check: any bit instead of
+	 * all bits, check for set instead of cleared bits */
+	SDP_DCD_FLAG_MASK	= (1u << 3),
+	SDP_DCD_FLAG_SET	= (1u << 4),
+};
+
+/* header of the DCD itself and of the single commands; 'version' is the
+ * parameter byte for the latter */
 struct sdp_dcd_hdr {
 	uint8_t	tag;
 	be16_t	length;
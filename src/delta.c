@@ -0,0 +1,143 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "delta.h"
+
+#include <stdio.h>
+#include <sys/param.h>
+
+#include "util.h"
+#include "sdp.h"
+#include "image.h"
+#include "stub.h"
+
+bool delta_ddr_ready(struct sdp *sdp)
+{
+	struct sdp_cpu_info const	*cpu = sdp_get_cpu_info(sdp);
+	uint32_t			v;
+
+	if (cpu->ddr_ready.mask == 0)
+		return false;
+
+	if (!sdp_read_regl(sdp, cpu->ddr_ready.addr, &v, 1))
+		return false;
+
+	return (v & cpu->ddr_ready.mask) == cpu->ddr_ready.val;
+}
+
+static bool delta_write_full(struct sdp *sdp, struct mx6_image const *img,
+			     struct delta_stats *st)
+{
+	st->num_dirty  = st->num_blocks;
+	st->num_writes = 1;
+	st->bytes_sent = img->fsize;
+
+	return image_write(sdp, img);
+}
+
+bool delta_write(struct sdp *sdp, struct mx6_image const *img,
+		 struct stub const *stub, size_t block_size,
+		 struct delta_stats *st)
+{
+	struct sdp_cpu_info const	*cpu = sdp_get_cpu_info(sdp);
+	uint32_t			digest_addr = stub_end_addr(sdp, stub);
+	uint64_t			img_end = (uint64_t)img->load_addr + img->fsize;
+	uint64_t			stub_end = (uint64_t)cpu->stub_addr + cpu->stub_size;
+	struct stub_delta_params	params;
+	uint32_t			*digests = NULL;
+	uint8_t const			*data = img->data;
+	size_t				i;
+	bool				rc = false;
+
+	if (block_size == 0 || block_size % 4 != 0) {
+		fprintf(stderr, "bad delta block size %zu\n", block_size);
+		return false;
+	}
+
+	*st = (struct delta_stats) {
+		.num_blocks	= (img->fsize + block_size - 1) / block_size,
+	};
+
+	if (digest_addr + 4 * (uint64_t)st->num_blocks > stub_end) {
+		fprintf(stderr, "too many delta blocks; doing full upload\n");
+		return delta_write_full(sdp, img, st);
+	}
+
+	if (img->load_addr < stub_end && img_end > cpu->stub_addr) {
+		fprintf(stderr, "image overlaps stub area; doing full upload\n");
+		return delta_write_full(sdp, img, st);
+	}
+
+	digests = calloc(st->num_blocks, sizeof digests[0]);
+	if (!digests)
+		return false;
+
+	params = (struct stub_delta_params) {
+		.base		= img->load_addr,
+		.length		= img->fsize,
+		.block_size	= block_size,
+		.digests	= digest_addr,
+	};
+
+	if (!stub_run(sdp, stub, &params, sizeof params) ||
+	    !sdp_read_regl(sdp, digest_addr, digests, st->num_blocks))
+		goto out;
+
+	/* replace the target digests by a dirty flag */
+	for (i = 0; i < st->num_blocks; ++i) {
+		size_t	ofs = i * block_size;
+
+		digests[i] = (stub_fnv1a(data + ofs,
+					 MIN(block_size, img->fsize - ofs)) !=
+			      digests[i]);
+	}
+
+	i = 0;
+	while (i < st->num_blocks) {
+		size_t		first = i;
+		size_t		ofs;
+		size_t		len;
+
+		if (!digests[i]) {
+			++i;
+			continue;
+		}
+
+		/* upload a run of dirty blocks with a single WRITE_FILE */
+		while (i < st->num_blocks && digests[i])
+			++i;
+
+		ofs = first * block_size;
+		len = MIN(i * block_size, img->fsize) - ofs;
+
+		if (!sdp_write_file(sdp, img->load_addr + ofs, data + ofs, len))
+			goto out;
+
+		st->num_dirty  += i - first;
+		st->num_writes += 1;
+		st->bytes_sent += len;
+	}
+
+	rc = true;
+
+out:
+	free(digests);
+	return rc;
+}
@@ -0,0 +1,48 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_MX6_LOAD_DELTA_H
+#define H_ENSC_MX6_LOAD_DELTA_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+struct sdp;
+struct stub;
+struct mx6_image;
+
+#define DELTA_STUB_NAME		"delta-hash.bin"
+#define DELTA_BLOCK_SIZE	4096u
+
+struct delta_stats {
+	size_t		num_blocks;
+	size_t		num_dirty;
+	size_t		num_writes;
+	size_t		bytes_sent;
+};
+
+/* checks whether the DDR controller was configured by a previous boot */
+bool	delta_ddr_ready(struct sdp *sdp);
+
+/* uploads only those blocks of 'img' whose digest differs from the
+ * target memory; the digests are calculated on the target by the
+ * delta-hash stub */
+bool	delta_write(struct sdp *sdp, struct mx6_image const *img,
+		    struct stub const *stub, size_t block_size,
+		    struct delta_stats *st);
+
+#endif	/* H_ENSC_MX6_LOAD_DELTA_H */
@@ -0,0 +1,630 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Emulates the serial download mode of the i.MX6 boot ROM as a USB
+ * device by the Linux raw-gadget interface.  Together with dummy_hcd it
+ * allows end-to-end tests of mx6-usbload including the kernel USB stack:
+ *
+ *   modprobe dummy_hcd raw_gadget
+ *   mx6-sdp-emu --verbose &
+ *   mx6-usbload u-boot.imx
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sysexits.h>
+#include <sys/ioctl.h>
+#include <sys/param.h>
+
+#include <linux/hid.h>
+#include <linux/usb/ch9.h>
+#include <linux/usb/raw_gadget.h>
+
+#include "../util.h"
+#include "../delta.h"
+#include "rom.h"
+
+#define EMU_STRING_MANUFACTURER	1
+#define EMU_STRING_PRODUCT	2
+
+#define EMU_EP0_MAX		64u
+#define EMU_EP_INT_MAX		64u
+
+enum {
+	CMD_HELP = 0x1000,
+	CMD_UDC_DRIVER,
+	CMD_UDC_DEVICE,
+	CMD_VID,
+	CMD_PID,
+	CMD_CMD_DELAY,
+	CMD_CHUNK_DELAY,
+	CMD_ENUM_DELAY,
+	CMD_REBOOT_DELAY,
+	CMD_DDR_BASE,
+	CMD_DDR_SIZE,
+	CMD_STUB_DIR,
+	CMD_ONCE,
+};
+
+static struct option const		CMDLINE_OPTIONS[] = {
+	{ "help",         no_argument,       0, CMD_HELP },
+	{ "udc-driver",   required_argument, 0, CMD_UDC_DRIVER },
+	{ "udc-device",   required_argument, 0, CMD_UDC_DEVICE },
+	{ "vid",          required_argument, 0, CMD_VID },
+	{ "pid",          required_argument, 0, CMD_PID },
+	{ "cmd-delay",    required_argument, 0, CMD_CMD_DELAY },
+	{ "chunk-delay",  required_argument, 0, CMD_CHUNK_DELAY },
+	{ "enum-delay",   required_argument, 0, CMD_ENUM_DELAY },
+	{ "reboot-delay", required_argument, 0, CMD_REBOOT_DELAY },
+	{ "ddr-base",     required_argument, 0, CMD_DDR_BASE },
+	{ "ddr-size",     required_argument, 0, CMD_DDR_SIZE },
+	{ "stub-dir",     required_argument, 0, CMD_STUB_DIR },
+	{ "once",         no_argument,       0, CMD_ONCE },
+	{ "verbose",      no_argument,       0, 'v' },
+	{ NULL, 0, 0, 0 }
+};
+
+/* report layout of the i.MX boot ROM */
+static uint8_t const		HID_REPORT_DESC[] = {
+	0x06, 0x00, 0xff,		/* Usage Page (Vendor Defined) */
+	0x09, 0x01,			/* Usage (1) */
+	0xa1, 0x01,			/* Collection (Application) */
+	0x85, 0x01,			/*   Report ID (1) */
+	0x19, 0x01, 0x29, 0x01,		/*   Usage Minimum/Maximum (1) */
+	0x15, 0x00, 0x26, 0xff, 0x00,	/*   Logical Minimum/Maximum (0/255) */
+	0x75, 0x08, 0x95, 0x10,		/*   Report Size (8), Count (16) */
+	0x91, 0x02,			/*   Output (Data,Var,Abs) */
+	0x85, 0x02,			/*   Report ID (2) */
+	0x19, 0x01, 0x29, 0x01,
+	0x15, 0x00, 0x26, 0xff, 0x00,
+	0x75, 0x08, 0x96, 0x00, 0x04,	/*   Report Size (8), Count (1024) */
+	0x91, 0x02,			/*   Output (Data,Var,Abs) */
+	0x85, 0x03,			/*   Report ID (3) */
+	0x19, 0x01, 0x29, 0x01,
+	0x15, 0x00, 0x26, 0xff, 0x00,
+	0x75, 0x08, 0x95, 0x04,		/*   Report Size (8), Count (4) */
+	0x81, 0x02,			/*   Input (Data,Var,Abs) */
+	0x85, 0x04,			/*   Report ID (4) */
+	0x19, 0x01, 0x29, 0x01,
+	0x15, 0x00, 0x26, 0xff, 0x00,
+	0x75, 0x08, 0x95, 0x40,		/*   Report Size (8), Count (64) */
+	0x81, 0x02,			/*   Input (Data,Var,Abs) */
+	0xc0,				/* End Collection */
+};
+
+struct hid_descriptor {
+	uint8_t		bLength;
+	uint8_t		bDescriptorType;
+	uint16_t	bcdHID;
+	uint8_t		bCountryCode;
+	uint8_t		bNumDescriptors;
+	uint8_t		bReportDescriptorType;
+	uint16_t	wReportDescriptorLength;
+} __packed;
+
+struct emu_config_desc {
+	struct usb_config_descriptor		config;
+	struct usb_interface_descriptor		iface;
+	struct hid_descriptor			hid;
+	/* usb_endpoint_descriptor contains the audio extension */
+	uint8_t					ep[USB_DT_ENDPOINT_SIZE];
+} __packed;
+
+struct emu_control_event {
+	struct usb_raw_event		inner;
+	struct usb_ctrlrequest		ctrl;
+};
+
+struct emu_ep_io {
+	struct usb_raw_ep_io		inner;
+	uint8_t				data[1100];
+};
+
+struct emu {
+	char const		*udc_driver;
+	char const		*udc_device;
+	uint16_t		vid;
+	uint16_t		pid;
+	unsigned int		enum_delay_ms;
+	unsigned int		reboot_delay_ms;
+	bool			once;
+
+	int			fd;
+	int			ep_int;
+	uint8_t			ep_addr;
+
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	struct emu_rom		rom;
+	/* a report was taken from 'rom' but not transferred yet */
+	bool			in_flight;
+	bool			stop;
+};
+
+static void show_help(void)
+{
+	printf("Usage: mx6-sdp-emu [--verbose|-v] [--once] [--vid <id>] [--pid <id>]\n"
+	       "           [--udc-driver <name>] [--udc-device <name>]\n"
+	       "           [--cmd-delay <us>] [--chunk-delay <us>]\n"
+	       "           [--enum-delay <ms>] [--reboot-delay <ms>]\n"
+	       "           [--ddr-base <addr>] [--ddr-size <size>]\n"
+	       "           [--stub-dir <dir>]\n");
+	exit(0);
+}
+
+static int emu_ioctl(struct emu *e, unsigned long req, void *arg,
+		     char const *what)
+{
+	int	rc = ioctl(e->fd, req, arg);
+
+	if (rc < 0 && errno != ESHUTDOWN)
+		fprintf(stderr, "ioctl(%s): %m\n", what);
+
+	return rc;
+}
+
+static void *emu_int_thread(void *e_)
+{
+	struct emu	*e = e_;
+	struct emu_ep_io	io;
+
+	for (;;) {
+		size_t	len = 0;
+
+		pthread_mutex_lock(&e->lock);
+		while (!e->stop &&
+		       (e->ep_int < 0 ||
+			(len = emu_rom_next_report(&e->rom, io.data)) == 0))
+			pthread_cond_wait(&e->cond, &e->lock);
+
+		if (e->stop) {
+			pthread_mutex_unlock(&e->lock);
+			break;
+		}
+
+		e->in_flight = true;
+		pthread_mutex_unlock(&e->lock);
+
+		io.inner = (struct usb_raw_ep_io) {
+			.ep	= e->ep_int,
+			.length	= len,
+		};
+
+		/* blocks until the host reads the report */
+		emu_ioctl(e, USB_RAW_IOCTL_EP_WRITE, &io, "EP_WRITE");
+
+		pthread_mutex_lock(&e->lock);
+		e->in_flight = false;
+		pthread_cond_broadcast(&e->cond);
+		pthread_mutex_unlock(&e->lock);
+	}
+
+	return NULL;
+}
+
+static void emu_find_ep(struct emu *e)
+{
+	struct usb_raw_eps_info	info = { };
+	int			num;
+
+	num = emu_ioctl(e, USB_RAW_IOCTL_EPS_INFO, &info, "EPS_INFO");
+
+	for (int i = 0; i < num; ++i) {
+		struct usb_raw_ep_info const	*ep = &info.eps[i];
+
+		if (!ep->caps.type_int || !ep->caps.dir_in)
+			continue;
+
+		e->ep_addr = ep->addr == USB_RAW_EP_ADDR_ANY ? 1 : ep->addr;
+		return;
+	}
+
+	fprintf(stderr, "no interrupt IN endpoint available\n");
+	e->ep_addr = 1;
+}
+
+static struct usb_endpoint_descriptor emu_ep_desc(struct emu const *e)
+{
+	return (struct usb_endpoint_descriptor) {
+		.bLength		= USB_DT_ENDPOINT_SIZE,
+		.bDescriptorType	= USB_DT_ENDPOINT,
+		.bEndpointAddress	= USB_DIR_IN | e->ep_addr,
+		.bmAttributes		= USB_ENDPOINT_XFER_INT,
+		.wMaxPacketSize		= htole16(EMU_EP_INT_MAX),
+		.bInterval		= 1,
+	};
+}
+
+static size_t emu_string_desc(unsigned int idx, uint8_t *buf, size_t max)
+{
+	static char const * const	STRINGS[] = {
+		[EMU_STRING_MANUFACTURER] = "Freescale SemiConductor Inc ",
+		[EMU_STRING_PRODUCT]      = "SE Blank ARIK",
+	};
+	char const			*s;
+	size_t				len;
+
+	if (idx == 0) {
+		/* supported languages: en-US */
+		static uint8_t const	LANGS[] = { 4, USB_DT_STRING, 0x09, 0x04 };
+
+		memcpy(buf, LANGS, sizeof LANGS);
+		return sizeof LANGS;
+	}
+
+	if (idx >= ARRAY_SIZE(STRINGS) || !STRINGS[idx])
+		return 0;
+
+	s   = STRINGS[idx];
+	len = MIN(strlen(s), (max - 2) / 2);
+
+	buf[0] = 2 + 2 * len;
+	buf[1] = USB_DT_STRING;
+	for (size_t i = 0; i < len; ++i) {
+		buf[2 + 2 * i] = s[i];
+		buf[3 + 2 * i] = 0;
+	}
+
+	return buf[0];
+}
+
+static bool emu_get_descriptor(struct emu *e, struct usb_ctrlrequest const *c,
+			       struct emu_ep_io *io)
+{
+	unsigned int	type = le16toh(c->wValue) >> 8;
+	unsigned int	idx  = le16toh(c->wValue) & 0xff;
+
+	switch (type) {
+	case USB_DT_DEVICE: {
+		struct usb_device_descriptor	d = {
+			.bLength		= USB_DT_DEVICE_SIZE,
+			.bDescriptorType	= USB_DT_DEVICE,
+			.bcdUSB			= htole16(0x0200),
+			.bMaxPacketSize0	= EMU_EP0_MAX,
+			.idVendor		= htole16(e->vid),
+			.idProduct		= htole16(e->pid),
+			.bcdDevice		= htole16(0x0001),
+			.iManufacturer		= EMU_STRING_MANUFACTURER,
+			.iProduct		= EMU_STRING_PRODUCT,
+			.bNumConfigurations	= 1,
+		};
+
+		memcpy(io->data, &d, sizeof d);
+		io->inner.length = sizeof d;
+		return true;
+	}
+
+	case USB_DT_CONFIG: {
+		struct emu_config_desc		d = {
+			.config	= {
+				.bLength		= USB_DT_CONFIG_SIZE,
+				.bDescriptorType	= USB_DT_CONFIG,
+				.wTotalLength		= htole16(sizeof d),
+				.bNumInterfaces		= 1,
+				.bConfigurationValue	= 1,
+				.bmAttributes		= USB_CONFIG_ATT_ONE,
+				.bMaxPower		= 0x32,
+			},
+			.iface	= {
+				.bLength		= USB_DT_INTERFACE_SIZE,
+				.bDescriptorType	= USB_DT_INTERFACE,
+				.bNumEndpoints		= 1,
+				.bInterfaceClass	= USB_CLASS_HID,
+			},
+			.hid	= {
+				.bLength		= sizeof d.hid,
+				.bDescriptorType	= HID_DT_HID,
+				.bcdHID			= htole16(0x0110),
+				.bNumDescriptors	= 1,
+				.bReportDescriptorType	= HID_DT_REPORT,
+				.wReportDescriptorLength = htole16(sizeof HID_REPORT_DESC),
+			},
+		};
+		struct usb_endpoint_descriptor	ep = emu_ep_desc(e);
+
+		memcpy(d.ep, &ep, sizeof d.ep);
+		memcpy(io->data, &d, sizeof d);
+		io->inner.length = sizeof d;
+		return true;
+	}
+
+	case USB_DT_STRING:
+		io->inner.length = emu_string_desc(idx, io->data,
+						   sizeof io->data);
+		return io->inner.length > 0;
+
+	case HID_DT_REPORT:
+		memcpy(io->data, HID_REPORT_DESC, sizeof HID_REPORT_DESC);
+		io->inner.length = sizeof HID_REPORT_DESC;
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+static bool emu_set_configuration(struct emu *e)
+{
+	struct usb_endpoint_descriptor	ep = emu_ep_desc(e);
+	int				rc;
+
+	if (e->ep_int < 0) {
+		rc = emu_ioctl(e, USB_RAW_IOCTL_EP_ENABLE, &ep, "EP_ENABLE");
+		if (rc < 0)
+			return false;
+
+		pthread_mutex_lock(&e->lock);
+		e->ep_int = rc;
+		pthread_cond_broadcast(&e->cond);
+		pthread_mutex_unlock(&e->lock);
+	}
+
+	emu_ioctl(e, USB_RAW_IOCTL_VBUS_DRAW, (void *)(uintptr_t)0x32, "VBUS_DRAW");
+	return emu_ioctl(e, USB_RAW_IOCTL_CONFIGURE, NULL, "CONFIGURE") >= 0;
+}
+
+/* returns false when the request shall be stalled */
+static bool emu_control(struct emu *e, struct usb_ctrlrequest const *c,
+			struct emu_ep_io *io, enum emu_rom_action *action)
+{
+	io->inner = (struct usb_raw_ep_io) { .ep = 0 };
+
+	switch (c->bRequestType & USB_TYPE_MASK) {
+	case USB_TYPE_STANDARD:
+		switch (c->bRequest) {
+		case USB_REQ_GET_DESCRIPTOR:
+			return emu_get_descriptor(e, c, io);
+		case USB_REQ_SET_CONFIGURATION:
+			return emu_set_configuration(e);
+		case USB_REQ_SET_INTERFACE:
+			return true;
+		case USB_REQ_GET_STATUS:
+			io->data[0] = io->data[1] = 0;
+			io->inner.length = 2;
+			return true;
+		default:
+			return false;
+		}
+
+	case USB_TYPE_CLASS:
+		switch (c->bRequest) {
+		case HID_REQ_SET_IDLE:
+			return true;
+		case HID_REQ_SET_REPORT:
+			/* data is read by the caller; mark it */
+			io->inner.length = MIN(le16toh(c->wLength),
+					       sizeof io->data);
+			*action = EMU_ROM_CONTINUE;
+			return true;
+		default:
+			return false;
+		}
+
+	default:
+		return false;
+	}
+}
+
+/* waits until the host received all pending reports */
+static void emu_drain(struct emu *e)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += 2;
+
+	pthread_mutex_lock(&e->lock);
+	while (e->in_flight || e->rom.hab_pending || e->rom.status_pending ||
+	       e->rom.read_left > 0)
+		if (pthread_cond_timedwait(&e->cond, &e->lock, &ts) != 0)
+			break;
+	pthread_mutex_unlock(&e->lock);
+}
+
+static enum emu_rom_action emu_run_session(struct emu *e)
+{
+	struct usb_raw_init	init = {
+		.speed		= USB_SPEED_HIGH,
+	};
+	enum emu_rom_action	action = EMU_ROM_CONTINUE;
+	pthread_t		thread;
+
+	e->fd = open("/dev/raw-gadget", O_RDWR | O_CLOEXEC);
+	if (e->fd < 0) {
+		perror("open(/dev/raw-gadget)");
+		return -1;
+	}
+
+	strncpy((char *)init.driver_name, e->udc_driver,
+		sizeof init.driver_name - 1);
+	strncpy((char *)init.device_name, e->udc_device,
+		sizeof init.device_name - 1);
+
+	e->ep_int = -1;
+	e->stop   = false;
+	emu_rom_reset(&e->rom);
+
+	if (emu_ioctl(e, USB_RAW_IOCTL_INIT, &init, "INIT") < 0 ||
+	    emu_ioctl(e, USB_RAW_IOCTL_RUN, NULL, "RUN") < 0) {
+		close(e->fd);
+		return -1;
+	}
+
+	pthread_create(&thread, NULL, emu_int_thread, e);
+
+	while (action != EMU_ROM_BOOT) {
+		struct emu_control_event	ev = {
+			.inner	= {
+				.length	= sizeof ev.ctrl,
+			},
+		};
+		struct emu_ep_io		io;
+		enum emu_rom_action		act = -1;
+
+		if (emu_ioctl(e, USB_RAW_IOCTL_EVENT_FETCH, &ev, "EVENT_FETCH") < 0)
+			break;
+
+		if (ev.inner.type == USB_RAW_EVENT_CONNECT) {
+			emu_find_ep(e);
+			continue;
+		}
+
+		if (ev.inner.type != USB_RAW_EVENT_CONTROL)
+			continue;
+
+		if (!emu_control(e, &ev.ctrl, &io, &act)) {
+			emu_ioctl(e, USB_RAW_IOCTL_EP0_STALL, NULL, "EP0_STALL");
+			continue;
+		}
+
+		if (ev.ctrl.bRequestType & USB_DIR_IN) {
+			io.inner.length = MIN(io.inner.length,
+					      le16toh(ev.ctrl.wLength));
+			emu_ioctl(e, USB_RAW_IOCTL_EP0_WRITE, &io, "EP0_WRITE");
+			continue;
+		}
+
+		if (emu_ioctl(e, USB_RAW_IOCTL_EP0_READ, &io, "EP0_READ") < 0 ||
+		    act != EMU_ROM_CONTINUE)
+			continue;
+
+		/* SET_REPORT */
+		pthread_mutex_lock(&e->lock);
+		action = emu_rom_set_report(&e->rom, io.data, io.inner.length);
+		pthread_cond_broadcast(&e->cond);
+		pthread_mutex_unlock(&e->lock);
+	}
+
+	/* send the HAB status of JUMP_ADDRESS before disconnecting */
+	emu_drain(e);
+
+	pthread_mutex_lock(&e->lock);
+	e->stop = true;
+	pthread_cond_broadcast(&e->cond);
+	pthread_mutex_unlock(&e->lock);
+
+	/* completes a blocked EP_WRITE with ESHUTDOWN */
+	if (e->ep_int >= 0)
+		emu_ioctl(e, USB_RAW_IOCTL_EP_DISABLE,
+			  (void *)(uintptr_t)e->ep_int, "EP_DISABLE");
+
+	pthread_join(thread, NULL);
+	close(e->fd);
+
+	return action;
+}
+
+int main(int argc, char *argv[])
+{
+	struct emu		e = {
+		.udc_driver	 = "dummy_udc",
+		.udc_device	 = "dummy_udc.0",
+		.vid		 = 0x15a2,
+		.pid		 = 0x0054,
+		.reboot_delay_ms = 500,
+		.lock		 = PTHREAD_MUTEX_INITIALIZER,
+		.cond		 = PTHREAD_COND_INITIALIZER,
+	};
+	struct emu_rom_opts	rom_opts = {
+		.ddr_base	= 0x10000000,
+		.ddr_size	= 0x10000000,
+	};
+	char const		*stub_dir = NULL;
+	void			*stub = NULL;
+	int			rc;
+
+	while (1) {
+		int         c = getopt_long(argc, argv, "v",
+					    CMDLINE_OPTIONS, NULL);
+
+		if (c==-1)
+			break;
+
+		switch (c) {
+		case CMD_HELP        :  show_help(); break;
+		case CMD_UDC_DRIVER  :  e.udc_driver = optarg; break;
+		case CMD_UDC_DEVICE  :  e.udc_device = optarg; break;
+		case CMD_VID         :  e.vid = strtoul(optarg, NULL, 0); break;
+		case CMD_PID         :  e.pid = strtoul(optarg, NULL, 0); break;
+		case CMD_CMD_DELAY   :  rom_opts.cmd_delay_us = strtoul(optarg, NULL, 0); break;
+		case CMD_CHUNK_DELAY :  rom_opts.chunk_delay_us = strtoul(optarg, NULL, 0); break;
+		case CMD_ENUM_DELAY  :  e.enum_delay_ms = strtoul(optarg, NULL, 0); break;
+		case CMD_REBOOT_DELAY:  e.reboot_delay_ms = strtoul(optarg, NULL, 0); break;
+		case CMD_DDR_BASE    :  rom_opts.ddr_base = strtoul(optarg, NULL, 0); break;
+		case CMD_DDR_SIZE    :  rom_opts.ddr_size = strtoul(optarg, NULL, 0); break;
+		case CMD_STUB_DIR    :  stub_dir = optarg; break;
+		case CMD_ONCE        :  e.once = true; break;
+		case 'v'             :  rom_opts.verbose = true; break;
+		default:
+			fprintf(stderr, "Try --help for more information\n");
+			return EX_USAGE;
+		}
+	}
+
+	if (stub_dir) {
+		char	*path;
+
+		if (asprintf(&path, "%s/%s", stub_dir, DELTA_STUB_NAME) < 0)
+			return EX_OSERR;
+
+		rc = read_file(path, &stub, &rom_opts.delta_stub_len);
+		free(path);
+
+		if (rc)
+			return rc;
+
+		rom_opts.delta_stub = stub;
+	}
+
+	if (!emu_rom_init(&e.rom, &rom_opts))
+		return EX_OSERR;
+
+	for (;;) {
+		enum emu_rom_action	action;
+
+		/* time the ROM needs after reset until it connects */
+		if (e.enum_delay_ms)
+			usleep(e.enum_delay_ms * 1000);
+
+		action = emu_run_session(&e);
+		if (action != EMU_ROM_BOOT) {
+			rc = EX_UNAVAILABLE;
+			break;
+		}
+
+		if (e.once) {
+			rc = 0;
+			break;
+		}
+
+		/* the booted image resets the board; memory survives */
+		usleep(e.reboot_delay_ms * 1000);
+	}
+
+	emu_rom_destroy(&e.rom);
+	free(stub);
+
+	return rc;
+}
@@ -0,0 +1,497 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "rom.h"
+
+#include <unistd.h>
+#include <endian.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+
+#include "../util.h"
+#include "../dcd.h"
+#include "../image.h"
+#include "../stub/stub-abi.h"
+
+#define HAB_STATUS_OPEN		0x56787856u
+#define STATUS_WRITE_FILE	0x88888888u
+#define STATUS_WRITE_COMPLETE	0x128a8a12u
+
+#define DCD_TAG			0xd2u
+#define DCD_CMD_WRITE		0xccu
+#define DCD_CMD_CHECK		0xcfu
+#define DCD_CMD_NOP		0xc0u
+#define DCD_CMD_UNLOCK		0xb2u
+
+/* the i.MX6 memory map as far as it is reachable by SDP */
+#define EMU_OCRAM_BASE		0x00900000u
+#define EMU_OCRAM_SIZE		0x00040000u
+#define EMU_REGS_BASE		0x02000000u
+#define EMU_REGS_SIZE		0x00c00000u
+
+struct emu_report1 {
+	be16_t		cmd;
+	be32_t		address;
+	uint8_t		format;
+	be32_t		count;
+	be32_t		data;
+	uint8_t		reserved;
+} __packed;
+
+#define emu_log(_rom, _fmt, ...) do {					\
+		if ((_rom)->opts.verbose)				\
+			fprintf(stderr, "[rom] " _fmt "\n", ## __VA_ARGS__); \
+	} while (0)
+
+static uint8_t *emu_rom_mem(struct emu_rom *rom, uint32_t addr, size_t len)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(rom->regions); ++i) {
+		struct emu_rom_region	*r = &rom->regions[i];
+
+		if (addr >= r->start && len <= r->size &&
+		    addr - r->start <= r->size - len)
+			return r->mem + (addr - r->start);
+	}
+
+	return NULL;
+}
+
+bool emu_rom_init(struct emu_rom *rom, struct emu_rom_opts const *opts)
+{
+	*rom = (struct emu_rom) {
+		.opts		= *opts,
+		.regions	= {
+			{ EMU_OCRAM_BASE, EMU_OCRAM_SIZE },
+			{ EMU_REGS_BASE,  EMU_REGS_SIZE },
+			{ opts->ddr_base, opts->ddr_size },
+		},
+	};
+
+	for (size_t i = 0; i < ARRAY_SIZE(rom->regions); ++i) {
+		struct emu_rom_region	*r = &rom->regions[i];
+		void			*p;
+
+		/* pages are allocated when they are written first */
+		p = mmap(NULL, r->size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (p == MAP_FAILED) {
+			perror("mmap()");
+			emu_rom_destroy(rom);
+			return false;
+		}
+
+		r->mem = p;
+	}
+
+	return true;
+}
+
+void emu_rom_destroy(struct emu_rom *rom)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(rom->regions); ++i) {
+		struct emu_rom_region	*r = &rom->regions[i];
+
+		if (r->mem)
+			munmap(r->mem, r->size);
+
+		r->mem = NULL;
+	}
+}
+
+void emu_rom_reset(struct emu_rom *rom)
+{
+	rom->cmd            = 0;
+	rom->hab_pending    = false;
+	rom->status_pending = false;
+	rom->read_left      = 0;
+}
+
+static uint32_t emu_rom_read(struct emu_rom *rom, uint32_t addr,
+			     unsigned int width)
+{
+	uint8_t const	*p = emu_rom_mem(rom, addr, width);
+	uint32_t	v = 0;
+
+	if (p)
+		memcpy(&v, p, width);
+
+	return le32toh(v);
+}
+
+static bool emu_rom_write(struct emu_rom *rom, uint32_t addr,
+			  unsigned int width, uint32_t v)
+{
+	uint8_t		*p = emu_rom_mem(rom, addr, width);
+
+	if (!p)
+		return false;
+
+	v = htole32(v);
+	memcpy(p, &v, width);
+
+	return true;
+}
+
+static bool emu_rom_dcd_write(struct emu_rom *rom, uint8_t param,
+			      uint8_t const *data, size_t len)
+{
+	unsigned int	width = param & 7;
+
+	for (; len >= 8; data += 8, len -= 8) {
+		uint32_t	addr = be32toh(*(be32_t const *)data);
+		uint32_t	val  = be32toh(*(be32_t const *)(data + 4));
+		uint32_t	v;
+
+		switch (param & (SDP_DCD_FLAG_MASK | SDP_DCD_FLAG_SET)) {
+		case 0:
+			v = val;
+			break;
+		case SDP_DCD_FLAG_MASK:
+			v = emu_rom_read(rom, addr, width) & ~val;
+			break;
+		case SDP_DCD_FLAG_MASK | SDP_DCD_FLAG_SET:
+			v = emu_rom_read(rom, addr, width) | val;
+			break;
+		default:
+			return false;
+		}
+
+		emu_log(rom, "DCD write %08x := %08x", addr, v);
+
+		if (!emu_rom_write(rom, addr, width, v))
+			return false;
+	}
+
+	return true;
+}
+
+static bool emu_rom_dcd_check(struct emu_rom *rom, uint8_t param,
+			      uint8_t const *data, size_t len)
+{
+	unsigned int	width = param & 7;
+	uint32_t	addr;
+	uint32_t	mask;
+	uint32_t	v;
+	bool		ok;
+
+	if (len < 8)
+		return false;
+
+	addr = be32toh(*(be32_t const *)data);
+	mask = be32toh(*(be32_t const *)(data + 4));
+	v    = emu_rom_read(rom, addr, width) & mask;
+
+	switch (param & (SDP_DCD_FLAG_MASK | SDP_DCD_FLAG_SET)) {
+	case 0:					ok = v == 0; break;
+	case SDP_DCD_FLAG_SET:			ok = v == mask; break;
+	case SDP_DCD_FLAG_MASK:			ok = v != mask; break;
+	default:				ok = v != 0; break;
+	}
+
+	emu_log(rom, "DCD check %08x & %08x -> %s", addr, mask,
+		ok ? "ok" : "failed");
+
+	/* memory never changes while the ROM polls; a check which fails
+	 * initially fails forever */
+	return ok;
+}
+
+static bool emu_rom_run_dcd(struct emu_rom *rom, uint8_t const *dcd,
+			    size_t len)
+{
+	struct sdp_dcd_hdr const	*hdr = (void const *)dcd;
+	size_t				total;
+	size_t				pos;
+
+	if (len < sizeof *hdr || hdr->tag != DCD_TAG)
+		return false;
+
+	total = MIN(len, be16toh(hdr->length));
+
+	for (pos = sizeof *hdr; pos + sizeof *hdr <= total;) {
+		struct sdp_dcd_hdr const	*cmd = (void const *)(dcd + pos);
+		size_t				cmd_len = be16toh(cmd->length);
+		uint8_t const			*data = dcd + pos + sizeof *cmd;
+		size_t				data_len;
+		bool				ok;
+
+		if (cmd_len < sizeof *cmd || cmd_len > total - pos)
+			return false;
+
+		data_len = cmd_len - sizeof *cmd;
+
+		switch (cmd->tag) {
+		case DCD_CMD_WRITE:
+			ok = emu_rom_dcd_write(rom, cmd->version, data, data_len);
+			break;
+		case DCD_CMD_CHECK:
+			ok = emu_rom_dcd_check(rom, cmd->version, data, data_len);
+			break;
+		case DCD_CMD_NOP:
+		case DCD_CMD_UNLOCK:
+			ok = true;
+			break;
+		default:
+			ok = false;
+			break;
+		}
+
+		if (!ok)
+			return false;
+
+		pos += cmd_len;
+	}
+
+	return true;
+}
+
+/* plugins can not be executed; the delta-hash stub is recognized by its
+ * code and emulated */
+static void emu_rom_run_plugin(struct emu_rom *rom, uint32_t entry)
+{
+	struct stub_delta_params	p;
+	uint8_t				*params;
+	uint8_t const			*code;
+	size_t				code_len = rom->opts.delta_stub_len;
+
+	code = emu_rom_mem(rom, entry, code_len);
+	if (!code_len || !code ||
+	    memcmp(code, rom->opts.delta_stub, code_len) != 0) {
+		emu_log(rom, "plugin at %08x not emulated", entry);
+		return;
+	}
+
+	params = emu_rom_mem(rom, entry - (STUB_CODE_OFFSET - STUB_PARAMS_OFFSET),
+			     sizeof p);
+	if (!params)
+		return;
+
+	memcpy(&p, params, sizeof p);
+	p.hdr.status = 0;
+
+	for (uint32_t pos = 0, i = 0; pos < p.length; pos += p.block_size, ++i) {
+		uint32_t	l = MIN(p.block_size, p.length - pos);
+		uint8_t const	*blk = emu_rom_mem(rom, p.base + pos, l);
+
+		if (!blk || p.block_size == 0 ||
+		    !emu_rom_write(rom, p.digests + 4 * i, 4,
+				   stub_fnv1a(blk, l))) {
+			p.hdr.status = 1;
+			break;
+		}
+	}
+
+	emu_log(rom, "delta-hash of %08x+%u -> %u", p.base, p.length,
+		p.hdr.status);
+
+	p.hdr.magic = STUB_MAGIC_DONE;
+	memcpy(params, &p.hdr, sizeof p.hdr);
+}
+
+static enum emu_rom_action emu_rom_jump(struct emu_rom *rom, uint32_t addr)
+{
+	struct ivt const	*ivt = (void const *)emu_rom_mem(rom, addr, sizeof *ivt);
+	struct bdata const	*bd;
+
+	if (!ivt || (le32toh(ivt->header) & 0xffu) != IVT_TAG) {
+		emu_log(rom, "no IVT at %08x", addr);
+		return EMU_ROM_CONTINUE;
+	}
+
+	bd = (void const *)emu_rom_mem(rom, le32toh(ivt->boot_data), sizeof *bd);
+	if (bd && (le32toh(bd->flag) & 1)) {
+		emu_rom_run_plugin(rom, le32toh(ivt->entry));
+		return EMU_ROM_CONTINUE;
+	}
+
+	emu_log(rom, "booting image at %08x", le32toh(ivt->entry));
+	return EMU_ROM_BOOT;
+}
+
+static enum emu_rom_action emu_rom_report1(struct emu_rom *rom,
+					   uint8_t const *buf, size_t len)
+{
+	struct emu_report1	r;
+	enum emu_rom_action	res = EMU_ROM_CONTINUE;
+	uint32_t		width;
+
+	if (len < sizeof r) {
+		emu_log(rom, "short report1 (%zu)", len);
+		return res;
+	}
+
+	memcpy(&r, buf, sizeof r);
+	emu_rom_reset(rom);
+
+	rom->cmd      = be16toh(r.cmd);
+	rom->addr     = be32toh(r.address);
+	rom->count    = be32toh(r.count);
+	rom->received = 0;
+	width         = r.format / 8;
+
+	emu_log(rom, "cmd %04x addr %08x count %u", rom->cmd, rom->addr,
+		rom->count);
+
+	if (rom->opts.cmd_delay_us)
+		usleep(rom->opts.cmd_delay_us);
+
+	switch (rom->cmd) {
+	case 0x0101: /* READ_REGISTER */
+		rom->hab_pending = true;
+		rom->read_addr   = rom->addr;
+		rom->read_left   = rom->count;
+		break;
+
+	case 0x0202: /* WRITE_REGISTER */
+		if (width != 1 && width != 2 && width != 4)
+			width = 4;
+
+		emu_rom_write(rom, rom->addr, width, be32toh(r.data));
+		rom->hab_pending    = true;
+		rom->status_pending = true;
+		rom->status         = STATUS_WRITE_COMPLETE;
+		break;
+
+	case 0x0404: /* WRITE_FILE */
+	case 0x0a0a: /* DCD_WRITE */
+		/* completed by the report2 payload */
+		break;
+
+	case 0x0505: /* ERROR_STATUS */
+		rom->hab_pending    = true;
+		rom->status_pending = true;
+		rom->status         = rom->error_status;
+		break;
+
+	case 0x0b0b: /* JUMP_ADDRESS */
+		rom->hab_pending = true;
+		res = emu_rom_jump(rom, rom->addr);
+		break;
+
+	default:
+		emu_log(rom, "unsupported command %04x", rom->cmd);
+		rom->cmd = 0;
+		break;
+	}
+
+	return res;
+}
+
+static void emu_rom_report2(struct emu_rom *rom, uint8_t const *buf,
+			    size_t len)
+{
+	uint8_t		*dst;
+
+	if (rom->cmd != 0x0404 && rom->cmd != 0x0a0a)
+		return;
+
+	len = MIN(len, rom->count - rom->received);
+	dst = emu_rom_mem(rom, rom->addr + rom->received, len);
+	if (dst)
+		memcpy(dst, buf, len);
+	else
+		emu_log(rom, "write to %08x+%zu outside of memory",
+			rom->addr + rom->received, len);
+
+	rom->received += len;
+
+	if (rom->opts.chunk_delay_us)
+		usleep(rom->opts.chunk_delay_us);
+
+	if (rom->received < rom->count)
+		return;
+
+	rom->hab_pending    = true;
+	rom->status_pending = true;
+
+	if (rom->cmd == 0x0404) {
+		rom->status = STATUS_WRITE_FILE;
+	} else {
+		uint8_t const	*dcd = emu_rom_mem(rom, rom->addr, rom->count);
+
+		if (!dcd || !emu_rom_run_dcd(rom, dcd, rom->count))
+			emu_log(rom, "DCD failed");
+
+		rom->status = STATUS_WRITE_COMPLETE;
+	}
+
+	rom->cmd = 0;
+}
+
+enum emu_rom_action emu_rom_set_report(struct emu_rom *rom,
+				       uint8_t const *buf, size_t len)
+{
+	if (len == 0)
+		return EMU_ROM_CONTINUE;
+
+	switch (buf[0]) {
+	case 1:
+		return emu_rom_report1(rom, buf + 1, len - 1);
+	case 2:
+		emu_rom_report2(rom, buf + 1, len - 1);
+		return EMU_ROM_CONTINUE;
+	default:
+		emu_log(rom, "unexpected report %u", buf[0]);
+		return EMU_ROM_CONTINUE;
+	}
+}
+
+size_t emu_rom_next_report(struct emu_rom *rom, uint8_t *buf)
+{
+	if (rom->hab_pending) {
+		be32_t	v = htobe32(HAB_STATUS_OPEN);
+
+		buf[0] = 3;
+		memcpy(buf + 1, &v, sizeof v);
+		rom->hab_pending = false;
+
+		return 1 + sizeof v;
+	}
+
+	memset(buf, 0, EMU_ROM_REPORT_MAX);
+	buf[0] = 4;
+
+	if (rom->read_left > 0) {
+		uint32_t	l = MIN(EMU_ROM_REPORT_MAX - 1, rom->read_left);
+		uint8_t const	*src = emu_rom_mem(rom, rom->read_addr, l);
+
+		/* the ROM sends memory content as is, i.e. little endian */
+		if (src)
+			memcpy(buf + 1, src, l);
+
+		rom->read_addr += l;
+		rom->read_left -= l;
+
+		return EMU_ROM_REPORT_MAX;
+	}
+
+	if (rom->status_pending) {
+		be32_t	v = htobe32(rom->status);
+
+		memcpy(buf + 1, &v, sizeof v);
+		rom->status_pending = false;
+
+		return EMU_ROM_REPORT_MAX;
+	}
+
+	return 0;
+}
@@ -0,0 +1,96 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_MX6_LOAD_EMU_ROM_H
+#define H_ENSC_MX6_LOAD_EMU_ROM_H
+
+/* Model of the serial download part of the i.MX6 boot ROM.  It consumes
+ * the SET_REPORT requests of the host and produces the reports which
+ * are sent on the interrupt IN endpoint.  It does not know anything
+ * about USB itself. */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#define EMU_ROM_REPORT_MAX	65u
+
+struct emu_rom_opts {
+	uint32_t		ddr_base;
+	uint32_t		ddr_size;
+
+	/* processing time of a command before the HAB status is sent */
+	unsigned int		cmd_delay_us;
+	/* time for storing a report2 payload chunk */
+	unsigned int		chunk_delay_us;
+
+	/* code of the delta-hash stub; plugins with this code are
+	 * emulated natively */
+	void const		*delta_stub;
+	size_t			delta_stub_len;
+
+	bool			verbose;
+};
+
+enum emu_rom_action {
+	EMU_ROM_CONTINUE,
+	/* JUMP_ADDRESS to a non plugin image; the device leaves serial
+	 * download mode once the pending reports have been sent */
+	EMU_ROM_BOOT,
+};
+
+struct emu_rom_region {
+	uint32_t		start;
+	uint32_t		size;
+	uint8_t			*mem;
+};
+
+struct emu_rom {
+	struct emu_rom_opts	opts;
+	struct emu_rom_region	regions[3];
+
+	/* command of the last report1 */
+	uint16_t		cmd;
+	uint32_t		addr;
+	uint32_t		count;
+	uint32_t		received;
+
+	/* pending reports */
+	bool			hab_pending;
+	bool			status_pending;
+	uint32_t		status;
+	uint32_t		read_addr;
+	uint32_t		read_left;
+
+	uint32_t		error_status;
+};
+
+bool	emu_rom_init(struct emu_rom *rom, struct emu_rom_opts const *opts);
+void	emu_rom_destroy(struct emu_rom *rom);
+
+/* resets the protocol state; memory content is kept like on a warm
+ * reset */
+void	emu_rom_reset(struct emu_rom *rom);
+
+/* 'buf' starts with the report id */
+enum emu_rom_action	emu_rom_set_report(struct emu_rom *rom,
+					   uint8_t const *buf, size_t len);
+
+/* writes the next report to send into 'buf' (EMU_ROM_REPORT_MAX bytes);
+ * returns its length or 0 when nothing is pending */
+size_t	emu_rom_next_report(struct emu_rom *rom, uint8_t *buf);
+
+#endif	/* H_ENSC_MX6_LOAD_EMU_ROM_H */
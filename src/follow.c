@@ -0,0 +1,489 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "follow.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <sysexits.h>
+#include <termios.h>
+
+#include <libudev.h>
+
+#include "sdp.h"
+#include "util.h"
+
+struct follow_event {
+	uint64_t	t;
+	char		*text;
+};
+
+struct follow {
+	struct follow_opts const	*opts;
+
+	struct udev			*udev;
+	struct udev_monitor		*mon;
+	/* "<bus>-<port path>" as used by sysfs */
+	char				sysname[48];
+
+	/* monotonic time of the boot ROM enumeration */
+	uint64_t			t_origin;
+
+	int				console_fd;
+	size_t				console_bytes;
+	char				line[128];
+	size_t				line_len;
+	uint64_t			t_line;
+
+	struct follow_event		*events;
+	size_t				num_events;
+
+	bool				done;
+};
+
+static struct {
+	unsigned int	baud;
+	speed_t		speed;
+} const			BAUD_RATES[] = {
+	{   9600, B9600 },
+	{  19200, B19200 },
+	{  38400, B38400 },
+	{  57600, B57600 },
+	{ 115200, B115200 },
+	{ 230400, B230400 },
+	{ 460800, B460800 },
+	{ 921600, B921600 },
+	{ 1500000, B1500000 },
+	{ 3000000, B3000000 },
+};
+
+bool follow_parse_match(char *spec, struct follow_match *m)
+{
+	char		*ids = strchr(spec, '=');
+	unsigned long	vid;
+	unsigned long	pid;
+	char		*end;
+
+	if (!ids || ids == spec)
+		return false;
+
+	*ids++ = '\0';
+
+	vid = strtoul(ids, &end, 16);
+	if (*end != ':' || end == ids || vid > 0xffff)
+		return false;
+
+	ids = end + 1;
+	pid = strtoul(ids, &end, 16);
+	if (*end != '\0' || end == ids || pid > 0xffff)
+		return false;
+
+	*m = (struct follow_match) {
+		.label	= spec,
+		.vid	= vid,
+		.pid	= pid,
+	};
+
+	return true;
+}
+
+bool follow_parse_console(char *spec, struct follow_opts *opts)
+{
+	char	*baud = strrchr(spec, ':');
+
+	opts->console = spec;
+	opts->baud    = FOLLOW_DEFAULT_BAUD;
+
+	if (baud) {
+		char	*end;
+
+		*baud++ = '\0';
+		opts->baud = strtoul(baud, &end, 10);
+		if (*end != '\0' || end == baud)
+			return false;
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(BAUD_RATES); ++i) {
+		if (BAUD_RATES[i].baud == opts->baud)
+			return true;
+	}
+
+	return false;
+}
+
+static void follow_add(struct follow *f, uint64_t t, char const *fmt, ...)
+	__attribute__((__format__(printf, 3, 4)));
+
+static void follow_add(struct follow *f, uint64_t t, char const *fmt, ...)
+{
+	struct follow_event	*tmp;
+	va_list			ap;
+	char			*text;
+	int			rc;
+
+	va_start(ap, fmt);
+	rc = vasprintf(&text, fmt, ap);
+	va_end(ap);
+
+	if (rc < 0)
+		return;
+
+	tmp = realloc(f->events, (f->num_events + 1) * sizeof f->events[0]);
+	if (!tmp) {
+		free(text);
+		return;
+	}
+
+	f->events = tmp;
+	f->events[f->num_events++] = (struct follow_event) {
+		.t	= t,
+		.text	= text,
+	};
+}
+
+void follow_mark(struct follow *f, char const *what)
+{
+	follow_add(f, monotonic_ns(), "%s", what);
+}
+
+static int follow_open_console(struct follow *f)
+{
+	struct termios	tio;
+	speed_t		speed = B115200;
+	int		fd;
+
+	for (size_t i = 0; i < ARRAY_SIZE(BAUD_RATES); ++i) {
+		if (BAUD_RATES[i].baud == f->opts->baud)
+			speed = BAUD_RATES[i].speed;
+	}
+
+	fd = open(f->opts->console,
+		  O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "failed to open '%s': %m\n", f->opts->console);
+		return EX_NOINPUT;
+	}
+
+	if (tcgetattr(fd, &tio) == 0) {
+		cfmakeraw(&tio);
+		cfsetispeed(&tio, speed);
+		cfsetospeed(&tio, speed);
+		tio.c_cflag |= CLOCAL | CREAD;
+
+		if (tcsetattr(fd, TCSANOW, &tio) < 0) {
+			fprintf(stderr, "failed to setup '%s': %m\n",
+				f->opts->console);
+			close(fd);
+			return EX_IOERR;
+		}
+
+		/* drop data from before the upload */
+		tcflush(fd, TCIFLUSH);
+	}
+
+	f->console_fd = fd;
+	return 0;
+}
+
+static void follow_console_line(struct follow *f)
+{
+	if (f->line_len > 0)
+		follow_add(f, f->t_line, "console: %.*s",
+			   (int)f->line_len, f->line);
+
+	f->line_len = 0;
+}
+
+static void follow_read_console(struct follow *f, uint64_t now)
+{
+	uint8_t		buf[256];
+	ssize_t		l;
+
+	l = read(f->console_fd, buf, sizeof buf);
+	if (l < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+
+	if (l <= 0) {
+		follow_console_line(f);
+		follow_add(f, now, "console: closed");
+		close(f->console_fd);
+		f->console_fd = -1;
+		return;
+	}
+
+	if (f->console_bytes == 0)
+		follow_add(f, now, "console: first byte");
+
+	for (ssize_t i = 0; i < l; ++i) {
+		uint8_t		c = buf[i];
+
+		if (c == '\n') {
+			follow_console_line(f);
+			continue;
+		}
+
+		if (c == '\r')
+			continue;
+
+		if (f->line_len == 0)
+			f->t_line = now;
+
+		/* long lines are split */
+		if (f->line_len == sizeof f->line)
+			follow_console_line(f);
+
+		f->line[f->line_len++] = isprint(c) ? c : '.';
+	}
+
+	f->console_bytes += l;
+
+	if (f->console_bytes >= FOLLOW_CONSOLE_MAX) {
+		follow_console_line(f);
+		follow_add(f, now, "console: capture limit reached");
+		close(f->console_fd);
+		f->console_fd = -1;
+	}
+}
+
+/* devices behind a hub on the board are accepted too */
+static bool follow_is_port(struct follow const *f, char const *sysname)
+{
+	size_t	l = strlen(f->sysname);
+
+	return (sysname && strncmp(sysname, f->sysname, l) == 0 &&
+		(sysname[l] == '\0' || sysname[l] == '.'));
+}
+
+static unsigned int follow_sysattr_hex(struct udev_device *dev,
+				       char const *name)
+{
+	char const	*v = udev_device_get_sysattr_value(dev, name);
+
+	return v ? strtoul(v, NULL, 16) : 0;
+}
+
+static void follow_udev_event(struct follow *f, uint64_t now)
+{
+	struct udev_device	*dev = udev_monitor_receive_device(f->mon);
+	char const		*action;
+	char const		*sysname;
+
+	if (!dev)
+		return;
+
+	action  = udev_device_get_action(dev);
+	sysname = udev_device_get_sysname(dev);
+
+	if (!action || !follow_is_port(f, sysname)) {
+		;			/* noop */
+	} else if (strcmp(action, "remove") == 0) {
+		follow_add(f, now, "usb %s removed", sysname);
+	} else if (strcmp(action, "add") == 0) {
+		unsigned int		vid = follow_sysattr_hex(dev, "idVendor");
+		unsigned int		pid = follow_sysattr_hex(dev, "idProduct");
+		char const		*product;
+		char const		*label = NULL;
+		size_t			pos;
+
+		product = udev_device_get_sysattr_value(dev, "product");
+
+		for (pos = 0; pos < f->opts->num_matches && !label; ++pos) {
+			struct follow_match const	*m = &f->opts->matches[pos];
+
+			if (m->vid == vid && m->pid == pid)
+				label = m->label;
+		}
+
+		follow_add(f, now, "usb %s added: %04x:%04x \"%s\"%s%s%s",
+			   sysname, vid, pid, product ? product : "",
+			   label ? " [" : "", label ? label : "",
+			   label ? "]" : "");
+
+		/* 'pos' is behind the matching entry */
+		if (label && pos == f->opts->num_matches)
+			f->done = true;
+	}
+
+	udev_device_unref(dev);
+}
+
+void follow_destroy(struct follow *f)
+{
+	if (f->console_fd >= 0)
+		close(f->console_fd);
+
+	if (f->mon)
+		udev_monitor_unref(f->mon);
+
+	if (f->udev)
+		udev_unref(f->udev);
+
+	for (size_t i = 0; i < f->num_events; ++i)
+		free(f->events[i].text);
+
+	free(f->events);
+	free(f);
+}
+
+int follow_start(struct follow **res, struct sdp *sdp,
+		 struct follow_opts const *opts)
+{
+	struct sdp_device_info const	*info = sdp_get_device_info(sdp);
+	struct follow			*f;
+	struct udev_device		*dev;
+	uint64_t			now = monotonic_ns();
+	int				rc;
+
+	f = calloc(1, sizeof *f);
+	if (!f)
+		return EX_OSERR;
+
+	f->opts       = opts;
+	f->console_fd = -1;
+	f->t_origin   = now;
+
+	snprintf(f->sysname, sizeof f->sysname, "%u-%s", info->bus,
+		 info->port_path);
+
+	f->udev = udev_new();
+	if (f->udev)
+		f->mon = udev_monitor_new_from_netlink(f->udev, "udev");
+
+	if (!f->mon ||
+	    udev_monitor_filter_add_match_subsystem_devtype(
+		    f->mon, "usb", "usb_device") < 0 ||
+	    udev_monitor_filter_update(f->mon) < 0 ||
+	    udev_monitor_enable_receiving(f->mon) < 0) {
+		fprintf(stderr, "failed to setup udev monitor\n");
+		rc = EX_OSERR;
+		goto err;
+	}
+
+	/* the age of the SDP device tells when the ROM enumerated */
+	dev = udev_device_new_from_subsystem_sysname(f->udev, "usb",
+						     f->sysname);
+	if (dev) {
+		unsigned long long	age =
+			udev_device_get_usec_since_initialized(dev);
+
+		if (age > 0 && age * 1000u < now)
+			f->t_origin = now - age * 1000u;
+
+		udev_device_unref(dev);
+	}
+
+	follow_add(f, f->t_origin, "usb %s: boot ROM %04x:%04x%s",
+		   f->sysname, info->vid, info->pid,
+		   f->t_origin == now ? " (enumeration time unknown)" : "");
+
+	if (opts->console) {
+		rc = follow_open_console(f);
+		if (rc)
+			goto err;
+	}
+
+	*res = f;
+	return 0;
+
+err:
+	follow_destroy(f);
+	return rc;
+}
+
+int follow_run(struct follow *f)
+{
+	uint64_t	deadline = (monotonic_ns() +
+				    f->opts->timeout_ms * 1000000ull);
+	int		mon_fd = udev_monitor_get_fd(f->mon);
+	uint64_t	prev;
+
+	while (!f->done) {
+		struct pollfd	fds[2] = {
+			[0] = {
+				.fd	= mon_fd,
+				.events	= POLLIN,
+			},
+			[1] = {
+				.fd	= f->console_fd,
+				.events	= POLLIN,
+			},
+		};
+		uint64_t	now = monotonic_ns();
+		int		rc;
+
+		if (now >= deadline) {
+			follow_add(f, now, "timeout");
+			break;
+		}
+
+		rc = poll(fds, f->console_fd >= 0 ? 2 : 1,
+			  (deadline - now + 999999) / 1000000);
+		if (rc < 0 && errno == EINTR)
+			continue;
+
+		if (rc < 0) {
+			perror("poll()");
+			break;
+		}
+
+		now = monotonic_ns();
+
+		if (fds[0].revents)
+			follow_udev_event(f, now);
+
+		if (f->console_fd >= 0 && fds[1].revents)
+			follow_read_console(f, now);
+	}
+
+	if (f->console_fd >= 0)
+		follow_console_line(f);
+
+	/* console lines are stamped when they started */
+	for (size_t i = 1; i < f->num_events; ++i) {
+		struct follow_event	e = f->events[i];
+		size_t			j;
+
+		for (j = i; j > 0 && f->events[j - 1].t > e.t; --j)
+			f->events[j] = f->events[j - 1];
+
+		f->events[j] = e;
+	}
+
+	printf("Boot timeline (ms since boot ROM enumeration, +delta):\n");
+
+	prev = f->t_origin;
+	for (size_t i = 0; i < f->num_events; ++i) {
+		struct follow_event const	*e = &f->events[i];
+		int64_t				t = e->t - f->t_origin;
+
+		printf("  %10.3f %+10.3f  %s\n", t / 1e6,
+		       (int64_t)(e->t - prev) / 1e6, e->text);
+		prev = e->t;
+	}
+
+	return 0;
+}
@@ -0,0 +1,75 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef H_ENSC_MX6_LOAD_FOLLOW_H
+#define H_ENSC_MX6_LOAD_FOLLOW_H
+
+/* --follow: records what happens after the jump.  USB devices appearing
+ * at the port of the SDP device (SPL gadget, U-Boot fastboot, Linux
+ * CDC-ACM, ...) and the first lines on a serial console are timestamped
+ * and printed as a timeline.  Times are relative to the enumeration of
+ * the boot ROM, which is the earliest host visible event after
+ * power-on.
+ *
+ * The monitor is set up before the upload so that no event is lost.
+ * Following ends when a device matching the last matcher appeared or
+ * after the timeout.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct sdp;
+struct follow;
+
+#define FOLLOW_MAX_MATCHES		8u
+#define FOLLOW_DEFAULT_TIMEOUT_MS	60000u
+#define FOLLOW_DEFAULT_BAUD		115200u
+/* console data beyond this limit is ignored */
+#define FOLLOW_CONSOLE_MAX		4096u
+
+struct follow_match {
+	char const	*label;
+	uint16_t	vid;
+	uint16_t	pid;
+};
+
+struct follow_opts {
+	struct follow_match	matches[FOLLOW_MAX_MATCHES];
+	unsigned int		num_matches;
+	/* tty of the serial console or NULL */
+	char const		*console;
+	unsigned int		baud;
+	unsigned int		timeout_ms;
+};
+
+/* parses '<label>=<vid>:<pid>' */
+bool	follow_parse_match(char *spec, struct follow_match *m);
+/* parses '<tty>[:<baud>]' */
+bool	follow_parse_console(char *spec, struct follow_opts *opts);
+
+/* starts monitoring the port of 'sdp'; returns 0 or a sysexits(3)
+ * code */
+int	follow_start(struct follow **f, struct sdp *sdp,
+		     struct follow_opts const *opts);
+/* adds an event with the current time to the timeline */
+void	follow_mark(struct follow *f, char const *what);
+/* collects events and prints the timeline to stdout */
+int	follow_run(struct follow *f);
+void	follow_destroy(struct follow *f);
+
+#endif	/* H_ENSC_MX6_LOAD_FOLLOW_H */
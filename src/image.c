@@ -0,0 +1,272 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "image.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <endian.h>
+#include <sysexits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "sdp.h"
+
+/* checks for an IVT which lies within the image it describes */
+static bool image_is_ivt(void const *data, size_t len)
+{
+	struct ivt const	*ivt = data;
+	struct bdata const	*bd;
+	uint32_t		hdr;
+	uint32_t		self;
+	uint32_t		start;
+	uint64_t		end;
+	uint32_t		entry;
+
+	if (len < sizeof *ivt)
+		return false;
+
+	hdr  = le32toh(ivt->header);
+	self = le32toh(ivt->self);
+
+	/* tag, big endian length and version 4.x */
+	if ((hdr & 0x00ffffffu) != (IVT_TAG | 0x200000u) ||
+	    (hdr >> 28) != 4 ||
+	    self == 0 ||
+	    le32toh(ivt->boot_data) < self ||
+	    le32toh(ivt->boot_data) - self > len - sizeof *bd)
+		return false;
+
+	/* random data rarely passes these.  mkimage lets the boot data
+	 * of the main image start at the image base in front of the IVT. */
+	bd    = data + le32toh(ivt->boot_data) - self;
+	start = le32toh(bd->start);
+	end   = (uint64_t)start + le32toh(bd->length);
+	entry = le32toh(ivt->entry);
+
+	return (self >= start && self < end &&
+		entry >= start && entry < end);
+}
+
+/* the main image of plugin images follows the plugin code; its IVT
+ * describes itself by 'self' so that it can be found by a scan */
+static size_t image_find_main(void const *data, size_t fsize,
+			      size_t start)
+{
+	for (size_t pos = (start + 3) & ~3u; pos < fsize; pos += 4) {
+		if (image_is_ivt(data + pos, fsize - pos))
+			return pos;
+	}
+
+	return 0;
+}
+
+int image_parse(struct mx6_image *img, void *data, size_t fsize,
+		unsigned int offset)
+{
+	unsigned long		self_addr;
+	struct ivt		*ivt;
+	uint64_t		dcd_ofs = 0;
+
+	if (offset > fsize) {
+		fprintf(stderr, "offset %u out of file (%zu)\n",
+			offset, fsize);
+		return EX_DATAERR;
+	}
+
+	ivt = data + offset;
+
+	if (fsize - offset < sizeof *ivt ||
+	    (le32toh(ivt->header) & 0xffu) != IVT_TAG) {
+		/* no IVT; e.g. container images for SDPS devices */
+		*img = (struct mx6_image) {
+			.data		= data,
+			.fsize		= fsize,
+			.offset		= offset,
+		};
+
+		return 0;
+	}
+
+	self_addr = le32toh(ivt->self);
+
+	/* position of the DCD in 'data'; its header must be within it */
+	if (ivt->dcd != 0 && le32toh(ivt->dcd) >= self_addr)
+		dcd_ofs = (uint64_t)offset + le32toh(ivt->dcd) - self_addr;
+
+	if (ivt->dcd != 0 &&
+	    (le32toh(ivt->dcd) < self_addr ||
+	     dcd_ofs + sizeof(struct dcd) > fsize)) {
+		fprintf(stderr,
+			"invalid IVT settings: self=%#08x, dcd=%#08x, size=%#08zx\n",
+			(unsigned int)le32toh(ivt->self),
+			(unsigned int)le32toh(ivt->dcd),
+			fsize);
+		return EX_DATAERR;
+	}
+
+	if (self_addr < offset) {
+		fprintf(stderr, "ivt->self=%lx in padding (%x)\n",
+			self_addr, offset);
+		return EX_DATAERR;
+	}
+
+	self_addr -= offset;
+
+	*img = (struct mx6_image) {
+		.data		= data,
+		.fsize		= fsize,
+		.offset		= offset,
+		.ivt		= ivt,
+		.load_addr	= self_addr,
+	};
+
+	if (ivt->dcd != 0) {
+		img->dcd     = data + dcd_ofs;
+		img->dcd_len = (be32toh(img->dcd->header) >> 8) & 0xffff;
+
+		if (dcd_ofs + img->dcd_len > fsize) {
+			fprintf(stderr, "DCD (%zu bytes at %#llx) exceeds image (%#08zx)\n",
+				img->dcd_len, (unsigned long long)dcd_ofs,
+				fsize);
+			return EX_DATAERR;
+		}
+	}
+
+	if (le32toh(ivt->boot_data) >= self_addr &&
+	    le32toh(ivt->boot_data) - self_addr <= fsize - sizeof(struct bdata)) {
+		struct bdata const	*bd =
+			data + le32toh(ivt->boot_data) - self_addr;
+
+		img->plugin = (le32toh(bd->flag) & BDATA_FLAG_PLUGIN) != 0;
+	}
+
+	if (img->plugin)
+		img->main_offset = image_find_main(data, fsize,
+						   offset + sizeof *ivt);
+
+	return 0;
+}
+
+int image_main(struct mx6_image const *img, struct mx6_image *main_img)
+{
+	if (!img->plugin || img->main_offset == 0)
+		return EX_DATAERR;
+
+	/* the main IVT is the first byte which is loaded */
+	return image_parse(main_img, img->data + img->main_offset,
+			   img->fsize - img->main_offset, 0);
+}
+
+int image_open(struct mx6_image *img, char const *file_name,
+	       unsigned int offset)
+{
+	struct stat		st;
+	void			*data;
+	size_t			fsize;
+	int			fd;
+	int			rc;
+
+	fd = open(file_name, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "failed to open '%s': %m\n", file_name);
+		return EX_NOINPUT;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		perror("fstat()");
+		rc = EX_OSERR;
+		goto out;
+	}
+
+	fsize = st.st_size;
+	if (offset > fsize) {
+		fprintf(stderr, "offset %u out of file (%zu)\n",
+			offset, fsize);
+		rc = EX_DATAERR;
+		goto out;
+	}
+
+	data = mmap(NULL, fsize, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) {
+		perror("mmap()");
+		rc = EX_OSERR;
+		goto out;
+	}
+
+	rc = image_parse(img, data, fsize, offset);
+	if (rc)
+		munmap(data, fsize);
+
+out:
+	close(fd);
+	return rc;
+}
+
+void image_close(struct mx6_image *img)
+{
+	if (img->iov) {
+		/* bundle variant; see bundle_variant_image() */
+		free(img->data);
+		free((void *)img->iov);
+	} else if (img->data) {
+		/* munmap() removes a lock done by image_pin() too */
+		munmap(img->data, img->fsize);
+	}
+
+	img->data = NULL;
+	img->iov  = NULL;
+}
+
+void image_strip_dcd(struct mx6_image *img)
+{
+	if (img->ivt)
+		img->ivt->dcd = 0;
+}
+
+void image_pin(struct mx6_image *img)
+{
+	long			pgsz = sysconf(_SC_PAGESIZE);
+	uint8_t volatile const	*p = img->data;
+
+	if (img->iov)
+		/* bundle variants point into the bundle mapping */
+		return;
+
+	if (mlock(img->data, img->fsize) == 0)
+		return;
+
+	/* RLIMIT_MEMLOCK is usually small for unprivileged users; read the
+	 * pages at least once so that they are in the page cache */
+	madvise(img->data, img->fsize, MADV_WILLNEED);
+	for (size_t i = 0; i < img->fsize; i += pgsz)
+		(void)p[i];
+}
+
+bool image_write(struct sdp *sdp, struct mx6_image const *img)
+{
+	if (img->iov)
+		return sdp_write_filev(sdp, img->load_addr, img->iov,
+				       img->iov_cnt);
+
+	return sdp_write_file(sdp, img->load_addr, img->data, img->fsize);
+}
@@ -0,0 +1,117 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_MX6_LOAD_IMAGE_H
+#define H_ENSC_MX6_LOAD_IMAGE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "util.h"
+
+struct sdp;
+struct iovec;
+
+#define IVT_TAG		0xd1u
+/* 'flag' of the boot data */
+#define BDATA_FLAG_PLUGIN	(1u << 0)
+
+struct ivt {
+	uint32_t	header;
+	uint32_t	entry;
+	uint32_t	rsrvd1;
+	uint32_t	dcd;
+	uint32_t	boot_data;
+	uint32_t	self;
+	uint32_t	csf;
+	uint32_t	rsrvd2;
+} __packed;
+
+struct bdata {
+	uint32_t	start;
+	uint32_t	length;
+	uint32_t	flag;
+} __packed;
+
+struct dcd {
+	be32_t		header;
+	uint8_t		data[];
+} __packed;
+
+struct mx6_image {
+	void		*data;
+	size_t		fsize;
+	unsigned int	offset;
+
+	/* NULL when there is no IVT at 'offset'; such images can be
+	 * streamed to SDPS devices only */
+	struct ivt	*ivt;
+	/* target address of data[0] */
+	uint32_t	load_addr;
+
+	/* NULL when the IVT does not reference a DCD */
+	struct dcd const	*dcd;
+	size_t		dcd_len;
+
+	/* set when the boot data mark the image as a plugin.  The ROM
+	 * returns after running it and the image behind it is uploaded
+	 * separately; it starts with its own IVT at 'main_offset' (0 when
+	 * none was found). */
+	bool		plugin;
+	size_t		main_offset;
+
+	/* set when the content is not contiguous in memory (variants of
+	 * a bundle); 'data' covers the first 'head_len' bytes only which
+	 * contain IVT and DCD.  'iov' describes all 'fsize' bytes and
+	 * starts with 'data'. */
+	struct iovec const	*iov;
+	size_t		iov_cnt;
+	size_t		head_len;
+};
+
+/* returns 0 or a sysexits(3) code */
+int	image_open(struct mx6_image *img, char const *file_name,
+		   unsigned int offset);
+void	image_close(struct mx6_image *img);
+
+/* initializes 'img' from 'fsize' bytes at 'data' which stay owned by the
+ * caller; returns 0 or a sysexits(3) code */
+int	image_parse(struct mx6_image *img, void *data, size_t fsize,
+		    unsigned int offset);
+
+/* describes the image behind the plugin of 'img'; it shares the data of
+ * 'img' and must not be closed.  Returns 0 or a sysexits(3) code. */
+int	image_main(struct mx6_image const *img, struct mx6_image *main_img);
+
+/* clears the DCD pointer in the IVT so that the ROM does not execute it a
+ * second time.  The DCD itself stays accessible through 'img->dcd' and
+ * must be sent by SDP_DCD_WRITE before the image is uploaded. */
+void	image_strip_dcd(struct mx6_image *img);
+
+/* faults in and locks the image data so that later uploads do not touch
+ * the filesystem; failure to lock is not fatal */
+void	image_pin(struct mx6_image *img);
+
+/* sends the image content by WRITE_FILE to 'img->load_addr' */
+bool	image_write(struct sdp *sdp, struct mx6_image const *img);
+
+inline static uint32_t image_ivt_addr(struct mx6_image const *img)
+{
+	return img->load_addr + img->offset;
+}
+
+#endif	/* H_ENSC_MX6_LOAD_IMAGE_H */
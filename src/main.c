@@ -26,16 +26,51 @@
 #include <stdio.h>
 #include <getopt.h>
 #include <sysexits.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
 
 #include <libudev.h>
 
 #include "util.h"
+#include "image.h"
+#include "manifest.h"
+#include "metrics.h"
+#include "stub.h"
+#include "delta.h"
+#include "upload.h"
+#include "daemon.h"
+#include "server.h"
+#include "client.h"
+#include "bundle.h"
+#include "sweep.h"
+#include "cache.h"
+#include "plan.h"
+#include "follow.h"
+
+#ifndef STUBDIR
+#  define STUBDIR	"/usr/local/share/mx6-usbload"
+#endif
 
 enum {
 	CMD_HELP = 0x1000,
 	CMD_VERSION,
+	CMD_RETRIES,
+	CMD_METRICS,
+	CMD_DELTA,
+	CMD_BLOCK_SIZE,
+	CMD_STUB_DIR,
+	CMD_SERVER,
+	CMD_CLIENT,
+	CMD_PORT,
+	CMD_TIMEOUT,
+	CMD_BUNDLE,
+	CMD_SELECT,
+	CMD_SWEEP,
+	CMD_CACHE,
+	CMD_TIMING,
+	CMD_PLAN,
+	CMD_PROFILE,
+	CMD_FOLLOW,
+	CMD_FOLLOW_MATCH,
+	CMD_CONSOLE,
 };
 
 static struct option const		CMDLINE_OPTIONS[] = {
@@ -43,40 +78,100 @@ static struct option const		CMDLINE_OPTIONS[] = {
 	{ "version",      no_argument,       0, CMD_VERSION },
 	{ "offset",       required_argument, 0, 'o' },
 	{ "addr",         required_argument, 0, 'a' },
+	{ "manifest",     required_argument, 0, 'm' },
+	{ "loop",         no_argument,       0, 'l' },
+	{ "daemon",       no_argument,       0, 'd' },
+	{ "retries",      required_argument, 0, CMD_RETRIES },
+	{ "metrics",      required_argument, 0, CMD_METRICS },
+	{ "delta",        no_argument,       0, CMD_DELTA },
+	{ "block-size",   required_argument, 0, CMD_BLOCK_SIZE },
+	{ "stub-dir",     required_argument, 0, CMD_STUB_DIR },
+	{ "server",       required_argument, 0, CMD_SERVER },
+	{ "client",       required_argument, 0, CMD_CLIENT },
+	{ "port",         required_argument, 0, CMD_PORT },
+	{ "timeout",      required_argument, 0, CMD_TIMEOUT },
+	{ "bundle",       required_argument, 0, CMD_BUNDLE },
+	{ "select",       required_argument, 0, CMD_SELECT },
+	{ "sweep",        required_argument, 0, CMD_SWEEP },
+	{ "cache",        required_argument, 0, CMD_CACHE },
+	{ "timing",       no_argument,       0, CMD_TIMING },
+	{ "plan",         no_argument,       0, CMD_PLAN },
+	{ "profile",      required_argument, 0, CMD_PROFILE },
+	{ "follow",       no_argument,       0, CMD_FOLLOW },
+	{ "follow-match", required_argument, 0, CMD_FOLLOW_MATCH },
+	{ "console",      required_argument, 0, CMD_CONSOLE },
 	{ NULL, 0, 0, 0 }
 };
 
-struct ivt {
-	uint32_t	header;
-	uint32_t	entry;
-	uint32_t	rsrvd1;
-	uint32_t	dcd;
-	uint32_t	boot_data;
-	uint32_t	self;
-	uint32_t	csf;
-	uint32_t	rsrvd2;
-} __packed;
-
-struct bdata {
-	uint32_t	start;
-	uint32_t	length;
-	uint32_t	flag;
-} __packed;
-
-struct dcd {
-	be32_t		header;
-	uint8_t		data[];
-} __packed;
+struct mx6_seen_dev {
+	bool			valid;
+	bool			done;
+	uint8_t			bus;
+	uint8_t			addr;
+	unsigned int		gen;
+	unsigned int		failures;
+};
 
 struct mx6_info {
 	struct sdp_context	sdp;
 	struct udev		*udev;
 	struct udev_monitor	*udev_monitor;
+
+	/* devices handled in --loop mode; entries are dropped when the
+	 * device was not seen in the last scan */
+	unsigned int		max_retries;
+	unsigned int		scan_gen;
+	struct mx6_seen_dev	seen[16];
 };
 
 static void show_help(void)
 {
-	printf("Usage: mx6-usbload [--offset|-o <ofs>] <file>\n");
+	printf("Usage: mx6-usbload [--offset|-o <ofs>] <file>\n"
+	       "       mx6-usbload --manifest|-m <manifest>\n"
+	       "       mx6-usbload --loop|-l [--retries <n>] [--offset|-o <ofs>] <file>\n"
+	       "       mx6-usbload --daemon|-d [--retries <n>] [--offset|-o <ofs>] <file>\n"
+	       "       mx6-usbload --server <socket>\n"
+	       "       mx6-usbload --client <socket> [--port <path>] [--timeout <ms>]\n"
+	       "                   [--retries <n>] [--offset|-o <ofs>] <file>\n"
+	       "       mx6-usbload --bundle <out> --select <addr>[/<mask>]...\n"
+	       "                   [--offset|-o <ofs>] [--block-size <n>]\n"
+	       "                   <val>[,<val>...]=<file>...\n"
+	       "       mx6-usbload --sweep <template> [--port <path>] [--timeout <ms>]\n"
+	       "       mx6-usbload --plan [--profile <file>] [--port <path>]\n"
+	       "                   [--offset|-o <ofs>] <file>\n"
+	       "       mx6-usbload --follow [--follow-match <label>=<vid>:<pid>]...\n"
+	       "                   [--console <tty>[:<baud>]] [--timeout <ms>]\n"
+	       "                   [--offset|-o <ofs>] <file>\n"
+	       "\n"
+	       "  <file> can be a bundle created by --bundle; the variant is chosen\n"
+	       "  by the values of the --select registers of the device.\n"
+	       "\n"
+	       "  --metrics <addr>   export Prometheus metrics on 'unix:<path>' or\n"
+	       "                     '[<host>:]<port>'\n"
+	       "  --delta            skip DCD when DDR is still configured and upload\n"
+	       "                     only blocks which differ from target memory\n"
+	       "  --block-size <n>   block size for --delta and --bundle (%u)\n"
+	       "  --stub-dir <dir>   location of target stubs (%s)\n"
+	       "  --cache <dir>      keep local copies of images in <dir>; unchanged\n"
+	       "                     files are not read again\n"
+	       "  --timing           show the duration of DDR setup (by DCD or\n"
+	       "                     plugin), image upload and jump\n"
+	       "  --profile <file>   per port transfer profile; updated by uploads\n"
+	       "                     and used by --plan to predict their duration\n"
+	       "  --follow           print a timeline of the USB devices and console\n"
+	       "                     output which follow the jump\n"
+	       "  --follow-match <label>=<vid>:<pid>\n"
+	       "                     name devices seen by --follow; the last one\n"
+	       "                     ends following\n"
+	       "  --console <tty>[:<baud>]\n"
+	       "                     capture the first %u bytes of the serial\n"
+	       "                     console in --follow mode (%u baud)\n"
+	       "  --port <path>      USB port path (e.g. '1.4') of the device\n"
+	       "  --timeout <ms>     time to wait for a device (%u; %u for --sweep)\n"
+	       "                     or to follow the boot (%u)\n",
+	       DELTA_BLOCK_SIZE, STUBDIR, FOLLOW_CONSOLE_MAX,
+	       FOLLOW_DEFAULT_BAUD, SERVER_DEFAULT_TIMEOUT_MS,
+	       SWEEP_DEFAULT_TIMEOUT_MS, FOLLOW_DEFAULT_TIMEOUT_MS);
 	exit(0);
 }
 
@@ -86,12 +181,69 @@ static void show_version(void)
 	exit(0);
 }
 
+static struct mx6_seen_dev *find_seen_dev(struct mx6_info *mx6,
+					   struct sdp_device_info const *dev,
+					   bool create)
+{
+	struct mx6_seen_dev	*res = NULL;
+
+	for (size_t i = 0; i < ARRAY_SIZE(mx6->seen); ++i) {
+		struct mx6_seen_dev	*e = &mx6->seen[i];
+
+		if (e->valid && e->bus == dev->bus && e->addr == dev->addr)
+			return e;
+
+		/* prefer free entries and recycle the oldest one else */
+		if (!res || (res->valid && (!e->valid || e->gen < res->gen)))
+			res = e;
+	}
+
+	if (!create)
+		return NULL;
+
+	*res = (struct mx6_seen_dev) {
+		.valid	= true,
+		.bus	= dev->bus,
+		.addr	= dev->addr,
+		.gen	= mx6->scan_gen,
+	};
+
+	return res;
+}
+
+static bool match_device(struct sdp_context *info,
+			 struct sdp_device_info const *dev)
+{
+	struct mx6_info		*mx6 = container_of(info, struct mx6_info, sdp);
+	struct mx6_seen_dev	*e = find_seen_dev(mx6, dev, false);
+
+	if (!e)
+		return true;
+
+	e->gen = mx6->scan_gen;
+	return !e->done;
+}
+
+static void expire_seen_devs(struct mx6_info *mx6)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(mx6->seen); ++i) {
+		if (mx6->seen[i].gen != mx6->scan_gen)
+			mx6->seen[i].valid = false;
+	}
+
+	++mx6->scan_gen;
+}
+
 static bool wait_for_device(struct sdp_context *info)
 {
 	struct mx6_info		*mx6 = container_of(info, struct mx6_info, sdp);
 	struct udev_monitor	*mon = NULL;
 	bool			rc = false;
 
+	/* the preceding scan did not find a usable device; forget about
+	 * devices which were not seen in it */
+	expire_seen_devs(mx6);
+
 	if (!mx6->udev)
 		/* \todo: only sleep in this case? */
 		mon = NULL;
@@ -142,37 +294,225 @@ out:
 	return rc;
 }
 
-static struct sdp *create_sdp(void) {
-	struct mx6_info		mx6 = {
+static void mx6_info_init(struct mx6_info *mx6)
+{
+	*mx6 = (struct mx6_info) {
 		.sdp	= {
+			.match		 = match_device,
 			.wait_for_device = wait_for_device,
 		},
 		.udev	= udev_new(),
 	};
-	struct sdp		*sdp = sdp_open(&mx6.sdp);
+}
+
+static void mx6_info_destroy(struct mx6_info *mx6)
+{
+	if (mx6->udev_monitor)
+		udev_monitor_unref(mx6->udev_monitor);
+
+	if (mx6->udev)
+		udev_unref(mx6->udev);
+
+	sdp_context_destroy(&mx6->sdp);
+}
 
-	if (mx6.udev_monitor)
-		udev_monitor_unref(mx6.udev_monitor);
+static struct sdp *create_sdp(void) {
+	struct mx6_info		mx6;
+	struct sdp		*sdp;
 
-	if (mx6.udev)
-		udev_unref(mx6.udev);
+	mx6_info_init(&mx6);
+	sdp = sdp_open(&mx6.sdp);
+	mx6_info_destroy(&mx6);
 
 	return sdp;
 }
 
+static int drop_privileges(void)
+{
+	if (getuid() != geteuid()) {
+		uid_t	id = getuid();
+
+		if (setresuid(id, id, id) < 0) {
+			perror("setresuid()");
+			return EX_OSERR;
+		}
+	}
+
+	return 0;
+}
+
+static int run_manifest(struct sdp *sdp, char const *file_name)
+{
+	struct manifest		m;
+	int			rc;
+
+	rc = manifest_load(&m, file_name);
+	if (rc)
+		return rc;
+
+	rc = manifest_run(&m, sdp);
+	manifest_free(&m);
+
+	return rc;
+}
+
+static int upload_bundle(struct sdp *sdp, struct upload_opts const *opts)
+{
+	struct bundle			b;
+	struct bundle_variant const	*v;
+	struct mx6_image		img;
+	int				rc;
+
+	rc = bundle_open(&b, opts->file_name);
+	if (rc)
+		goto err;
+
+	rc = bundle_select(&b, sdp, &v);
+	if (!rc)
+		rc = bundle_variant_image(&b, v, &img);
+
+	if (rc) {
+		bundle_close(&b);
+		goto err;
+	}
+
+	printf("Selected variant '%s' of %s\n", v->name, opts->file_name);
+
+	image_strip_dcd(&img);
+	rc = upload_image(sdp, &img, opts, stdout);
+	image_close(&img);
+	bundle_close(&b);
+
+	return rc;
+
+err:
+	metrics_upload(metrics_port_get(sdp_get_devpath(sdp)), false, 0, 0);
+	return rc;
+}
+
+/* must be called after dropping privileges so that the cache is owned by
+ * the unprivileged user */
+static int setup_cache(struct image_cache *cache, char const *dir,
+		       struct upload_opts *opts)
+{
+	int	rc;
+
+	if (!dir)
+		return 0;
+
+	rc = image_cache_init(cache, dir);
+	if (rc)
+		return rc;
+
+	opts->cache = cache;
+	return 0;
+}
+
+static int open_image(struct mx6_image *img, struct upload_opts const *opts)
+{
+	uint64_t	t0 = monotonic_ns();
+	int		rc;
+
+	if (opts->cache)
+		rc = image_cache_open(opts->cache, img, opts->file_name,
+				      opts->offset);
+	else
+		rc = image_open(img, opts->file_name, opts->offset);
+
+	if (!rc)
+		metrics_phase(METRICS_PHASE_PREPARE, monotonic_ns() - t0);
+
+	return rc;
+}
+
+static int upload_file(struct sdp *sdp, struct upload_opts const *opts)
+{
+	struct mx6_image	img;
+	int			rc;
+
+	if (bundle_probe(opts->file_name))
+		return upload_bundle(sdp, opts);
+
+	rc = open_image(&img, opts);
+	if (rc) {
+		metrics_upload(metrics_port_get(sdp_get_devpath(sdp)),
+			       false, 0, 0);
+		return rc;
+	}
+
+	image_strip_dcd(&img);
+	rc = upload_image(sdp, &img, opts, stdout);
+	image_close(&img);
+
+	return rc;
+}
+
+/* flashes every board which shows up; runs forever */
+static int run_loop(struct mx6_info *mx6, struct upload_opts const *opts)
+{
+	if (!sdp_context_init(&mx6->sdp))
+		return EX_UNAVAILABLE;
+
+	for (;;) {
+		uint64_t		t0 = monotonic_ns();
+		struct sdp		*sdp = sdp_open(&mx6->sdp);
+		struct mx6_seen_dev	*e;
+		int			rc;
+
+		if (!sdp) {
+			/* no udev or libusb failure; avoid busy looping */
+			sleep(1);
+			continue;
+		}
+
+		metrics_phase(METRICS_PHASE_WAIT, monotonic_ns() - t0);
+
+		e = find_seen_dev(mx6, sdp_get_device_info(sdp), true);
+		if (e->failures > 0)
+			metrics_retry(METRICS_RETRY_UPLOAD);
+
+		rc = upload_file(sdp, opts);
+		sdp_close(sdp);
+
+		if (rc == 0 || ++e->failures > mx6->max_retries)
+			e->done = true;
+
+		e->gen = mx6->scan_gen;
+	}
+}
+
 int main(int argc, char *argv[])
 {
-	struct stat		st;
-	void			*data;
-	unsigned int		offset = 0x400;
-	unsigned long		addr = 0x00907000;
-	unsigned long		self_addr;
+	struct upload_opts	opts = {
+		.offset		= 0x400,
+		.block_size	= DELTA_BLOCK_SIZE,
+	};
 	struct sdp		*sdp;
-	char const		*file_name;
-	int			fd;
+	char const		*manifest_file = NULL;
+	char const		*metrics_addr = NULL;
+	bool			loop = false;
+	bool			daemon_mode = false;
+	unsigned int		retries = 0;
+	bool			delta = false;
+	char const		*stub_dir = STUBDIR;
+	struct stub		delta_stub = { };
+	char const		*server_socket = NULL;
+	char const		*client_socket = NULL;
+	char const		*port = NULL;
+	unsigned int		timeout_ms = 0;
+	char const		*bundle_file = NULL;
+	char const		*sweep_file = NULL;
+	char const		*cache_dir = NULL;
+	bool			plan = false;
+	bool			follow = false;
+	struct follow_opts	follow_opts = { };
+	struct follow		*follower = NULL;
+	struct image_cache	cache;
+	struct bundle_build_opts	bundle = { };
+	int			rc;
 
 	while (1) {
-		int         c = getopt_long(argc, argv, "o:a:",
+		int         c = getopt_long(argc, argv, "o:a:m:ld",
 					    CMDLINE_OPTIONS, NULL);
 
 		if (c==-1)
@@ -181,135 +521,325 @@ int main(int argc, char *argv[])
 		switch (c) {
 		case CMD_HELP     :  show_help(); break;
 		case CMD_VERSION  :  show_version(); break;
-		case 'o'	  :  offset = strtoul(optarg, NULL, 0); break;
-		case 'a'	  :  addr   = strtoul(optarg, NULL, 0); break;
+		case 'o'	  :  opts.offset = strtoul(optarg, NULL, 0); break;
+		case 'a':
+			/* the load address is taken from the IVT of the image */
+			fprintf(stderr, "--addr is not supported anymore\n");
+			return EX_USAGE;
+		case 'm'	  :  manifest_file = optarg; break;
+		case 'l'	  :  loop = true; break;
+		case 'd'	  :  daemon_mode = true; break;
+		case CMD_RETRIES  :  retries = strtoul(optarg, NULL, 0); break;
+		case CMD_METRICS  :  metrics_addr = optarg; break;
+		case CMD_DELTA    :  delta = true; break;
+		case CMD_BLOCK_SIZE: opts.block_size = strtoul(optarg, NULL, 0); break;
+		case CMD_STUB_DIR :  stub_dir = optarg; break;
+		case CMD_SERVER   :  server_socket = optarg; break;
+		case CMD_CLIENT   :  client_socket = optarg; break;
+		case CMD_PORT     :  port = optarg; break;
+		case CMD_TIMEOUT  :  timeout_ms = strtoul(optarg, NULL, 0); break;
+		case CMD_BUNDLE   :  bundle_file = optarg; break;
+		case CMD_SWEEP    :  sweep_file = optarg; break;
+		case CMD_CACHE    :  cache_dir = optarg; break;
+		case CMD_TIMING   :  opts.timing = true; break;
+		case CMD_PLAN     :  plan = true; break;
+		case CMD_PROFILE  :  opts.profile = optarg; break;
+		case CMD_FOLLOW   :  follow = true; break;
+		case CMD_CONSOLE:
+			if (!follow_parse_console(optarg, &follow_opts)) {
+				fprintf(stderr, "bad console '%s'\n", optarg);
+				return EX_USAGE;
+			}
+			break;
+		case CMD_FOLLOW_MATCH:
+			if (follow_opts.num_matches == FOLLOW_MAX_MATCHES) {
+				fprintf(stderr, "too many --follow-match options\n");
+				return EX_USAGE;
+			}
+
+			if (!follow_parse_match(optarg, &follow_opts.matches[follow_opts.num_matches++])) {
+				fprintf(stderr, "bad matcher '%s'\n", optarg);
+				return EX_USAGE;
+			}
+			break;
+		case CMD_SELECT:
+			if (bundle.num_selectors == BUNDLE_MAX_SELECTORS) {
+				fprintf(stderr, "too many --select options\n");
+				return EX_USAGE;
+			}
+
+			if (!bundle_parse_selector(optarg, &bundle.selectors[bundle.num_selectors++])) {
+				fprintf(stderr, "bad selector '%s'\n", optarg);
+				return EX_USAGE;
+			}
+			break;
 		default:
 			fprintf(stderr, "Try --help for more information\n");
 			return EX_USAGE;
 		}
 	}
 
-	if (optind >= argc) {
+	if (!manifest_file && !server_socket && !sweep_file && optind >= argc) {
 		fprintf(stderr, "missing filename\n");
 		return EX_USAGE;
 	}
 
-	file_name = argv[optind];
+	if (!!manifest_file + loop + daemon_mode + !!server_socket +
+	    !!client_socket + !!bundle_file + !!sweep_file + plan > 1) {
+		fprintf(stderr, "--manifest, --loop, --daemon, --server, --client, --bundle, --sweep and --plan are exclusive\n");
+		return EX_USAGE;
+	}
 
-	sdp = create_sdp();
-	if (!sdp)
-		return EX_UNAVAILABLE;
+	if (follow && (loop || daemon_mode || server_socket || client_socket ||
+		       bundle_file || sweep_file || plan)) {
+		fprintf(stderr, "--follow works for single uploads only\n");
+		return EX_USAGE;
+	}
 
-	if (getuid() != geteuid()) {
-		uid_t	id = getuid();
+	follow_opts.timeout_ms = (timeout_ms ? timeout_ms :
+				  FOLLOW_DEFAULT_TIMEOUT_MS);
 
-		if (setresuid(id, id, id) < 0) {
-			perror("setresuid()");
+	if (plan)
+		return plan_run(&(struct plan_opts) {
+				.file_name	= argv[optind],
+				.offset		= opts.offset,
+				.profile	= opts.profile,
+				.port		= port,
+			});
+
+	if (bundle_file) {
+		struct bundle_build_variant	*variants;
+
+		variants = calloc(argc - optind, sizeof variants[0]);
+		if (!variants)
 			return EX_OSERR;
+
+		for (int i = optind; i < argc; ++i) {
+			if (!bundle_parse_variant(argv[i], bundle.num_selectors,
+						  &variants[i - optind])) {
+				fprintf(stderr, "bad variant '%s'\n", argv[i]);
+				free(variants);
+				return EX_USAGE;
+			}
 		}
-	}
 
-	fd = open(file_name, O_RDONLY);
-	if (fd < 0) {
-		fprintf(stderr, "failed to open '%s': %m\n", file_name);
-		return EX_NOINPUT;
+		bundle.out_file     = bundle_file;
+		bundle.block_size   = opts.block_size;
+		bundle.offset       = opts.offset;
+		bundle.variants     = variants;
+		bundle.num_variants = argc - optind;
+
+		rc = bundle_build(&bundle);
+		free(variants);
+
+		return rc;
 	}
 
-#if 0
-	struct ivt	ivt = {
-		.header	= htobe32((0xd1u << 24) | ((sizeof ivt) << 8) | 0x40),
-		.entry	= htole32(addr + 0x100),
-		.dcd	= 0,
-		.boot_data = htole32(addr + sizeof ivt),
-		.self	= htole32(addr),
-	};
-	struct bdata	bdata = {
-		.start	= htole32(addr + 0x100),
-	};
-#else
-	(void)addr;
-#endif
+	if (!manifest_file && !server_socket && !sweep_file)
+		opts.file_name = argv[optind];
+
+	if (client_socket)
+		return client_run(&(struct client_job) {
+				.socket_path	= client_socket,
+				.file_name	= opts.file_name,
+				.offset		= opts.offset,
+				.port		= port,
+				.delta		= delta,
+				.retries	= retries,
+				.timeout_ms	= timeout_ms,
+			});
+
+	if (metrics_addr && !metrics_serve(metrics_addr))
+		return EX_UNAVAILABLE;
 
-	struct ivt	*ivt;
-	struct dcd	*dcd;
-	size_t		dcd_len;
-	size_t		fsize;
+	if (sweep_file) {
+		struct sweep_template	tmpl;
+		struct stub		bench_stub;
 
-//	uint32_t	tmp;
+		rc = drop_privileges();
+		if (rc)
+			return rc;
 
-	if (fstat(fd, &st) < 0) {
-		perror("fstat()");
-		return EX_OSERR;
-	}
+		rc = sweep_load(&tmpl, sweep_file);
+		if (rc)
+			return rc;
 
-	fsize = st.st_size;
-	if (offset > fsize) {
-		fprintf(stderr, "offset %u out of file (%zu)\n",
-			offset, fsize);
-		return EX_DATAERR;
-	}
+		rc = stub_load(&bench_stub, stub_dir, SWEEP_STUB_NAME);
+		if (rc) {
+			sweep_free(&tmpl);
+			return rc;
+		}
 
-	data = mmap(NULL, fsize, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
-	if (data == MAP_FAILED) {
-		perror("mmap()");
-		return EX_OSERR;
+		rc = sweep_run(&tmpl, &(struct sweep_opts) {
+				.port		= port,
+				.stub		= &bench_stub,
+				.timeout_ms	= (timeout_ms ? timeout_ms :
+						   SWEEP_DEFAULT_TIMEOUT_MS),
+			});
+
+		stub_free(&bench_stub);
+		sweep_free(&tmpl);
+
+		return rc;
 	}
 
-	ivt = data + offset;
-	self_addr = le32toh(ivt->self);
-
-	if (le32toh(ivt->dcd) < self_addr ||
-	    le32toh(ivt->dcd) - self_addr > fsize) {
-		fprintf(stderr,
-			"invalid IVT settings: self=%#08x, dcd=%#08x, size=%#08zx\n",
-			(unsigned int)le32toh(ivt->self),
-			(unsigned int)le32toh(ivt->dcd),
-			fsize);
-		return EX_DATAERR;
+	if (server_socket) {
+		rc = drop_privileges();
+		if (rc)
+			return rc;
+
+		if (delta) {
+			rc = stub_load(&delta_stub, stub_dir, DELTA_STUB_NAME);
+			if (rc)
+				return rc;
+		}
+
+		rc = setup_cache(&cache, cache_dir, &opts);
+		if (rc)
+			return rc;
+
+		rc = server_run(&(struct server_opts) {
+				.socket_path	= server_socket,
+				.delta_stub	= delta ? &delta_stub : NULL,
+				.block_size	= opts.block_size,
+				.cache		= opts.cache,
+				.profile	= opts.profile,
+			});
+
+		if (opts.cache)
+			image_cache_destroy(opts.cache);
+
+		stub_free(&delta_stub);
+		return rc;
 	}
 
-	if (self_addr < offset) {
-		fprintf(stderr, "ivt->self=%lx in padding (%x)\n",
-			self_addr, offset);
-		return EX_DATAERR;
+	if (daemon_mode) {
+		struct mx6_image	img;
+
+		rc = drop_privileges();
+		if (rc)
+			return rc;
+
+		if (delta) {
+			rc = stub_load(&delta_stub, stub_dir, DELTA_STUB_NAME);
+			if (rc)
+				return rc;
+
+			opts.delta_stub = &delta_stub;
+		}
+
+		rc = setup_cache(&cache, cache_dir, &opts);
+		if (rc)
+			return rc;
+
+		if (bundle_probe(opts.file_name)) {
+			fprintf(stderr, "bundles are not supported in --daemon mode\n");
+			return EX_USAGE;
+		}
+
+		/* the image is parsed only once and kept in memory; changes
+		 * of the file require a restart */
+		rc = open_image(&img, &opts);
+		if (rc)
+			return rc;
+
+		image_strip_dcd(&img);
+		image_pin(&img);
+
+		rc = daemon_run(&(struct daemon_opts) {
+				.upload		= &opts,
+				.img		= &img,
+				.max_retries	= retries,
+			});
+
+		image_close(&img);
+		if (opts.cache)
+			image_cache_destroy(opts.cache);
+		stub_free(&delta_stub);
+
+		return rc;
 	}
 
-	self_addr -= offset;
-	dcd = data + le32toh(ivt->dcd) - self_addr;
-	dcd_len = (be32toh(dcd->header) >> 8) & 0xffff;
+	if (loop) {
+		struct mx6_info	mx6;
 
-	printf("Uploading image to %s...", sdp_get_devpath(sdp));
+		/* privileges are dropped before the first device is
+		 * opened; the station must grant access to the devices
+		 * (e.g. by udev rules) */
+		rc = drop_privileges();
+		if (rc)
+			return rc;
 
-	printf(" DCD[%zu]", dcd_len);
-	fflush(stdout);
+		if (delta) {
+			rc = stub_load(&delta_stub, stub_dir, DELTA_STUB_NAME);
+			if (rc)
+				return rc;
 
-	if (!sdp_write_dcd(sdp, dcd, dcd_len))
-		return EX_OSERR;
+			opts.delta_stub = &delta_stub;
+		}
 
-	ivt->dcd = 0;
+		rc = setup_cache(&cache, cache_dir, &opts);
+		if (rc)
+			return rc;
 
-	printf(" FILE[%08lx+%zu]", self_addr, fsize);
-	fflush(stdout);
-	if (!sdp_write_file(sdp, self_addr, data, fsize) ||
-	    !sdp_jump(sdp, self_addr + offset))
-		return EX_OSERR;
+		mx6_info_init(&mx6);
+		mx6.max_retries = retries;
 
-#if 0
-	if (!sdp_write_file(sdp, addr, &ivt, sizeof ivt) ||
-	    !sdp_write_file(sdp, addr + sizeof ivt, &bdata, sizeof bdata) ||
-	    !sdp_write_file(sdp, addr + 0x100, data, fsize) ||
-	    !sdp_jump(sdp, addr))
-		return EX_OSERR;
-#endif
+		rc = run_loop(&mx6, &opts);
+		mx6_info_destroy(&mx6);
+		if (opts.cache)
+			image_cache_destroy(opts.cache);
+		stub_free(&delta_stub);
 
-#if 0
-	sdp_read_regl(sdp, addr, &tmp);
-	sdp_read_regl(sdp, 0xd0, &tmp);
-	sdp_read_regl(sdp, be32toh(tmp) + 4, &tmp);
-#endif
+		return rc;
+	}
+
+	sdp = create_sdp();
+	if (!sdp)
+		return EX_UNAVAILABLE;
+
+	rc = drop_privileges();
+	if (rc)
+		return rc;
+
+	if (delta) {
+		rc = stub_load(&delta_stub, stub_dir, DELTA_STUB_NAME);
+		if (rc)
+			return rc;
+
+		opts.delta_stub = &delta_stub;
+	}
 
+	rc = setup_cache(&cache, cache_dir, &opts);
+	if (rc)
+		return rc;
+
+	if (follow) {
+		rc = follow_start(&follower, sdp, &follow_opts);
+		if (rc)
+			return rc;
+
+		follow_mark(follower, "upload started");
+	}
+
+	if (manifest_file)
+		rc = run_manifest(sdp, manifest_file);
+	else
+		rc = upload_file(sdp, &opts);
 
 	sdp_close(sdp);
 
-	printf(" done\n");
+	if (follower) {
+		if (rc == 0) {
+			follow_mark(follower, "upload finished");
+			rc = follow_run(follower);
+		}
+
+		follow_destroy(follower);
+	}
+	if (opts.cache)
+		image_cache_destroy(opts.cache);
+	stub_free(&delta_stub);
+
+	return rc;
 }
@@ -0,0 +1,893 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "manifest.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sysexits.h>
+#include <sys/stat.h>
+
+#include "util.h"
+#include "sdp.h"
+#include "dcd.h"
+#include "image.h"
+
+#define MANIFEST_POLL_TIMEOUT_MS	1000u
+
+struct manifest_image {
+	char			*path;
+	struct mx6_image	img;
+};
+
+struct manifest_parser {
+	struct manifest		*m;
+	unsigned int		line;
+	bool			have_ivt;
+	uint32_t		ivt_addr;
+};
+
+static char const * const	OP_NAMES[] = {
+	[MANIFEST_OP_DCD]	= "dcd",
+	[MANIFEST_OP_WRITE]	= "write",
+	[MANIFEST_OP_WRITE_REG]	= "wreg",
+	[MANIFEST_OP_READ_REG]	= "rreg",
+	[MANIFEST_OP_POLL]	= "poll",
+	[MANIFEST_OP_JUMP]	= "jump",
+};
+
+static struct {
+	char const		*name;
+	enum manifest_op	op;
+	unsigned int		width;
+	unsigned int		min_args;
+	unsigned int		max_args;
+} const				MANIFEST_CMDS[] = {
+	{ "dcd",    MANIFEST_OP_DCD,       0, 1, 2 },
+	{ "image",  MANIFEST_OP_WRITE,     0, 1, 2 },
+	{ "write",  MANIFEST_OP_WRITE,     0, 2, 2 },
+	{ "writeb", MANIFEST_OP_WRITE_REG, 1, 2, 2 },
+	{ "writew", MANIFEST_OP_WRITE_REG, 2, 2, 2 },
+	{ "writel", MANIFEST_OP_WRITE_REG, 4, 2, 2 },
+	{ "readb",  MANIFEST_OP_READ_REG,  1, 1, 2 },
+	{ "readw",  MANIFEST_OP_READ_REG,  2, 1, 2 },
+	{ "readl",  MANIFEST_OP_READ_REG,  4, 1, 2 },
+	{ "poll",   MANIFEST_OP_POLL,      4, 3, 5 },
+	{ "jump",   MANIFEST_OP_JUMP,      0, 0, 1 },
+};
+
+static void parse_error(struct manifest_parser const *p, char const *fmt, ...)
+	__attribute__((__format__(printf, 2, 3)));
+
+static void parse_error(struct manifest_parser const *p, char const *fmt, ...)
+{
+	va_list		ap;
+
+	fprintf(stderr, "%s:%u: ", p->m->file_name, p->line);
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+
+	fputc('\n', stderr);
+}
+
+static bool parse_u32(char const *str, uint32_t *val)
+{
+	unsigned long long	v;
+	char			*end;
+
+	errno = 0;
+	v = strtoull(str, &end, 0);
+	if (errno != 0 || end == str || *end || v > UINT32_MAX)
+		return false;
+
+	*val = v;
+	return true;
+}
+
+static char *resolve_path(struct manifest const *m, char const *name)
+{
+	char const	*sep = strrchr(m->file_name, '/');
+	char		*res;
+
+	if (name[0] == '/' || !sep)
+		return strdup(name);
+
+	if (asprintf(&res, "%.*s/%s", (int)(sep - m->file_name),
+		     m->file_name, name) < 0)
+		return NULL;
+
+	return res;
+}
+
+static int manifest_get_image(struct manifest *m, char const *path,
+			      unsigned int offset, struct mx6_image **img)
+{
+	struct manifest_image	*mi;
+	void			*tmp;
+	int			rc;
+
+	for (size_t i = 0; i < m->num_images; ++i) {
+		mi = m->images[i];
+
+		if (strcmp(mi->path, path) == 0 && mi->img.offset == offset) {
+			*img = &mi->img;
+			return 0;
+		}
+	}
+
+	tmp = realloc(m->images, (m->num_images + 1) * sizeof m->images[0]);
+	if (!tmp)
+		return EX_OSERR;
+
+	m->images = tmp;
+
+	mi = calloc(1, sizeof *mi);
+	if (!mi)
+		return EX_OSERR;
+
+	mi->path = strdup(path);
+	rc = mi->path ? image_open(&mi->img, path, offset) : EX_OSERR;
+	if (rc) {
+		free(mi->path);
+		free(mi);
+		return rc;
+	}
+
+	m->images[m->num_images++] = mi;
+	*img = &mi->img;
+
+	return 0;
+}
+
+static int manifest_add_step(struct manifest *m,
+			     struct manifest_step const *step)
+{
+	void	*tmp;
+
+	tmp = realloc(m->steps, (m->num_steps + 1) * sizeof m->steps[0]);
+	if (!tmp)
+		return EX_OSERR;
+
+	m->steps = tmp;
+	m->steps[m->num_steps++] = *step;
+
+	return 0;
+}
+
+static int manifest_parse_file_arg(struct manifest_parser *p,
+				   char const *name, char const *ofs_str,
+				   struct mx6_image **img)
+{
+	uint32_t	offset = 0x400;
+	char		*path;
+	int		rc;
+
+	if (ofs_str && !parse_u32(ofs_str, &offset)) {
+		parse_error(p, "bad offset '%s'", ofs_str);
+		return EX_DATAERR;
+	}
+
+	path = resolve_path(p->m, name);
+	if (!path)
+		return EX_OSERR;
+
+	rc = manifest_get_image(p->m, path, offset, img);
+	free(path);
+
+	if (rc == 0 && !(*img)->ivt) {
+		parse_error(p, "no IVT in '%s' at offset %#x", name, offset);
+		rc = EX_DATAERR;
+	}
+
+	return rc;
+}
+
+static int manifest_parse_line(struct manifest_parser *p, char *line)
+{
+	char			*args[5];
+	unsigned int		num_args = 0;
+	char			*tok;
+	char			*saveptr;
+	char			*cmd;
+	size_t			i;
+	struct manifest_step	step = {
+		.line		= p->line,
+		.num_merged	= 1,
+	};
+	struct mx6_image	*img;
+	int			rc;
+
+	tok = strchr(line, '#');
+	if (tok)
+		*tok = '\0';
+
+	cmd = strtok_r(line, " \t\r\n", &saveptr);
+	if (!cmd)
+		return 0;
+
+	while ((tok = strtok_r(NULL, " \t\r\n", &saveptr)) != NULL) {
+		if (num_args == ARRAY_SIZE(args)) {
+			parse_error(p, "too many arguments");
+			return EX_DATAERR;
+		}
+
+		args[num_args++] = tok;
+	}
+
+	if (strcmp(cmd, "cpu") == 0) {
+		if (num_args != 1) {
+			parse_error(p, "'cpu' requires exactly one argument");
+			return EX_DATAERR;
+		}
+
+		p->m->cpu = sdp_find_cpu_info(args[0]);
+		if (!p->m->cpu) {
+			parse_error(p, "unknown cpu '%s'", args[0]);
+			return EX_DATAERR;
+		}
+
+		return 0;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(MANIFEST_CMDS); ++i) {
+		if (strcmp(MANIFEST_CMDS[i].name, cmd) == 0)
+			break;
+	}
+
+	if (i == ARRAY_SIZE(MANIFEST_CMDS)) {
+		parse_error(p, "unknown command '%s'", cmd);
+		return EX_DATAERR;
+	}
+
+	if (num_args < MANIFEST_CMDS[i].min_args ||
+	    num_args > MANIFEST_CMDS[i].max_args) {
+		parse_error(p, "bad number of arguments for '%s'", cmd);
+		return EX_DATAERR;
+	}
+
+	step.op    = MANIFEST_CMDS[i].op;
+	step.width = MANIFEST_CMDS[i].width;
+
+	switch (step.op) {
+	case MANIFEST_OP_DCD:
+		rc = manifest_parse_file_arg(p, args[0],
+					     num_args > 1 ? args[1] : NULL,
+					     &img);
+		if (rc)
+			return rc;
+
+		if (!img->dcd) {
+			parse_error(p, "'%s' does not contain a DCD", args[0]);
+			return EX_DATAERR;
+		}
+
+		step.data = img->dcd;
+		step.len  = img->dcd_len;
+		break;
+
+	case MANIFEST_OP_WRITE:
+		if (strcmp(cmd, "image") == 0) {
+			rc = manifest_parse_file_arg(p, args[0],
+						     num_args > 1 ? args[1] : NULL,
+						     &img);
+			if (rc)
+				return rc;
+
+			/* DCD must be sent explicitly by a 'dcd' step */
+			image_strip_dcd(img);
+
+			step.addr = img->load_addr;
+			step.data = img->data;
+			step.len  = img->fsize;
+
+			p->have_ivt = true;
+			p->ivt_addr = image_ivt_addr(img);
+		} else {
+			char	*path;
+
+			if (!parse_u32(args[0], &step.addr)) {
+				parse_error(p, "bad address '%s'", args[0]);
+				return EX_DATAERR;
+			}
+
+			path = resolve_path(p->m, args[1]);
+			if (!path)
+				return EX_OSERR;
+
+			rc = read_file(path, &step.owned, &step.len);
+			free(path);
+			if (rc)
+				return rc;
+
+			step.data = step.owned;
+		}
+		break;
+
+	case MANIFEST_OP_WRITE_REG:
+	case MANIFEST_OP_READ_REG:
+	case MANIFEST_OP_POLL: {
+		uint32_t	cnt = 1;
+		uint32_t	timeout = MANIFEST_POLL_TIMEOUT_MS;
+		bool		ok;
+
+		ok = parse_u32(args[0], &step.addr);
+
+		if (step.op == MANIFEST_OP_WRITE_REG)
+			ok = ok && parse_u32(args[1], &step.val);
+		else if (step.op == MANIFEST_OP_READ_REG)
+			ok = ok && (num_args < 2 || parse_u32(args[1], &cnt));
+		else
+			ok = (ok && parse_u32(args[1], &step.mask) &&
+			      parse_u32(args[2], &step.val) &&
+			      (num_args < 4 || parse_u32(args[3], &timeout)));
+
+		if (!ok) {
+			parse_error(p, "bad numeric argument");
+			return EX_DATAERR;
+		}
+
+		if (num_args < 5)
+			step.poll_mode = SDP_POLL_AUTO;
+		else if (strcmp(args[4], "auto") == 0)
+			step.poll_mode = SDP_POLL_AUTO;
+		else if (strcmp(args[4], "host") == 0)
+			step.poll_mode = SDP_POLL_HOST;
+		else if (strcmp(args[4], "dcd") == 0)
+			step.poll_mode = SDP_POLL_DCD;
+		else {
+			parse_error(p, "bad poll mode '%s'", args[4]);
+			return EX_DATAERR;
+		}
+
+		if (step.width < 4 &&
+		    step.val >= (UINT32_C(1) << (step.width * 8))) {
+			parse_error(p, "value %#x too large", step.val);
+			return EX_DATAERR;
+		}
+
+		if (step.addr % step.width) {
+			parse_error(p, "unaligned address %#x", step.addr);
+			return EX_DATAERR;
+		}
+
+		step.cnt = cnt;
+		step.timeout_ms = timeout;
+		break;
+	}
+
+	case MANIFEST_OP_JUMP:
+		if (num_args > 0) {
+			if (!parse_u32(args[0], &step.addr)) {
+				parse_error(p, "bad address '%s'", args[0]);
+				return EX_DATAERR;
+			}
+		} else if (p->have_ivt) {
+			step.addr = p->ivt_addr;
+		} else {
+			parse_error(p, "'jump' without address requires a preceding 'image'");
+			return EX_DATAERR;
+		}
+		break;
+	}
+
+	rc = manifest_add_step(p->m, &step);
+	if (rc)
+		free(step.owned);
+
+	return rc;
+}
+
+int manifest_load(struct manifest *m, char const *file_name)
+{
+	struct manifest_parser	p = {
+		.m	= m,
+	};
+	FILE			*f;
+	char			*line = NULL;
+	size_t			line_sz = 0;
+	int			rc = 0;
+
+	*m = (struct manifest) {
+		.file_name	= file_name,
+	};
+
+	f = fopen(file_name, "r");
+	if (!f) {
+		fprintf(stderr, "failed to open '%s': %m\n", file_name);
+		return EX_NOINPUT;
+	}
+
+	while (rc == 0 && getline(&line, &line_sz, f) >= 0) {
+		++p.line;
+		rc = manifest_parse_line(&p, line);
+	}
+
+	if (rc == 0 && ferror(f)) {
+		fprintf(stderr, "failed to read '%s'\n", file_name);
+		rc = EX_IOERR;
+	}
+
+	free(line);
+	fclose(f);
+
+	if (rc)
+		manifest_free(m);
+
+	return rc;
+}
+
+void manifest_free(struct manifest *m)
+{
+	for (size_t i = 0; i < m->num_steps; ++i)
+		free(m->steps[i].owned);
+
+	for (size_t i = 0; i < m->num_images; ++i) {
+		image_close(&m->images[i]->img);
+		free(m->images[i]->path);
+		free(m->images[i]);
+	}
+
+	free(m->steps);
+	free(m->images);
+
+	m->steps = NULL;
+	m->num_steps = 0;
+	m->images = NULL;
+	m->num_images = 0;
+}
+
+static bool manifest_validate_step(struct manifest const *m,
+				   struct manifest_step const *s,
+				   struct sdp_cpu_info const *cpu)
+{
+	uint32_t	addr = s->addr;
+	size_t		len;
+	unsigned int	flags;
+
+	switch (s->op) {
+	case MANIFEST_OP_DCD:
+		if (s->len > SDP_DCD_MAX_SIZE) {
+			fprintf(stderr, "%s:%u: DCD too large (%zu)\n",
+				m->file_name, s->line, s->len);
+			return false;
+		}
+		return true;
+
+	case MANIFEST_OP_WRITE:
+		flags = SDP_MEM_LOAD;
+		len   = s->len;
+		break;
+
+	case MANIFEST_OP_JUMP:
+		flags = SDP_MEM_LOAD;
+		len   = 1;
+		break;
+
+	case MANIFEST_OP_READ_REG:
+		flags = SDP_MEM_REG;
+		len   = s->width * s->cnt;
+		break;
+
+	case MANIFEST_OP_POLL:
+		if (s->poll_mode == SDP_POLL_DCD &&
+		    !sdp_poll_can_dcd(cpu, &(struct sdp_poll) {
+				    .addr	= s->addr,
+				    .mask	= s->mask,
+				    .val	= s->val,
+			    })) {
+			fprintf(stderr, "%s:%u: poll can not be done by DCD on %s\n",
+				m->file_name, s->line, cpu->name);
+			return false;
+		}
+		/* fallthrough */
+
+	case MANIFEST_OP_WRITE_REG:
+		flags = SDP_MEM_REG;
+		len   = s->width;
+		break;
+
+	default:
+		abort();
+	}
+
+	if ((uint64_t)addr + len > (uint64_t)UINT32_MAX + 1 ||
+	    !sdp_cpu_check_region(cpu, addr, len, flags)) {
+		fprintf(stderr, "%s:%u: %s of %08x+%zu not allowed on %s\n",
+			m->file_name, s->line, OP_NAMES[s->op], addr, len,
+			cpu->name);
+		return false;
+	}
+
+	return true;
+}
+
+static bool is_foldable_reg_write(struct manifest_step const *s,
+				  struct sdp_cpu_info const *cpu)
+{
+	return (s->op == MANIFEST_OP_WRITE_REG &&
+		sdp_cpu_check_region(cpu, s->addr, s->width, SDP_MEM_DCD));
+}
+
+/*
+ * DCD_WRITE stages its payload at cpu->dcd_addr which lies in loadable
+ * OCRAM; after a 'write' or 'image' step placed data there, every later
+ * DCD_WRITE would clobber it
+ */
+static bool overlaps_dcd_area(struct manifest_step const *s,
+			      struct sdp_cpu_info const *cpu)
+{
+	return (s->op == MANIFEST_OP_WRITE && cpu->dcd_addr != 0 &&
+		s->addr < (uint64_t)cpu->dcd_addr + SDP_DCD_MAX_SIZE &&
+		(uint64_t)s->addr + s->len > cpu->dcd_addr);
+}
+
+static bool is_adjacent_write(struct manifest_step const *a,
+			      struct manifest_step const *b)
+{
+	return (a->op == MANIFEST_OP_WRITE && b->op == MANIFEST_OP_WRITE &&
+		(uint64_t)a->addr + a->len == b->addr);
+}
+
+/* folds register writes src[0..cnt) into one or more DCD_WRITE steps */
+static int plan_add_reg_writes(struct manifest_step *plan, size_t *num_plan,
+			       struct manifest_step const *src, size_t cnt)
+{
+	struct sdp_dcd_write_data	*data;
+	size_t				pos = 0;
+	int				rc = 0;
+
+	data = calloc(cnt, sizeof data[0]);
+	if (!data)
+		return EX_OSERR;
+
+	while (pos < cnt && rc == 0) {
+		struct sdp_dcd	dcd;
+		size_t		first = pos;
+
+		if (!sdp_dcd_init(&dcd)) {
+			rc = EX_OSERR;
+			break;
+		}
+
+		while (pos < cnt) {
+			unsigned int	width = src[pos].width;
+			size_t		k = pos;
+
+			while (k < cnt && src[k].width == width &&
+			       (dcd.sz + sizeof(struct sdp_dcd_hdr) +
+				(k - pos + 1) * 8) <= SDP_DCD_MAX_SIZE) {
+				data[k - pos] = (struct sdp_dcd_write_data) {
+					.addr		= src[k].addr,
+					.val_mask	= src[k].val,
+				};
+				++k;
+			}
+
+			if (k == pos)
+				/* DCD is full */
+				break;
+
+			if (!sdp_dcd_data(&dcd, width, data, k - pos)) {
+				rc = EX_OSERR;
+				break;
+			}
+
+			pos = k;
+		}
+
+		if (rc) {
+			sdp_dcd_free(&dcd);
+			break;
+		}
+
+		plan[(*num_plan)++] = (struct manifest_step) {
+			.op		= MANIFEST_OP_DCD,
+			.line		= src[first].line,
+			.num_merged	= pos - first,
+			.data		= dcd.buf,
+			.len		= dcd.sz,
+			.owned		= dcd.buf,
+		};
+	}
+
+	free(data);
+	return rc;
+}
+
+/* concatenates the adjacent writes src[0..cnt) into one WRITE_FILE */
+static int plan_add_writes(struct manifest_step *plan, size_t *num_plan,
+			   struct manifest_step *src, size_t cnt)
+{
+	size_t		len = 0;
+	uint8_t		*buf;
+	uint8_t		*ptr;
+
+	for (size_t i = 0; i < cnt; ++i)
+		len += src[i].len;
+
+	buf = malloc(len);
+	if (!buf)
+		return EX_OSERR;
+
+	ptr = buf;
+	for (size_t i = 0; i < cnt; ++i) {
+		memcpy(ptr, src[i].data, src[i].len);
+		ptr += src[i].len;
+
+		free(src[i].owned);
+		src[i].owned = NULL;
+	}
+
+	plan[(*num_plan)++] = (struct manifest_step) {
+		.op		= MANIFEST_OP_WRITE,
+		.line		= src[0].line,
+		.num_merged	= cnt,
+		.addr		= src[0].addr,
+		.data		= buf,
+		.len		= len,
+		.owned		= buf,
+	};
+
+	return 0;
+}
+
+int manifest_compile(struct manifest *m, struct sdp_cpu_info const *cpu)
+{
+	struct manifest_step	*plan;
+	size_t			num_plan = 0;
+	size_t			i;
+	bool			dcd_loaded = false;
+	int			rc = 0;
+
+	if (m->compiled) {
+		if (m->cpu == cpu)
+			return 0;
+
+		fprintf(stderr, "%s: plan was compiled for %s\n",
+			m->file_name, m->cpu->name);
+		return EX_CONFIG;
+	}
+
+	if (cpu->protocol != SDP_PROTO_SDP) {
+		fprintf(stderr, "%s: %s does not support SDP commands\n",
+			m->file_name, cpu->name);
+		return EX_CONFIG;
+	}
+
+	if (m->cpu && m->cpu != cpu) {
+		fprintf(stderr, "%s: manifest requires %s but %s detected\n",
+			m->file_name, m->cpu->name, cpu->name);
+		return EX_CONFIG;
+	}
+
+	for (i = 0; i < m->num_steps; ++i) {
+		if (!manifest_validate_step(m, &m->steps[i], cpu))
+			return EX_DATAERR;
+	}
+
+	plan = calloc(m->num_steps + 1, sizeof plan[0]);
+	if (!plan)
+		return EX_OSERR;
+
+	i = 0;
+	while (i < m->num_steps && rc == 0) {
+		struct manifest_step	*s = &m->steps[i];
+		size_t			j = i + 1;
+
+		if (dcd_loaded &&
+		    (s->op == MANIFEST_OP_DCD ||
+		     (s->op == MANIFEST_OP_POLL &&
+		      s->poll_mode == SDP_POLL_DCD))) {
+			fprintf(stderr,
+				"%s:%u: %s would overwrite data loaded at %08x\n",
+				m->file_name, s->line, OP_NAMES[s->op],
+				cpu->dcd_addr);
+			rc = EX_DATAERR;
+			break;
+		}
+
+		/* AUTO polls must not fall back to DCD either */
+		if (dcd_loaded && s->op == MANIFEST_OP_POLL)
+			s->poll_mode = SDP_POLL_HOST;
+
+		if (!dcd_loaded && is_foldable_reg_write(s, cpu)) {
+			while (j < m->num_steps &&
+			       is_foldable_reg_write(&m->steps[j], cpu))
+				++j;
+		} else if (s->op == MANIFEST_OP_WRITE) {
+			while (j < m->num_steps &&
+			       is_adjacent_write(&m->steps[j-1], &m->steps[j]))
+				++j;
+		}
+
+		for (size_t k = i; k < j; ++k)
+			dcd_loaded |= overlaps_dcd_area(&m->steps[k], cpu);
+
+		if (j - i == 1) {
+			plan[num_plan++] = *s;
+			s->owned = NULL;
+		} else if (s->op == MANIFEST_OP_WRITE_REG) {
+			rc = plan_add_reg_writes(plan, &num_plan, s, j - i);
+		} else {
+			rc = plan_add_writes(plan, &num_plan, s, j - i);
+		}
+
+		i = j;
+	}
+
+	if (rc) {
+		for (i = 0; i < num_plan; ++i)
+			free(plan[i].owned);
+
+		free(plan);
+		return rc;
+	}
+
+	for (i = 0; i < m->num_steps; ++i)
+		free(m->steps[i].owned);
+
+	free(m->steps);
+
+	m->steps     = plan;
+	m->num_steps = num_plan;
+	m->cpu       = cpu;
+	m->compiled  = true;
+
+	return 0;
+}
+
+static bool manifest_poll(struct sdp *sdp, struct manifest_step const *s)
+{
+	static char const * const	MODES[] = {
+		[SDP_POLL_AUTO]	= "auto",
+		[SDP_POLL_HOST]	= "host",
+		[SDP_POLL_DCD]	= "dcd",
+	};
+	struct sdp_poll			p = {
+		.addr		= s->addr,
+		.mask		= s->mask,
+		.val		= s->val,
+		.mode		= s->poll_mode,
+		.timeout_ms	= s->timeout_ms,
+	};
+	struct sdp_poll_result		res;
+
+	if (!sdp_poll(sdp, &p, &res))
+		return false;
+
+	printf(" [%s, %u reads, %.3f ms]", MODES[res.mode], res.num_reads,
+	       res.latency_ns / 1e6);
+
+	return true;
+}
+
+static bool manifest_read_reg(struct sdp *sdp, struct manifest_step const *s)
+{
+	union {
+		uint8_t		b[1];
+		uint16_t	w[1];
+		uint32_t	l[1];
+	}		*buf;
+	bool		ok;
+
+	buf = calloc(s->cnt, sizeof(uint32_t));
+	if (!buf)
+		return false;
+
+	switch (s->width) {
+	case 1:  ok = sdp_read_regb(sdp, s->addr, buf->b, s->cnt); break;
+	case 2:  ok = sdp_read_regw(sdp, s->addr, buf->w, s->cnt); break;
+	default: ok = sdp_read_regl(sdp, s->addr, buf->l, s->cnt); break;
+	}
+
+	for (size_t i = 0; ok && i < s->cnt; ++i) {
+		uint32_t	v;
+
+		switch (s->width) {
+		case 1:  v = buf->b[i]; break;
+		case 2:  v = buf->w[i]; break;
+		default: v = buf->l[i]; break;
+		}
+
+		printf("  %08zx: %0*x\n", s->addr + i * s->width,
+		       (int)(s->width * 2), v);
+	}
+
+	free(buf);
+	return ok;
+}
+
+static bool manifest_exec_step(struct sdp *sdp, struct manifest_step const *s)
+{
+	switch (s->op) {
+	case MANIFEST_OP_DCD:
+		return sdp_write_dcd(sdp, s->data, s->len);
+
+	case MANIFEST_OP_WRITE:
+		return sdp_write_file(sdp, s->addr, s->data, s->len);
+
+	case MANIFEST_OP_WRITE_REG:
+		switch (s->width) {
+		case 1:  return sdp_read_writeb(sdp, s->val, s->addr);
+		case 2:  return sdp_read_writew(sdp, s->val, s->addr);
+		default: return sdp_read_writel(sdp, s->val, s->addr);
+		}
+
+	case MANIFEST_OP_READ_REG:
+		return manifest_read_reg(sdp, s);
+
+	case MANIFEST_OP_POLL:
+		return manifest_poll(sdp, s);
+
+	case MANIFEST_OP_JUMP:
+		return sdp_jump(sdp, s->addr);
+	}
+
+	abort();
+}
+
+int manifest_run(struct manifest *m, struct sdp *sdp)
+{
+	uint64_t	t_start = monotonic_ns();
+	unsigned int	num_lines = 0;
+	int		rc;
+
+	rc = manifest_compile(m, sdp_get_cpu_info(sdp));
+	if (rc)
+		return rc;
+
+	printf("Running %s on %s (%s), %zu steps\n", m->file_name,
+	       sdp_get_devpath(sdp), m->cpu->name, m->num_steps);
+
+	for (size_t i = 0; i < m->num_steps; ++i) {
+		struct manifest_step	*s = &m->steps[i];
+		uint64_t		t0 = monotonic_ns();
+		bool			ok;
+
+		printf("%4u: %-5s %08x", s->line, OP_NAMES[s->op], s->addr);
+		if (s->len > 0)
+			printf(" [%zu]", s->len);
+		if (s->num_merged > 1)
+			printf(" (%u lines)", s->num_merged);
+		fflush(stdout);
+
+		ok = manifest_exec_step(sdp, s);
+
+		s->duration_ns = monotonic_ns() - t0;
+		num_lines += s->num_merged;
+
+		printf(" %s %.3f ms\n", ok ? "ok" : "FAILED",
+		       s->duration_ns / 1e6);
+
+		if (!ok)
+			return EX_OSERR;
+	}
+
+	printf("%u manifest lines in %zu steps, %.3f ms\n", num_lines,
+	       m->num_steps, (monotonic_ns() - t_start) / 1e6);
+
+	return 0;
+}
@@ -0,0 +1,97 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_MX6_LOAD_MANIFEST_H
+#define H_ENSC_MX6_LOAD_MANIFEST_H
+
+/* Manifests are line based; '#' starts a comment.  Numbers are parsed
+ * with strtoul(..., 0), relative file names are resolved against the
+ * directory of the manifest.
+ *
+ *   cpu    <id>                        require a certain CPU (imx6, imx7)
+ *   dcd    <file> [<ofs>]              send DCD of an i.MX image
+ *   image  <file> [<ofs>]              load i.MX image (without DCD)
+ *   write  <addr> <file>               load raw file
+ *   write{b,w,l} <addr> <val>          write register
+ *   read{b,w,l}  <addr> [<cnt>]        read and print registers
+ *   poll   <addr> <mask> <val> [<ms> [auto|host|dcd]]
+ *                                      wait until (*addr & mask) == val
+ *   jump   [<addr>]                    jump; default is IVT of last image
+ *
+ * After loading, the manifest is compiled into an execution plan for the
+ * detected CPU: all addresses are validated before the first command is
+ * sent, runs of register writes into DCD capable areas are folded into a
+ * single DCD_WRITE and adjacent raw writes into a single WRITE_FILE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "sdp.h"
+
+struct manifest_image;
+
+enum manifest_op {
+	MANIFEST_OP_DCD,
+	MANIFEST_OP_WRITE,
+	MANIFEST_OP_WRITE_REG,
+	MANIFEST_OP_READ_REG,
+	MANIFEST_OP_POLL,
+	MANIFEST_OP_JUMP,
+};
+
+struct manifest_step {
+	enum manifest_op	op;
+	unsigned int		line;
+	/* number of manifest lines folded into this step */
+	unsigned int		num_merged;
+
+	uint32_t		addr;
+	unsigned int		width;
+	uint32_t		val;
+	uint32_t		mask;
+	size_t			cnt;
+	unsigned int		timeout_ms;
+	enum sdp_poll_mode	poll_mode;
+
+	void const		*data;
+	size_t			len;
+	/* buffer owned by this step; 'data' might point into it */
+	void			*owned;
+
+	uint64_t		duration_ns;
+};
+
+struct manifest {
+	char const			*file_name;
+	struct sdp_cpu_info const	*cpu;
+	bool				compiled;
+
+	struct manifest_step		*steps;
+	size_t				num_steps;
+
+	struct manifest_image		**images;
+	size_t				num_images;
+};
+
+/* these functions return 0 or a sysexits(3) code */
+int	manifest_load(struct manifest *m, char const *file_name);
+int	manifest_compile(struct manifest *m, struct sdp_cpu_info const *cpu);
+int	manifest_run(struct manifest *m, struct sdp *sdp);
+void	manifest_free(struct manifest *m);
+
+#endif	/* H_ENSC_MX6_LOAD_MANIFEST_H */
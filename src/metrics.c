@@ -0,0 +1,514 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "metrics.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <libusb.h>
+
+#include "util.h"
+
+#define METRICS_MAX_PORTS	32
+#define METRICS_NUM_ERRORS	14	/* protocol, 12 libusb codes, other */
+
+typedef atomic_uint_fast64_t	metrics_counter_t;
+
+struct metrics_histogram {
+	/* non-cumulative; last bucket is +Inf */
+	metrics_counter_t	buckets[16];
+	metrics_counter_t	sum;
+	metrics_counter_t	count;
+};
+
+struct metrics_port {
+	/* 0 = free, 1 = being claimed, 2 = valid */
+	atomic_uint		state;
+	char			path[32];
+
+	metrics_counter_t	ok;
+	metrics_counter_t	failed;
+	metrics_counter_t	bytes;
+};
+
+static struct {
+	metrics_counter_t		errors[_METRICS_SITE_NUM][METRICS_NUM_ERRORS];
+	metrics_counter_t		retries[_METRICS_RETRY_NUM];
+	metrics_counter_t		payload_bytes;
+
+	struct metrics_histogram	phases[_METRICS_PHASE_NUM];
+	struct metrics_histogram	throughput;
+
+	/* the last slot is used for overflow */
+	struct metrics_port		ports[METRICS_MAX_PORTS + 1];
+}					g_metrics;
+
+/* bucket bounds in ns */
+static uint64_t const		DURATION_BOUNDS[] = {
+	1000000, 2500000, 5000000, 10000000, 25000000, 50000000,
+	100000000, 250000000, 500000000, 1000000000, 2500000000,
+	5000000000, 10000000000, 30000000000,
+};
+
+/* bucket bounds in bytes/s */
+static uint64_t const		THROUGHPUT_BOUNDS[] = {
+	65536, 131072, 262144, 524288, 786432, 1048576, 1572864,
+	2097152, 4194304, 8388608, 16777216,
+};
+
+static char const * const	SITE_NAMES[] = {
+	[METRICS_SITE_INIT]		= "libusb_init",
+	[METRICS_SITE_DEVICE_LIST]	= "get_device_list",
+	[METRICS_SITE_DESCRIPTOR]	= "get_device_descriptor",
+	[METRICS_SITE_OPEN]		= "open",
+	[METRICS_SITE_CLAIM]		= "claim_interface",
+	[METRICS_SITE_REPORT1]		= "report1",
+	[METRICS_SITE_PAYLOAD]		= "payload",
+	[METRICS_SITE_REPORT3]		= "report3",
+	[METRICS_SITE_REPORT4]		= "report4",
+	[METRICS_SITE_STATUS]		= "status",
+};
+
+static char const * const	PHASE_NAMES[] = {
+	[METRICS_PHASE_WAIT]	= "wait",
+	[METRICS_PHASE_PREPARE]	= "prepare",
+	[METRICS_PHASE_OPEN]	= "open",
+	[METRICS_PHASE_DCD]	= "dcd",
+	[METRICS_PHASE_PLUGIN]	= "plugin",
+	[METRICS_PHASE_FILE]	= "file",
+	[METRICS_PHASE_JUMP]	= "jump",
+	[METRICS_PHASE_TOTAL]	= "total",
+};
+
+static char const * const	RETRY_NAMES[] = {
+	[METRICS_RETRY_ENUMERATION]	= "enumeration",
+	[METRICS_RETRY_UPLOAD]		= "upload",
+};
+
+static void counter_add(metrics_counter_t *c, uint64_t v)
+{
+	atomic_fetch_add_explicit(c, v, memory_order_relaxed);
+}
+
+static uint64_t counter_get(metrics_counter_t const *c)
+{
+	return atomic_load_explicit(c, memory_order_relaxed);
+}
+
+static void histogram_observe(struct metrics_histogram *h,
+			      uint64_t const bounds[], size_t num_bounds,
+			      uint64_t v)
+{
+	size_t		i;
+
+	for (i = 0; i < num_bounds && v > bounds[i]; ++i)
+		;
+
+	counter_add(&h->buckets[i], 1);
+	counter_add(&h->sum, v);
+	counter_add(&h->count, 1);
+}
+
+static int error_index(int rc)
+{
+	if (rc == METRICS_ERR_PROTOCOL)
+		return 0;
+
+	if (rc < 0 && rc >= LIBUSB_ERROR_NOT_SUPPORTED)
+		return -rc;
+
+	return METRICS_NUM_ERRORS - 1;
+}
+
+void metrics_error(enum metrics_site site, int rc)
+{
+	counter_add(&g_metrics.errors[site][error_index(rc)], 1);
+}
+
+void metrics_retry(enum metrics_retry kind)
+{
+	counter_add(&g_metrics.retries[kind], 1);
+}
+
+void metrics_phase(enum metrics_phase phase, uint64_t duration_ns)
+{
+	histogram_observe(&g_metrics.phases[phase], DURATION_BOUNDS,
+			  ARRAY_SIZE(DURATION_BOUNDS), duration_ns);
+}
+
+void metrics_payload(uint64_t bytes)
+{
+	counter_add(&g_metrics.payload_bytes, bytes);
+}
+
+struct metrics_port *metrics_port_get(char const *port_path)
+{
+	for (size_t i = 0; i < METRICS_MAX_PORTS; ++i) {
+		struct metrics_port	*p = &g_metrics.ports[i];
+		unsigned int		state;
+
+		state = atomic_load_explicit(&p->state, memory_order_acquire);
+
+		if (state == 0) {
+			unsigned int	exp = 0;
+
+			if (!atomic_compare_exchange_strong(&p->state, &exp, 1))
+				state = exp;
+			else {
+				snprintf(p->path, sizeof p->path, "%s", port_path);
+				atomic_store_explicit(&p->state, 2,
+						      memory_order_release);
+				return p;
+			}
+		}
+
+		/* another thread is registering a port right now; this is
+		 * rare enough to just wait for it */
+		while (state == 1)
+			state = atomic_load_explicit(&p->state,
+						     memory_order_acquire);
+
+		if (strcmp(p->path, port_path) == 0)
+			return p;
+	}
+
+	return &g_metrics.ports[METRICS_MAX_PORTS];
+}
+
+void metrics_upload(struct metrics_port *port, bool ok, uint64_t bytes,
+		    uint64_t duration_ns)
+{
+	counter_add(ok ? &port->ok : &port->failed, 1);
+	counter_add(&port->bytes, bytes);
+
+	if (ok && duration_ns > 0)
+		histogram_observe(&g_metrics.throughput, THROUGHPUT_BOUNDS,
+				  ARRAY_SIZE(THROUGHPUT_BOUNDS),
+				  bytes * 1000000000u / duration_ns);
+}
+
+/* integer values are printed exactly; scaled ones with full precision */
+static void render_value(FILE *f, uint64_t v, double scale)
+{
+	if (scale == 1.0)
+		fprintf(f, "%" PRIu64, v);
+	else
+		fprintf(f, "%.17g", v * scale);
+}
+
+static void render_histogram(FILE *f, char const *name, char const *label,
+			     struct metrics_histogram const *h,
+			     uint64_t const bounds[], size_t num_bounds,
+			     double scale)
+{
+	uint64_t	cnt = 0;
+	char const	*sep = label[0] ? "," : "";
+
+	for (size_t i = 0; i <= num_bounds; ++i) {
+		cnt += counter_get(&h->buckets[i]);
+
+		fprintf(f, "%s_bucket{%s%sle=\"", name, label, sep);
+
+		if (i < num_bounds)
+			render_value(f, bounds[i], scale);
+		else
+			fputs("+Inf", f);
+
+		fprintf(f, "\"} %" PRIu64 "\n", cnt);
+	}
+
+	fprintf(f, "%s_sum%s%s%s ", name,
+		label[0] ? "{" : "", label, label[0] ? "}" : "");
+	render_value(f, counter_get(&h->sum), scale);
+	fputc('\n', f);
+	fprintf(f, "%s_count%s%s%s %" PRIu64 "\n", name,
+		label[0] ? "{" : "", label, label[0] ? "}" : "",
+		counter_get(&h->count));
+}
+
+static void metrics_render(FILE *f)
+{
+	fprintf(f,
+		"# HELP mx6_usbload_uploads_total Uploads by USB port path and result.\n"
+		"# TYPE mx6_usbload_uploads_total counter\n");
+	for (size_t i = 0; i <= METRICS_MAX_PORTS; ++i) {
+		struct metrics_port const	*p = &g_metrics.ports[i];
+		char const			*path = p->path;
+
+		if (i == METRICS_MAX_PORTS)
+			path = "other";
+		else if (atomic_load_explicit(&p->state,
+					      memory_order_acquire) != 2)
+			continue;
+
+		fprintf(f,
+			"mx6_usbload_uploads_total{port=\"%s\",result=\"ok\"} %" PRIu64 "\n"
+			"mx6_usbload_uploads_total{port=\"%s\",result=\"failed\"} %" PRIu64 "\n",
+			path, counter_get(&p->ok), path, counter_get(&p->failed));
+	}
+
+	fprintf(f,
+		"# HELP mx6_usbload_upload_bytes_total Bytes of uploaded images by USB port path.\n"
+		"# TYPE mx6_usbload_upload_bytes_total counter\n");
+	for (size_t i = 0; i <= METRICS_MAX_PORTS; ++i) {
+		struct metrics_port const	*p = &g_metrics.ports[i];
+
+		if (i < METRICS_MAX_PORTS &&
+		    atomic_load_explicit(&p->state, memory_order_acquire) != 2)
+			continue;
+
+		fprintf(f, "mx6_usbload_upload_bytes_total{port=\"%s\"} %" PRIu64 "\n",
+			i < METRICS_MAX_PORTS ? p->path : "other",
+			counter_get(&p->bytes));
+	}
+
+	fprintf(f,
+		"# HELP mx6_usbload_payload_bytes_total Bytes sent as report2 payload.\n"
+		"# TYPE mx6_usbload_payload_bytes_total counter\n"
+		"mx6_usbload_payload_bytes_total %" PRIu64 "\n",
+		counter_get(&g_metrics.payload_bytes));
+
+	fprintf(f,
+		"# HELP mx6_usbload_upload_throughput_bytes_per_second Throughput of successful uploads.\n"
+		"# TYPE mx6_usbload_upload_throughput_bytes_per_second histogram\n");
+	render_histogram(f, "mx6_usbload_upload_throughput_bytes_per_second",
+			 "", &g_metrics.throughput,
+			 THROUGHPUT_BOUNDS, ARRAY_SIZE(THROUGHPUT_BOUNDS), 1);
+
+	fprintf(f,
+		"# HELP mx6_usbload_phase_duration_seconds Duration of the single upload phases.\n"
+		"# TYPE mx6_usbload_phase_duration_seconds histogram\n");
+	for (size_t i = 0; i < _METRICS_PHASE_NUM; ++i) {
+		char	label[32];
+
+		snprintf(label, sizeof label, "phase=\"%s\"", PHASE_NAMES[i]);
+		render_histogram(f, "mx6_usbload_phase_duration_seconds",
+				 label, &g_metrics.phases[i],
+				 DURATION_BOUNDS, ARRAY_SIZE(DURATION_BOUNDS),
+				 1e-9);
+	}
+
+	fprintf(f,
+		"# HELP mx6_usbload_usb_errors_total Failed USB operations by call site and error.\n"
+		"# TYPE mx6_usbload_usb_errors_total counter\n");
+	for (size_t s = 0; s < _METRICS_SITE_NUM; ++s) {
+		for (size_t e = 0; e < METRICS_NUM_ERRORS; ++e) {
+			uint64_t	v = counter_get(&g_metrics.errors[s][e]);
+			char const	*err;
+
+			if (v == 0)
+				continue;
+
+			if (e == 0)
+				err = "PROTOCOL";
+			else if (e == METRICS_NUM_ERRORS - 1)
+				err = libusb_error_name(LIBUSB_ERROR_OTHER);
+			else
+				err = libusb_error_name(-(int)e);
+
+			fprintf(f, "mx6_usbload_usb_errors_total{site=\"%s\",error=\"%s\"} %" PRIu64 "\n",
+				SITE_NAMES[s], err, v);
+		}
+	}
+
+	fprintf(f,
+		"# HELP mx6_usbload_retries_total Retried operations.\n"
+		"# TYPE mx6_usbload_retries_total counter\n");
+	for (size_t i = 0; i < _METRICS_RETRY_NUM; ++i)
+		fprintf(f, "mx6_usbload_retries_total{kind=\"%s\"} %" PRIu64 "\n",
+			RETRY_NAMES[i], counter_get(&g_metrics.retries[i]));
+}
+
+static void metrics_handle_client(int fd)
+{
+	struct timeval	tv = { .tv_sec = 2 };
+	char		req[1024];
+	FILE		*f;
+
+	/* the request itself is ignored; every request gets the metrics */
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+	if (recv(fd, req, sizeof req, 0) < 0) {
+		close(fd);
+		return;
+	}
+
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		return;
+	}
+
+	fprintf(f,
+		"HTTP/1.0 200 OK\r\n"
+		"Content-Type: text/plain; version=0.0.4\r\n"
+		"Connection: close\r\n"
+		"\r\n");
+	metrics_render(f);
+	fclose(f);
+}
+
+static void *metrics_thread(void *fd_ptr)
+{
+	int		fd = (intptr_t)fd_ptr;
+
+	for (;;) {
+		int	cfd = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+
+		if (cfd < 0 && errno == EINTR)
+			continue;
+
+		if (cfd < 0) {
+			perror("accept()");
+			sleep(1);
+			continue;
+		}
+
+		metrics_handle_client(cfd);
+	}
+
+	return NULL;
+}
+
+static int metrics_listen_unix(char const *path)
+{
+	struct sockaddr_un	addr = {
+		.sun_family	= AF_UNIX,
+	};
+	int			fd;
+
+	if (strlen(path) >= sizeof addr.sun_path) {
+		fprintf(stderr, "metrics socket path too long\n");
+		return -1;
+	}
+
+	strcpy(addr.sun_path, path);
+	unlink(path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("socket()");
+		return -1;
+	}
+
+	if (bind(fd, (void *)&addr, sizeof addr) < 0) {
+		fprintf(stderr, "bind(%s): %m\n", path);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int metrics_listen_inet(char const *spec)
+{
+	struct addrinfo		hints = {
+		.ai_family	= AF_UNSPEC,
+		.ai_socktype	= SOCK_STREAM,
+		.ai_flags	= AI_PASSIVE,
+	};
+	struct addrinfo		*res;
+	char const		*sep = strrchr(spec, ':');
+	char			*host;
+	int			fd = -1;
+	int			rc;
+
+	if (sep)
+		host = strndup(spec, sep - spec);
+	else
+		host = strdup("localhost");
+
+	if (!host)
+		return -1;
+
+	rc = getaddrinfo(host, sep ? sep + 1 : spec, &hints, &res);
+	free(host);
+
+	if (rc != 0) {
+		fprintf(stderr, "invalid metrics address '%s': %s\n", spec,
+			gai_strerror(rc));
+		return -1;
+	}
+
+	for (struct addrinfo *ai = res; ai && fd < 0; ai = ai->ai_next) {
+		int	one = 1;
+
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+			    ai->ai_protocol);
+		if (fd < 0)
+			continue;
+
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+
+		if (bind(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+			fprintf(stderr, "bind(%s): %m\n", spec);
+			close(fd);
+			fd = -1;
+		}
+	}
+
+	freeaddrinfo(res);
+	return fd;
+}
+
+bool metrics_serve(char const *addr)
+{
+	pthread_t	thread;
+	int		fd;
+	int		rc;
+
+	if (strncmp(addr, "unix:", 5) == 0)
+		fd = metrics_listen_unix(addr + 5);
+	else
+		fd = metrics_listen_inet(addr);
+
+	if (fd < 0)
+		return false;
+
+	if (listen(fd, 8) < 0) {
+		perror("listen()");
+		close(fd);
+		return false;
+	}
+
+	/* clients might go away while we are writing */
+	signal(SIGPIPE, SIG_IGN);
+
+	rc = pthread_create(&thread, NULL, metrics_thread,
+			    (void *)(intptr_t)fd);
+	if (rc != 0) {
+		fprintf(stderr, "pthread_create(): %s\n", strerror(rc));
+		close(fd);
+		return false;
+	}
+
+	pthread_detach(thread);
+	return true;
+}
@@ -0,0 +1,80 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_MX6_LOAD_METRICS_H
+#define H_ENSC_MX6_LOAD_METRICS_H
+
+/* Process wide counters and histograms.  Recording functions use relaxed
+ * atomics on statically allocated storage only so that they can be
+ * called from the transfer path.  metrics_serve() exports them in the
+ * Prometheus text format. */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* error code for failures which are not reported by libusb */
+#define METRICS_ERR_PROTOCOL	1
+
+enum metrics_site {
+	METRICS_SITE_INIT,
+	METRICS_SITE_DEVICE_LIST,
+	METRICS_SITE_DESCRIPTOR,
+	METRICS_SITE_OPEN,
+	METRICS_SITE_CLAIM,
+	METRICS_SITE_REPORT1,
+	METRICS_SITE_PAYLOAD,
+	METRICS_SITE_REPORT3,
+	METRICS_SITE_REPORT4,
+	METRICS_SITE_STATUS,
+	_METRICS_SITE_NUM,
+};
+
+enum metrics_phase {
+	METRICS_PHASE_WAIT,
+	METRICS_PHASE_PREPARE,
+	METRICS_PHASE_OPEN,
+	METRICS_PHASE_DCD,
+	METRICS_PHASE_PLUGIN,
+	METRICS_PHASE_FILE,
+	METRICS_PHASE_JUMP,
+	METRICS_PHASE_TOTAL,
+	_METRICS_PHASE_NUM,
+};
+
+enum metrics_retry {
+	METRICS_RETRY_ENUMERATION,
+	METRICS_RETRY_UPLOAD,
+	_METRICS_RETRY_NUM,
+};
+
+struct metrics_port;
+
+void	metrics_error(enum metrics_site site, int rc);
+void	metrics_retry(enum metrics_retry kind);
+void	metrics_phase(enum metrics_phase phase, uint64_t duration_ns);
+void	metrics_payload(uint64_t bytes);
+
+/* returns a slot for the given port path; never fails but might return a
+ * shared overflow slot when too many ports were seen */
+struct metrics_port	*metrics_port_get(char const *port_path);
+void	metrics_upload(struct metrics_port *port, bool ok, uint64_t bytes,
+		       uint64_t duration_ns);
+
+/* 'addr' is either "unix:<path>" or "[<host>:]<port>"; the default host
+ * is the loopback interface */
+bool	metrics_serve(char const *addr);
+
+#endif	/* H_ENSC_MX6_LOAD_METRICS_H */
@@ -0,0 +1,388 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "plan.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <endian.h>
+#include <stdbool.h>
+#include <sysexits.h>
+
+#include "sdp.h"
+#include "image.h"
+#include "bundle.h"
+#include "profile.h"
+
+#define PLAN_MAX_CMDS	(8u + BUNDLE_MAX_SELECTORS)
+
+enum plan_kind {
+	/* READ_REGISTER of a bundle selector */
+	PLAN_READ_REG,
+	PLAN_DCD,
+	PLAN_FILE,
+	PLAN_JUMP,
+	/* ERROR_STATUS which waits for the return of a plugin */
+	PLAN_PLUGIN_WAIT,
+	/* SDPS download */
+	PLAN_STREAM,
+};
+
+struct plan_cmd {
+	enum plan_kind	kind;
+	char const	*name;
+	uint32_t	addr;
+	bool		have_addr;
+	size_t		len;
+	unsigned int	num_report1;
+	unsigned int	num_report2;
+	unsigned int	num_report3;
+	unsigned int	num_report4;
+};
+
+struct plan {
+	struct plan_cmd	cmds[PLAN_MAX_CMDS];
+	size_t		num_cmds;
+	/* conditions which let the upload fail */
+	char const	*error;
+};
+
+static void plan_add(struct plan *p, enum plan_kind kind, char const *name,
+		     uint32_t addr, bool have_addr, size_t len)
+{
+	struct plan_cmd	*cmd = &p->cmds[p->num_cmds++];
+	bool		sdps = kind == PLAN_STREAM;
+
+	/* see the sdp_*() functions for the reports of each command */
+	*cmd = (struct plan_cmd) {
+		.kind		= kind,
+		.name		= name,
+		.addr		= addr,
+		.have_addr	= have_addr,
+		.len		= len,
+		.num_report1	= 1,
+		.num_report2	= (len + SDP_REPORT2_SIZE - 1) / SDP_REPORT2_SIZE,
+		.num_report3	= sdps ? 0 : 1,
+		.num_report4	= (sdps || kind == PLAN_JUMP) ? 0 : 1,
+	};
+}
+
+static void plan_add_dcd(struct plan *p, struct mx6_image const *img,
+			 struct sdp_cpu_info const *cpu)
+{
+	plan_add(p, PLAN_DCD, "DCD_WRITE", cpu ? cpu->dcd_addr : 0, cpu,
+		 img->dcd_len);
+
+	if (img->dcd_len > SDP_DCD_MAX_SIZE)
+		p->error = "DCD too large";
+	else if (cpu && cpu->dcd_addr == 0)
+		p->error = "CPU does not support DCD";
+}
+
+/* mirrors upload_image() (and bundle_select() when 'b' is set) for a cold
+ * board; 'cpu' can be NULL */
+static int plan_build(struct plan *p, struct mx6_image const *img,
+		      struct bundle const *b, struct sdp_cpu_info const *cpu)
+{
+	struct mx6_image	main_img;
+
+	*p = (struct plan) { .num_cmds = 0 };
+
+	for (size_t i = 0; b && i < le32toh(b->hdr->num_selectors); ++i)
+		plan_add(p, PLAN_READ_REG, "READ_REGISTER",
+			 le32toh(b->hdr->selectors[i].addr), true, 0);
+
+	if (cpu && cpu->protocol == SDP_PROTO_SDPS) {
+		if (img->iov)
+			p->error = "bundle variants not supported by SDPS";
+
+		plan_add(p, PLAN_STREAM, "BLTC_DOWNLOAD", 0, false,
+			 img->fsize);
+		return 0;
+	}
+
+	if (!img->ivt) {
+		fprintf(stderr, "no IVT at offset %#x\n", img->offset);
+		return EX_DATAERR;
+	}
+
+	if (img->plugin) {
+		if (img->iov)
+			p->error = "plugin images not supported in bundles";
+
+		if (image_main(img, &main_img) != 0) {
+			fprintf(stderr, "no main image behind the plugin\n");
+			return EX_DATAERR;
+		}
+
+		if (img->dcd)
+			plan_add_dcd(p, img, cpu);
+
+		plan_add(p, PLAN_FILE, "WRITE_FILE", img->load_addr, true,
+			 img->main_offset);
+		plan_add(p, PLAN_JUMP, "JUMP_ADDRESS", image_ivt_addr(img),
+			 true, 0);
+		plan_add(p, PLAN_PLUGIN_WAIT, "ERROR_STATUS", 0, false, 0);
+
+		img = &main_img;
+	} else if (img->dcd) {
+		plan_add_dcd(p, img, cpu);
+	}
+
+	plan_add(p, PLAN_FILE, "WRITE_FILE", img->load_addr, true,
+		 img->fsize);
+	plan_add(p, PLAN_JUMP, "JUMP_ADDRESS", image_ivt_addr(img), true, 0);
+
+	return 0;
+}
+
+/* returns the predicted duration in ns or a negative value when the
+ * profile lacks the required values */
+static double plan_predict(struct plan const *p,
+			   struct profile_entry const *e)
+{
+	double	res = 0;
+
+	for (size_t i = 0; i < p->num_cmds; ++i) {
+		struct plan_cmd const	*cmd = &p->cmds[i];
+
+		res += e->latency_ns;
+
+		switch (cmd->kind) {
+		case PLAN_DCD:
+			if (e->dcd_ns_per_byte > 0) {
+				res += cmd->len * e->dcd_ns_per_byte;
+				break;
+			}
+			/* fallthrough */
+		case PLAN_FILE:
+		case PLAN_STREAM:
+			if (e->bytes_per_s <= 0)
+				return -1;
+
+			res += cmd->len * 1e9 / e->bytes_per_s;
+			break;
+
+		case PLAN_PLUGIN_WAIT:
+			if (e->plugin_ns <= 0)
+				return -1;
+
+			res += e->plugin_ns;
+			break;
+
+		case PLAN_READ_REG:
+		case PLAN_JUMP:
+			break;
+		}
+	}
+
+	return res;
+}
+
+static size_t trailing_zeros(struct mx6_image const *img)
+{
+	uint8_t const	*data = img->data;
+	size_t		len = img->fsize;
+
+	if (img->iov)
+		return 0;
+
+	while (len > img->offset && data[len - 1] == 0)
+		--len;
+
+	return img->fsize - len;
+}
+
+static void plan_print(struct plan const *p)
+{
+	struct plan_cmd	total = { .len = 0 };
+
+	printf("  %-14s %-8s %10s %7s %7s %7s %7s\n", "command", "address",
+	       "payload", "report1", "report2", "report3", "report4");
+
+	for (size_t i = 0; i < p->num_cmds; ++i) {
+		struct plan_cmd const	*cmd = &p->cmds[i];
+		char			addr[12] = "-";
+
+		if (cmd->have_addr)
+			snprintf(addr, sizeof addr, "%08lx",
+				 (unsigned long)cmd->addr);
+
+		printf("  %-14s %-8s %10zu %7u %7u %7u %7u\n", cmd->name,
+		       addr, cmd->len, cmd->num_report1, cmd->num_report2,
+		       cmd->num_report3, cmd->num_report4);
+
+		total.len         += cmd->len;
+		total.num_report1 += cmd->num_report1;
+		total.num_report2 += cmd->num_report2;
+		total.num_report3 += cmd->num_report3;
+		total.num_report4 += cmd->num_report4;
+	}
+
+	printf("  %-14s %-8s %10zu %7u %7u %7u %7u\n", "total",
+	       "", total.len, total.num_report1,
+	       total.num_report2, total.num_report3, total.num_report4);
+
+	if (p->error)
+		printf("  upload would fail: %s\n", p->error);
+}
+
+static int plan_image(struct mx6_image const *img, char const *name,
+		      struct bundle const *b,
+		      struct profile_entry const *entries, size_t num_entries,
+		      struct plan_opts const *opts)
+{
+	struct sdp_cpu_info const	*cpu = NULL;
+	struct plan			p;
+	bool				have_header = false;
+	int				rc;
+
+	for (size_t i = 0; i < num_entries && opts->port; ++i) {
+		if (strcmp(entries[i].port, opts->port) == 0)
+			cpu = sdp_find_cpu_info(entries[i].cpu);
+	}
+
+	printf("%s: %zu bytes", name, img->fsize);
+	if (img->ivt)
+		printf(", IVT at %#x, load address %08lx", img->offset,
+		       (unsigned long)img->load_addr);
+	if (img->dcd)
+		printf(", DCD %zu bytes", img->dcd_len);
+	if (img->plugin)
+		printf(", plugin %zu bytes", img->main_offset);
+	printf(", %zu bytes trailing zeros\n", trailing_zeros(img));
+
+	rc = plan_build(&p, img, b, cpu);
+	if (rc)
+		return rc;
+
+	if (cpu)
+		printf("  commands for %s (port %s):\n", cpu->name, opts->port);
+
+	plan_print(&p);
+
+	for (size_t i = 0; i < num_entries; ++i) {
+		struct profile_entry const	*e = &entries[i];
+		struct plan			ep;
+		double				t;
+
+		if (opts->port && strcmp(e->port, opts->port) != 0)
+			continue;
+
+		/* the command sequence depends on the CPU of the port */
+		rc = plan_build(&ep, img, b, sdp_find_cpu_info(e->cpu));
+		if (rc)
+			return rc;
+
+		if (!have_header) {
+			printf("  %-12s %-8s %7s %10s %12s %12s\n", "port",
+			       "cpu", "samples", "latency", "throughput",
+			       "predicted");
+			have_header = true;
+		}
+
+		t = plan_predict(&ep, e);
+
+		printf("  %-12s %-8s %7u %7.1f us %7.0f kB/s", e->port,
+		       e->cpu, e->samples, e->latency_ns / 1e3,
+		       e->bytes_per_s / 1e3);
+
+		if (t < 0)
+			printf(" %12s\n", "unknown");
+		else
+			printf(" %9.3f ms%s\n", t / 1e6,
+			       ep.error ? " (fails)" : "");
+	}
+
+	if (opts->profile && !have_header)
+		printf("  no profile data%s%s\n",
+		       opts->port ? " for port " : "",
+		       opts->port ? opts->port : "");
+
+	return 0;
+}
+
+static int plan_bundle(struct plan_opts const *opts,
+		       struct profile_entry const *entries, size_t num_entries)
+{
+	struct bundle	b;
+	int		rc;
+
+	rc = bundle_open(&b, opts->file_name);
+	if (rc)
+		return rc;
+
+	for (size_t i = 0; i < le32toh(b.hdr->num_variants) && !rc; ++i) {
+		struct bundle_variant const	*v = &b.variants[i];
+		struct mx6_image		img;
+		char				*name;
+
+		rc = bundle_variant_image(&b, v, &img);
+		if (rc)
+			break;
+
+		if (asprintf(&name, "%s[%.*s]", opts->file_name,
+			     (int)sizeof v->name, v->name) < 0) {
+			image_close(&img);
+			rc = EX_OSERR;
+			break;
+		}
+
+		rc = plan_image(&img, name, &b, entries, num_entries, opts);
+
+		free(name);
+		image_close(&img);
+	}
+
+	bundle_close(&b);
+
+	return rc;
+}
+
+int plan_run(struct plan_opts const *opts)
+{
+	struct profile_entry	*entries = NULL;
+	size_t			num_entries = 0;
+	int			rc;
+
+	if (opts->profile) {
+		rc = profile_load(opts->profile, &entries, &num_entries);
+		if (rc)
+			return rc;
+	}
+
+	if (bundle_probe(opts->file_name)) {
+		rc = plan_bundle(opts, entries, num_entries);
+	} else {
+		struct mx6_image	img;
+
+		rc = image_open(&img, opts->file_name, opts->offset);
+		if (!rc) {
+			rc = plan_image(&img, opts->file_name, NULL, entries,
+					num_entries, opts);
+			image_close(&img);
+		}
+	}
+
+	free(entries);
+
+	return rc;
+}
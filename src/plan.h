@@ -0,0 +1,39 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef H_ENSC_MX6_LOAD_PLAN_H
+#define H_ENSC_MX6_LOAD_PLAN_H
+
+/* --plan: lists the SDP commands which an upload of an image would send
+ * without touching a device and predicts the duration of the upload per
+ * port from a profile (see profile.h).  Bundles are planned for every
+ * variant.  The prediction assumes a cold board, i.e. no --delta. */
+
+struct plan_opts {
+	char const	*file_name;
+	unsigned int	offset;
+	/* NULL disables the prediction */
+	char const	*profile;
+	/* limits the prediction to this port; its CPU is used for the
+	 * command list */
+	char const	*port;
+};
+
+/* returns 0 or a sysexits(3) code */
+int	plan_run(struct plan_opts const *opts);
+
+#endif	/* H_ENSC_MX6_LOAD_PLAN_H */
@@ -0,0 +1,231 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "profile.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sysexits.h>
+#include <sys/file.h>
+#include <sys/param.h>
+
+#define PROFILE_FORMAT_IN \
+	"%31s %15s %u %lf %lf %lf %lf"
+#define PROFILE_FORMAT_OUT \
+	"%s %s %u %.0f %.0f %.3f %.0f\n"
+
+static int profile_parse(FILE *f, char const *file_name,
+			 struct profile_entry **entries, size_t *cnt)
+{
+	char			*line = NULL;
+	size_t			line_sz = 0;
+	unsigned int		line_num = 0;
+	struct profile_entry	*res = NULL;
+	size_t			num = 0;
+	int			rc = 0;
+
+	while (getline(&line, &line_sz, f) >= 0) {
+		struct profile_entry	e = { };
+		struct profile_entry	*tmp;
+
+		++line_num;
+
+		if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+			continue;
+
+		if (sscanf(line, PROFILE_FORMAT_IN, e.port, e.cpu, &e.samples,
+			   &e.latency_ns, &e.bytes_per_s, &e.dcd_ns_per_byte,
+			   &e.plugin_ns) != 7) {
+			fprintf(stderr, "%s:%u: bad profile entry\n",
+				file_name, line_num);
+			rc = EX_DATAERR;
+			break;
+		}
+
+		tmp = realloc(res, (num + 1) * sizeof res[0]);
+		if (!tmp) {
+			rc = EX_OSERR;
+			break;
+		}
+
+		res = tmp;
+		res[num++] = e;
+	}
+
+	free(line);
+
+	if (rc) {
+		free(res);
+		return rc;
+	}
+
+	*entries = res;
+	*cnt     = num;
+
+	return 0;
+}
+
+int profile_load(char const *file_name, struct profile_entry **entries,
+		 size_t *cnt)
+{
+	FILE	*f = fopen(file_name, "r");
+	int	rc;
+
+	if (!f && errno == ENOENT) {
+		*entries = NULL;
+		*cnt     = 0;
+		return 0;
+	}
+
+	if (!f) {
+		fprintf(stderr, "failed to open '%s': %m\n", file_name);
+		return EX_NOINPUT;
+	}
+
+	rc = profile_parse(f, file_name, entries, cnt);
+	fclose(f);
+
+	return rc;
+}
+
+static void profile_avg(double *v, double sample, unsigned int samples)
+{
+	if (sample <= 0)
+		return;
+
+	if (*v <= 0)
+		*v = sample;
+	else
+		*v += (sample - *v) / MIN(samples + 1u, PROFILE_WINDOW);
+}
+
+static void profile_merge(struct profile_entry *e,
+			  struct profile_sample const *s)
+{
+	double	latency;
+	double	t_payload;
+
+	profile_avg(&e->latency_ns, s->t_jump, e->samples);
+
+	latency = e->latency_ns;
+
+	/* the WRITE_FILE duration without the command overhead */
+	t_payload = (double)s->t_file - latency;
+	if (s->file_len > 0 && t_payload > 0)
+		profile_avg(&e->bytes_per_s, s->file_len * 1e9 / t_payload,
+			    e->samples);
+
+	if (s->dcd_len > 0 && s->t_dcd > latency)
+		profile_avg(&e->dcd_ns_per_byte,
+			    (s->t_dcd - latency) / s->dcd_len, e->samples);
+
+	/* upload of the plugin, jump and status request */
+	if (s->t_plugin > 0 && e->bytes_per_s > 0)
+		profile_avg(&e->plugin_ns,
+			    s->t_plugin - 3 * latency -
+			    s->plugin_len * 1e9 / e->bytes_per_s, e->samples);
+
+	if (s->cpu)
+		snprintf(e->cpu, sizeof e->cpu, "%s", s->cpu);
+
+	++e->samples;
+}
+
+int profile_record(char const *file_name, char const *port,
+		   struct profile_sample const *s)
+{
+	struct profile_entry	*entries = NULL;
+	struct profile_entry	*e = NULL;
+	size_t			cnt = 0;
+	FILE			*f;
+	int			fd;
+	int			rc;
+
+	fd = open(file_name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "failed to open '%s': %m\n", file_name);
+		return EX_CANTCREAT;
+	}
+
+	/* the lock is released by closing the file */
+	if (flock(fd, LOCK_EX) < 0) {
+		fprintf(stderr, "failed to lock '%s': %m\n", file_name);
+		close(fd);
+		return EX_TEMPFAIL;
+	}
+
+	f = fdopen(fd, "r+");
+	if (!f) {
+		close(fd);
+		return EX_OSERR;
+	}
+
+	rc = profile_parse(f, file_name, &entries, &cnt);
+	if (rc)
+		goto out;
+
+	for (size_t i = 0; i < cnt && !e; ++i) {
+		if (strcmp(entries[i].port, port) == 0)
+			e = &entries[i];
+	}
+
+	if (!e) {
+		struct profile_entry	*tmp;
+
+		tmp = realloc(entries, (cnt + 1) * sizeof entries[0]);
+		if (!tmp) {
+			rc = EX_OSERR;
+			goto out;
+		}
+
+		entries = tmp;
+		e = &entries[cnt++];
+
+		*e = (struct profile_entry) {
+			.cpu	= "-",
+		};
+		snprintf(e->port, sizeof e->port, "%s", port);
+	}
+
+	profile_merge(e, s);
+
+	rewind(f);
+
+	for (size_t i = 0; i < cnt; ++i)
+		fprintf(f, PROFILE_FORMAT_OUT, entries[i].port,
+			entries[i].cpu, entries[i].samples,
+			entries[i].latency_ns, entries[i].bytes_per_s,
+			entries[i].dcd_ns_per_byte, entries[i].plugin_ns);
+
+	if (fflush(f) != 0 || ftruncate(fd, ftell(f)) < 0) {
+		fprintf(stderr, "failed to write '%s': %m\n", file_name);
+		rc = EX_IOERR;
+	}
+
+out:
+	free(entries);
+	fclose(f);
+
+	return rc;
+}
@@ -0,0 +1,71 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef H_ENSC_MX6_LOAD_PROFILE_H
+#define H_ENSC_MX6_LOAD_PROFILE_H
+
+/* Transfer characteristics per USB port which are learned from uploads
+ * and used by --plan to predict the duration of an upload.  The profile
+ * is a text file with one line per port:
+ *
+ *   <port> <cpu> <samples> <latency_ns> <bytes_per_s> <dcd_ns_per_byte>
+ *          <plugin_ns>
+ *
+ * <latency_ns> is the round trip of a command without payload (JUMP),
+ * <dcd_ns_per_byte> covers transfer and execution of DCD_WRITE and
+ * <plugin_ns> is the run time of a plugin.  Values are moving averages
+ * over the last PROFILE_WINDOW uploads; 0 means unknown.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define PROFILE_WINDOW	8u
+
+struct profile_entry {
+	char		port[32];
+	char		cpu[16];
+	unsigned int	samples;
+	double		latency_ns;
+	double		bytes_per_s;
+	double		dcd_ns_per_byte;
+	double		plugin_ns;
+};
+
+/* durations of a single upload; phases which were not executed are 0 */
+struct profile_sample {
+	char const	*cpu;
+	uint64_t	t_jump;
+	uint64_t	t_file;
+	size_t		file_len;
+	uint64_t	t_dcd;
+	size_t		dcd_len;
+	/* upload and run of the plugin */
+	uint64_t	t_plugin;
+	size_t		plugin_len;
+};
+
+/* returns 0 or a sysexits(3) code; a missing file is an empty profile */
+int	profile_load(char const *file_name, struct profile_entry **entries,
+		     size_t *cnt);
+
+/* merges 's' into the entry of 'port'; concurrent updates of the same file
+ * are serialized by a lock.  Returns 0 or a sysexits(3) code. */
+int	profile_record(char const *file_name, char const *port,
+		       struct profile_sample const *s);
+
+#endif	/* H_ENSC_MX6_LOAD_PROFILE_H */
@@ -22,45 +22,252 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include <libusb.h>
+#include <sys/uio.h>
 #include <sys/param.h>
 
 #include "util.h"
+#include "dcd.h"
+#include "metrics.h"
 
 #define FREESCALE_VENDOR_ID     	0x15a2
 #define FREESCALE_PRODUCT_MX6_ID    	0x0054
 #define FREESCALE_PRODUCT_MX7_ID    	0x0076
 
-struct sdp_cpu_info {
-	char const		*name;
-	uint32_t		dcd_addr;
-};
+#define NXP_VENDOR_ID			0x1fc9
+#define NXP_PRODUCT_MX8QM_ID		0x0129
+#define NXP_PRODUCT_MX8QXP_ID		0x012f
+#define NXP_PRODUCT_MX8MM_ID		0x0134
+
+/* "BLTC" signature and command of the SDPS download CBW */
+#define SDPS_BLTC_SIGNATURE		0x43544c42u
+#define SDPS_BLTC_DOWNLOAD_FW		2u
+
+/* WDOG_WCR bits */
+#define WDOG_WCR_WDE			(1u << 2)
+#define WDOG_WCR_SRS			(1u << 4)
+#define WDOG_WCR_WDA			(1u << 5)
+#define WDOG_WCR_WT_SHIFT		8
+
+/* host reads before AUTO polling trusts its round trip estimate */
+#define SDP_POLL_SPIN_READS		2u
+/* keep DCD checks well below the 2s transfer timeout */
+#define SDP_POLL_DCD_MAX_MS		1500u
 
 struct sdp {
 	struct libusb_context		*ctx;
 	struct libusb_device		*dev;
 	struct libusb_device_handle	*h;
 	bool				own_context;
-	char const			*devpath;
 	struct sdp_cpu_info const	*cpu_info;
+	struct sdp_device_info		info;
 };
 
 enum {
 	SDP_CPU_IMX7,
 	SDP_CPU_IMX6,
+	SDP_CPU_IMX8MM,
+	SDP_CPU_IMX8QXP,
+	SDP_CPU_IMX8QM,
 };
 
+#define R_LOAD	(SDP_MEM_LOAD | SDP_MEM_REG)
+#define R_REG	(SDP_MEM_REG)
+#define R_DCD	(SDP_MEM_REG | SDP_MEM_DCD)
+#define R_DDR	(SDP_MEM_DDR)
+
+/* memory maps as seen by the boot ROM; DCD targets are restricted to the
+ * ranges listed in the "DCD" chapter of the reference manuals */
 static struct sdp_cpu_info const	CPU_INFO[] = {
 	[SDP_CPU_IMX6] = {
 		.name		= "i.MX 6",
+		.id		= "imx6",
+		.vid		= FREESCALE_VENDOR_ID,
+		.pid		= FREESCALE_PRODUCT_MX6_ID,
+		.protocol	= SDP_PROTO_SDP,
 		.dcd_addr	= 0x00907000,
+		.dcd_check_rate	= 1000,
+		.stub_addr	= 0x00910000,
+		.stub_size	= 0x00010000,
+		.wdog_addr	= 0x020bc000,
+		/* MMDC0_MDCTL.SDE_0 */
+		.ddr_ready	= { 0x021b0000, 0x80000000, 0x80000000 },
+		.regions	= (struct sdp_mem_region const []) {
+			{ 0x00900000, 0x00906fff, R_LOAD },
+			{ 0x00907000, 0x00937fff, R_LOAD | R_DCD }, /* OCRAM free area */
+			{ 0x00938000, 0x0093ffff, R_LOAD },
+			{ 0x02000000, 0x020c3fff, R_REG },
+			{ 0x020c4000, 0x020c8fff, R_DCD },	/* CCM, ANALOG */
+			{ 0x020c9000, 0x020dffff, R_REG },
+			{ 0x020e0000, 0x020e3fff, R_DCD },	/* IOMUXC */
+			{ 0x020e4000, 0x021affff, R_REG },
+			{ 0x021b0000, 0x021bbfff, R_DCD },	/* MMDC, EIM */
+			{ 0x021bc000, 0x02bfffff, R_REG },
+			{ 0x10000000, 0xffffffff, R_LOAD | R_DCD | R_DDR }, /* DDR */
+			{ .flags = 0 },
+		},
 	},
 	[SDP_CPU_IMX7] = {
 		.name		= "i.MX 7",
+		.id		= "imx7",
+		.vid		= FREESCALE_VENDOR_ID,
+		.pid		= FREESCALE_PRODUCT_MX7_ID,
+		.protocol	= SDP_PROTO_SDP,
 		.dcd_addr	= 0x00910000,
+		.dcd_check_rate	= 1000,
+		.stub_addr	= 0x00918000,
+		.stub_size	= 0x00008000,
+		.wdog_addr	= 0x30280000,
+		/* DDRC_STAT.operating_mode == normal */
+		.ddr_ready	= { 0x307a0004, 0x00000007, 0x00000001 },
+		.regions	= (struct sdp_mem_region const []) {
+			{ 0x00900000, 0x0090ffff, R_LOAD },
+			{ 0x00910000, 0x0093ffff, R_LOAD | R_DCD }, /* OCRAM */
+			{ 0x30000000, 0x3032ffff, R_REG },
+			{ 0x30330000, 0x3034ffff, R_DCD },	/* IOMUXC, GPR */
+			{ 0x30350000, 0x3035ffff, R_REG },
+			{ 0x30360000, 0x3036ffff, R_DCD },	/* ANATOP */
+			{ 0x30370000, 0x3037ffff, R_REG },
+			{ 0x30380000, 0x3039ffff, R_DCD },	/* CCM, SRC */
+			{ 0x303a0000, 0x3078ffff, R_REG },
+			{ 0x30790000, 0x307affff, R_DCD },	/* DDR PHY, DDRC */
+			{ 0x307b0000, 0x30ffffff, R_REG },
+			{ 0x80000000, 0xffffffff, R_LOAD | R_DCD | R_DDR }, /* DDR */
+			{ .flags = 0 },
+		},
+	},
+	/* the i.MX 8M ROMs implement the SDP command set but ignore the
+	 * DCD; the SPL initializes the DDR controller */
+	[SDP_CPU_IMX8MM] = {
+		.name		= "i.MX 8M Mini",
+		.id		= "imx8mm",
+		.vid		= NXP_VENDOR_ID,
+		.pid		= NXP_PRODUCT_MX8MM_ID,
+		.protocol	= SDP_PROTO_SDP,
+		.regions	= (struct sdp_mem_region const []) {
+			{ 0x007e0000, 0x0081ffff, R_LOAD },	/* TCM */
+			{ 0x00900000, 0x0093ffff, R_LOAD },	/* OCRAM */
+			{ 0x30000000, 0x3fffffff, R_REG },
+			{ 0x40000000, 0xffffffff, R_LOAD | R_DDR }, /* DDR */
+			{ .flags = 0 },
+		},
+	},
+	[SDP_CPU_IMX8QXP] = {
+		.name		= "i.MX 8QuadXPlus",
+		.id		= "imx8qxp",
+		.vid		= NXP_VENDOR_ID,
+		.pid		= NXP_PRODUCT_MX8QXP_ID,
+		.protocol	= SDP_PROTO_SDPS,
+		.regions	= (struct sdp_mem_region const []) {
+			{ .flags = 0 },
+		},
+	},
+	[SDP_CPU_IMX8QM] = {
+		.name		= "i.MX 8QuadMax",
+		.id		= "imx8qm",
+		.vid		= NXP_VENDOR_ID,
+		.pid		= NXP_PRODUCT_MX8QM_ID,
+		.protocol	= SDP_PROTO_SDPS,
+		.regions	= (struct sdp_mem_region const []) {
+			{ .flags = 0 },
+		},
 	},
 };
 
+#undef R_DDR
+#undef R_DCD
+#undef R_REG
+#undef R_LOAD
+
+struct sdp_cpu_info const *sdp_find_cpu_info(char const *id)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(CPU_INFO); ++i) {
+		if (strcmp(CPU_INFO[i].id, id) == 0)
+			return &CPU_INFO[i];
+	}
+
+	return NULL;
+}
+
+struct sdp_cpu_info const *sdp_find_cpu_by_usb_id(uint16_t vid, uint16_t pid)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(CPU_INFO); ++i) {
+		if (CPU_INFO[i].vid == vid && CPU_INFO[i].pid == pid)
+			return &CPU_INFO[i];
+	}
+
+	return NULL;
+}
+
+struct sdp_cpu_info const *sdp_get_cpu_info(struct sdp const *sdp)
+{
+	return sdp->cpu_info;
+}
+
+bool sdp_cpu_check_region(struct sdp_cpu_info const *cpu,
+			  uint32_t addr, size_t len, unsigned int flags)
+{
+	uint64_t	pos = addr;
+	uint64_t	end = (uint64_t)addr + (len > 0 ? len : 1);
+
+	/* the range might span adjacent regions with different attributes;
+	 * walk through them until it is covered completely */
+	while (pos < end) {
+		struct sdp_mem_region const	*r;
+
+		for (r = cpu->regions; r->flags; ++r) {
+			if (pos >= r->start && pos <= r->end)
+				break;
+		}
+
+		if (!r->flags || (r->flags & flags) != flags)
+			return false;
+
+		pos = (uint64_t)r->end + 1;
+	}
+
+	return true;
+}
+
+static void sdp_fill_port_path(struct libusb_device *dev,
+			       char *buf, size_t len)
+{
+	uint8_t		ports[8];
+	int		num_ports;
+	size_t		pos = 0;
+
+	buf[0] = '\0';
+
+	num_ports = libusb_get_port_numbers(dev, ports, ARRAY_SIZE(ports));
+	for (int i = 0; i < num_ports && pos < len; ++i)
+		pos += snprintf(buf + pos, len - pos, "%s%u",
+				i == 0 ? "" : ".", ports[i]);
+}
+
+bool sdp_context_init(struct sdp_context *info)
+{
+	int		rc;
+
+	rc = libusb_init(&info->usb);
+	if (rc != 0) {
+		fprintf(stderr, "libusb_init(): %s\n", libusb_error_name(rc));
+		metrics_error(METRICS_SITE_INIT, rc);
+		info->usb = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+void sdp_context_destroy(struct sdp_context *info)
+{
+	if (info->usb)
+		libusb_exit(info->usb);
+
+	info->usb = NULL;
+}
+
 struct sdp *sdp_open(struct sdp_context *info)
 {
 	struct sdp		*sdp;
@@ -69,7 +276,7 @@ struct sdp *sdp_open(struct sdp_context *info)
 	struct libusb_device	**dev_list = NULL;
 	size_t			i;
 	bool			claimed = false;
-	struct sdp_cpu_info const	*cpu_info = NULL;
+	uint64_t		t_found;
 
 	sdp = calloc(1, sizeof *sdp);
 	if (!sdp)
@@ -82,6 +289,7 @@ struct sdp *sdp_open(struct sdp_context *info)
 		rc = libusb_init(&sdp->ctx);
 		if (rc != 0) {
 			fprintf(stderr, "libusb_init(): %s\n", libusb_error_name(rc));
+			metrics_error(METRICS_SITE_INIT, rc);
 			goto err;
 		}
 
@@ -92,62 +300,74 @@ again:
 	dev_list_cnt = libusb_get_device_list(sdp->ctx, &dev_list);
 	if (dev_list_cnt < 0) {
 		fprintf(stderr, "libusb_get_device_list(): %s\n",
-			libusb_error_name(rc));
+			libusb_error_name(dev_list_cnt));
+		metrics_error(METRICS_SITE_DEVICE_LIST, dev_list_cnt);
 		goto err;
 	}
 
 	for (i = 0; i < (size_t)(dev_list_cnt) && !sdp->dev; ++i) {
 		struct libusb_device			*dev = dev_list[i];
 		struct libusb_device_descriptor		desc;
+		struct sdp_cpu_info const		*cpu_info;
 
 		rc = libusb_get_device_descriptor(dev, &desc);
 		if (rc < 0) {
 			fprintf(stderr, "libusb_get_device_descriptor(): %s\n",
 				libusb_error_name(rc));
+			metrics_error(METRICS_SITE_DESCRIPTOR, rc);
 			continue;
 		}
 
-		if (desc.idVendor != FREESCALE_VENDOR_ID)
-			continue;
-
-		switch (desc.idProduct) {
-		case FREESCALE_PRODUCT_MX6_ID:
-			cpu_info = &CPU_INFO[SDP_CPU_IMX6];
-			break;
-
-		case FREESCALE_PRODUCT_MX7_ID:
-			cpu_info = &CPU_INFO[SDP_CPU_IMX7];
-			break;
-
-		default:
+		cpu_info = sdp_find_cpu_by_usb_id(desc.idVendor,
+						  desc.idProduct);
+		if (cpu_info) {
+			; /* noop */
+		} else if (desc.idVendor == FREESCALE_VENDOR_ID) {
 			fprintf(stderr,
 				"unknown cpu %04x detected; assuming i.MX6\n",
 				desc.idProduct);
 			cpu_info = &CPU_INFO[SDP_CPU_IMX6];
-			break;
+		} else {
+			continue;
 		}
 
-		/* \todo: call match() */
+		sdp->info = (struct sdp_device_info) {
+			.vid	= desc.idVendor,
+			.pid	= desc.idProduct,
+			.bus	= libusb_get_bus_number(dev),
+			.addr	= libusb_get_device_address(dev),
+			.cpu	= cpu_info,
+		};
+
+		sdp_fill_port_path(dev, sdp->info.port_path,
+				   sizeof sdp->info.port_path);
 
+		if (info && info->match && !info->match(info, &sdp->info))
+			continue;
+
+		sdp->cpu_info = cpu_info;
 		sdp->dev = libusb_ref_device(dev);
 	}
 
-	sdp->cpu_info = cpu_info;
 	libusb_free_device_list(dev_list, 1);
 
 	if (sdp->dev) {
 		; /* noop */
 	} else if (info && info->wait_for_device && 
 		   info->wait_for_device(info)) {
+		metrics_retry(METRICS_RETRY_ENUMERATION);
 		goto again;
 	} else {
 		fprintf(stderr, "no mx6 device found\n");
 		goto err;
 	}
 
+	t_found = monotonic_ns();
+
 	rc = libusb_open(sdp->dev, &sdp->h);
 	if (rc < 0) {
 		fprintf(stderr, "libusb_open(): %s\n", libusb_error_name(rc));
+		metrics_error(METRICS_SITE_OPEN, rc);
 		sdp->h = NULL;
 		goto err;
 	}
@@ -158,10 +378,12 @@ again:
 	if (rc < 0) {
 		fprintf(stderr, "libusb_claim_interface(): %s\n",
 			libusb_error_name(rc));
+		metrics_error(METRICS_SITE_CLAIM, rc);
 		goto err;
 	}
 
 	claimed = true;
+	metrics_phase(METRICS_PHASE_OPEN, monotonic_ns() - t_found);
 
 	return sdp;
 
@@ -194,7 +416,6 @@ void	sdp_close(struct sdp *sdp)
 	if (sdp->own_context)
 		libusb_exit(sdp->ctx);
 
-	free((void *)sdp->devpath);
 	free(sdp);
 }
 
@@ -208,62 +429,103 @@ struct sdp_data_report1 {
 	be8_t		reserved;
 } __packed;
 
+/* 'buf' starts with the report id */
+static int sdp_set_report(struct sdp *sdp, void const *buf, size_t len)
+{
+	return libusb_control_transfer(sdp->h,
+				       LIBUSB_REQUEST_TYPE_CLASS |
+				       LIBUSB_RECIPIENT_INTERFACE,
+				       0x09, /* SET_REPORT */
+				       0x0200 | ((uint8_t const *)buf)[0],
+				       LIBUSB_ENDPOINT_OUT | 0,
+				       (void *)buf, len,
+				       2000);
+}
+
 static bool sdp_write_data_report1(struct sdp *sdp,
 				   struct sdp_data_report1 const *rep)
 {
 	int		rc;
 
-	rc = libusb_control_transfer(sdp->h,
-				     LIBUSB_REQUEST_TYPE_CLASS | 
-				     LIBUSB_RECIPIENT_INTERFACE,
-				     0x09, /* SET_REPORT */
-				     0x0200 | 1,
-				     LIBUSB_ENDPOINT_OUT | 0,
-				     (void *)rep, sizeof *rep,
-				     2000);
+	if (sdp->cpu_info->protocol != SDP_PROTO_SDP) {
+		fprintf(stderr, "%s does not support SDP commands\n",
+			sdp->cpu_info->name);
+		metrics_error(METRICS_SITE_REPORT1, METRICS_ERR_PROTOCOL);
+		return false;
+	}
+
+	rc = sdp_set_report(sdp, rep, sizeof *rep);
 	if (rc < 0) {
 		fprintf(stderr, "libusb_control_transfer(<report1>): %s\n",
 			libusb_error_name(rc));
+		metrics_error(METRICS_SITE_REPORT1, rc);
 		return false;
 	}
 
 	return true;
 }
 
-static bool sdp_send_payload_report2(struct sdp *sdp,
-				     void const *data, size_t len)
+static bool sdp_send_payload_report2v(struct sdp *sdp,
+				      struct iovec const *iov, size_t iov_cnt)
 {
-	unsigned char	buf[1025];
-	void const	*ptr = data;
+	unsigned char	buf[SDP_REPORT2_SIZE + 1];
+	size_t		fill = 0;
+	size_t		total = 0;
 	int		rc = 0;
 
-	while (len > 0 && rc >= 0) {
-		size_t		l = MIN(sizeof buf - 1u, len);
+	/* reports are filled across iovec boundaries; only the last one
+	 * might be short */
+	for (size_t i = 0; i < iov_cnt && rc >= 0; ++i) {
+		uint8_t const	*ptr = iov[i].iov_base;
+		size_t		len = iov[i].iov_len;
 
-		buf[0] = 2;
-		memcpy(buf+1, ptr, l);
+		while (len > 0 && rc >= 0) {
+			size_t		l = MIN(sizeof buf - 1u - fill, len);
+
+			memcpy(buf + 1 + fill, ptr, l);
+			fill += l;
+			ptr  += l;
+			len  -= l;
 
-		rc = libusb_control_transfer(sdp->h,
-					     LIBUSB_REQUEST_TYPE_CLASS | 
-					     LIBUSB_RECIPIENT_INTERFACE,
-					     0x09, /* SET_REPORT */
-					     0x0200 | 2,
-					     LIBUSB_ENDPOINT_OUT | 0,
-					     buf, l+1, 2000);
+			if (fill < sizeof buf - 1u)
+				continue;
 
-		ptr += l;
-		len -= l;
+			buf[0] = 2;
+			rc = sdp_set_report(sdp, buf, fill + 1);
+			total += fill;
+			fill   = 0;
+		}
+	}
+
+	if (fill > 0 && rc >= 0) {
+		buf[0] = 2;
+		rc = sdp_set_report(sdp, buf, fill + 1);
+		total += fill;
 	}
 
+	metrics_payload(total);
+
 	if (rc < 0) {
 		fprintf(stderr, "libusb_control_transfer(<payload>): %s\n",
 			libusb_error_name(rc));
+		metrics_error(METRICS_SITE_PAYLOAD, rc);
 		return false;
 	}
 
 	return true;
 }
 
+static bool sdp_send_payload_report2(struct sdp *sdp,
+				     void const *data, size_t len)
+{
+	struct iovec	iov = {
+		.iov_base	= (void *)data,
+		.iov_len	= len,
+	};
+
+	return sdp_send_payload_report2v(sdp, &iov, 1);
+}
+
 static bool sdp_verify_sec_report3(struct sdp *sdp, uint32_t val)
 {
 	struct {
@@ -281,22 +543,26 @@ static bool sdp_verify_sec_report3(struct sdp *sdp, uint32_t val)
 	if (rc < 0) {
 		fprintf(stderr, "libusb_interrupt_transfer(<report3>): %s\n",
 			libusb_error_name(rc));
+		metrics_error(METRICS_SITE_REPORT3, rc);
 		return false;
 	}
 	
 	if ((size_t)len != sizeof buf) {
 		fprintf(stderr, "unexpected report3 len: %d\n", len);
+		metrics_error(METRICS_SITE_REPORT3, METRICS_ERR_PROTOCOL);
 		return false;
 	}
 
 	if (buf.id != 3) {
 		fprintf(stderr, "unexpected report3 tag: %02x\n", buf.id);
+		metrics_error(METRICS_SITE_REPORT3, METRICS_ERR_PROTOCOL);
 		return false;
 	}
 
 	if (be32toh(buf.code) != val) {
 		fprintf(stderr, "unexpected report3 status: %08x vs. %08x\n",
 			be32toh(buf.code), val);
+		metrics_error(METRICS_SITE_STATUS, METRICS_ERR_PROTOCOL);
 		return false;
 	}
 
@@ -325,16 +591,19 @@ static bool _sdp_get_data_report4(struct sdp *sdp, void *dst, size_t cnt)
 	if (rc < 0) {
 		fprintf(stderr, "libusb_interrupt_transfer(<report4>): %s\n",
 			libusb_error_name(rc));
+		metrics_error(METRICS_SITE_REPORT4, rc);
 		return false;
 	}
 	
 	if ((size_t)len < cnt + 1u) {
 		fprintf(stderr, "unexpected report4 len: %d\n", len);
+		metrics_error(METRICS_SITE_REPORT4, METRICS_ERR_PROTOCOL);
 		return false;
 	}
 
 	if (buf.id != 4) {
 		fprintf(stderr, "unexpected report4 tag: %02x\n", buf.id);
+		metrics_error(METRICS_SITE_REPORT4, METRICS_ERR_PROTOCOL);
 		return false;
 	}
 
@@ -395,8 +664,9 @@ bool sdp_read_regw(struct sdp *sdp, uint32_t addr, uint16_t val[], size_t cnt)
 	if (!_sdp_read_reg(sdp, addr, val, sizeof val[0], cnt))
 		return false;
 
+	/* the ROM returns the memory content as is */
 	for (i = 0; i < cnt; ++i)
-		val[i] = be16toh(val[i]);
+		val[i] = le16toh(val[i]);
 
 	return true;
 }
@@ -408,15 +678,55 @@ bool sdp_read_regl(struct sdp *sdp, uint32_t addr, uint32_t val[], size_t cnt)
 	if (!_sdp_read_reg(sdp, addr, val, sizeof val[0], cnt))
 		return false;
 
+	/* the ROM returns the memory content as is */
 	for (i = 0; i < cnt; ++i)
-		val[i] = be32toh(val[i]);
+		val[i] = le32toh(val[i]);
+
+	return true;
+}
+
+static bool _sdp_write_reg(struct sdp *sdp, uint32_t val, uint32_t addr,
+			   size_t elem_sz)
+{
+	struct sdp_data_report1		rep = {
+		.id		= 1,
+		.cmd		= htobe16(0x0202), /* WRITE_REGISTER */
+		.address	= htobe32(addr),
+		.count		= htobe32(elem_sz),
+		.format		= elem_sz * 8,
+		.data		= htobe32(val),
+	};
+	uint32_t			tmp;
+
+	if (!sdp_write_data_report1(sdp, &rep) ||
+	    !sdp_verify_sec_report3(sdp, 0x56787856) ||
+	    !sdp_get_data_report4(sdp, &tmp, 4))
+		return false;
+
+	if (be32toh(tmp) != 0x128a8a12) {
+		fprintf(stderr, "WRITE_REGISTER(%08x) failed: %08x\n",
+			addr, be32toh(tmp));
+		metrics_error(METRICS_SITE_STATUS, METRICS_ERR_PROTOCOL);
+		return false;
+	}
 
 	return true;
 }
 
-bool	sdp_read_writeb(struct sdp *, uint8_t val, uint32_t addr);
-bool	sdp_read_writew(struct sdp *, uint16_t val, uint32_t addr);
-bool	sdp_read_writel(struct sdp *, uint32_t val, uint32_t addr);
+bool	sdp_read_writeb(struct sdp *sdp, uint8_t val, uint32_t addr)
+{
+	return _sdp_write_reg(sdp, val, addr, sizeof val);
+}
+
+bool	sdp_read_writew(struct sdp *sdp, uint16_t val, uint32_t addr)
+{
+	return _sdp_write_reg(sdp, val, addr, sizeof val);
+}
+
+bool	sdp_read_writel(struct sdp *sdp, uint32_t val, uint32_t addr)
+{
+	return _sdp_write_reg(sdp, val, addr, sizeof val);
+}
 
 bool	sdp_read_error_status(struct sdp *sdp, int *status)
 {
@@ -435,19 +745,78 @@ bool	sdp_read_error_status(struct sdp *sdp, int *status)
 	return true;
 }
 
-bool	sdp_write_file(struct sdp *sdp, uint32_t addr,
-		       void const *data, size_t count)
+bool	sdp_wdog_arm(struct sdp *sdp, unsigned int timeout_ms)
+{
+	/* WT counts in 0.5s steps starting at 0.5s */
+	unsigned int	wt = MIN(MAX(timeout_ms, 500u) / 500u - 1u, 0xffu);
+
+	if (sdp->cpu_info->wdog_addr == 0) {
+		fprintf(stderr, "%s: watchdog not supported\n",
+			sdp->cpu_info->name);
+		return false;
+	}
+
+	return sdp_read_writew(sdp,
+			       (wt << WDOG_WCR_WT_SHIFT) | WDOG_WCR_WDA |
+			       WDOG_WCR_SRS | WDOG_WCR_WDE,
+			       sdp->cpu_info->wdog_addr);
+}
+
+bool	sdp_wdog_service(struct sdp *sdp)
+{
+	uint32_t	wsr = sdp->cpu_info->wdog_addr + 2;
+
+	if (sdp->cpu_info->wdog_addr == 0) {
+		fprintf(stderr, "%s: watchdog not supported\n",
+			sdp->cpu_info->name);
+		return false;
+	}
+
+	/* WDOG_WSR service sequence */
+	return (sdp_read_writew(sdp, 0x5555, wsr) &&
+		sdp_read_writew(sdp, 0xaaaa, wsr));
+}
+
+bool	sdp_reset(struct sdp *sdp)
+{
+	struct sdp_data_report1		rep = {
+		.id		= 1,
+		.cmd		= htobe16(0x0202), /* WRITE_REGISTER */
+		.address	= htobe32(sdp->cpu_info->wdog_addr),
+		.count		= htobe32(2),
+		.format		= 16,
+		/* SRS cleared */
+		.data		= htobe32(WDOG_WCR_WDA),
+	};
+
+	if (sdp->cpu_info->wdog_addr == 0) {
+		fprintf(stderr, "%s: watchdog not supported\n",
+			sdp->cpu_info->name);
+		return false;
+	}
+
+	/* the board resets immediately; there will be no status */
+	return sdp_write_data_report1(sdp, &rep);
+}
+
+bool	sdp_write_filev(struct sdp *sdp, uint32_t addr,
+			struct iovec const *iov, size_t iov_cnt)
 {
 	struct sdp_data_report1		rep = {
 		.id		= 1,
 		.cmd		= htobe16(0x0404), /* WRITE_FILE */
 		.address	= htobe32(addr),
-		.count		= htobe32(count),
 	};
+	size_t				count = 0;
 	uint32_t			tmp;
 
+	for (size_t i = 0; i < iov_cnt; ++i)
+		count += iov[i].iov_len;
+
+	rep.count = htobe32(count);
+
 	if (!sdp_write_data_report1(sdp, &rep) ||
-	    !sdp_send_payload_report2(sdp, data, count) ||
+	    !sdp_send_payload_report2v(sdp, iov, iov_cnt) ||
 	    !sdp_verify_sec_report3(sdp, 0x56787856) ||
 	    !sdp_get_data_report4(sdp, &tmp, 4))
 		return false;
@@ -455,6 +824,17 @@ bool	sdp_write_file(struct sdp *sdp, uint32_t addr,
 	return true;
 }
 
+bool	sdp_write_file(struct sdp *sdp, uint32_t addr,
+		       void const *data, size_t count)
+{
+	struct iovec	iov = {
+		.iov_base	= (void *)data,
+		.iov_len	= count,
+	};
+
+	return sdp_write_filev(sdp, addr, &iov, 1);
+}
+
 //bool	sdp_write_dcd(struct sdp *, struct sdp_dcd const *dcd)
 bool	sdp_write_dcd(struct sdp *sdp, void const *dcd, size_t len)
 {
@@ -466,11 +846,17 @@ bool	sdp_write_dcd(struct sdp *sdp, void const *dcd, size_t len)
 	};
 	uint32_t		tmp;
 
-	if (len > 1768) {
+	if (len > SDP_DCD_MAX_SIZE) {
 		fprintf(stderr, "DCD too large (%zu)\n", len);
 		return false;
 	}
 
+	if (sdp->cpu_info->dcd_addr == 0) {
+		fprintf(stderr, "%s does not support DCD\n",
+			sdp->cpu_info->name);
+		return false;
+	}
+
 	if (!sdp_write_data_report1(sdp, &rep) ||
 	    !sdp_send_payload_report2(sdp, dcd, len) ||
 	    !sdp_verify_sec_report3(sdp, 0x56787856) ||
@@ -499,31 +885,197 @@ bool	sdp_jump(struct sdp *sdp, uint32_t addr)
 	return true;
 }
 
-char const *sdp_get_devpath(struct sdp *sdp)
+/* command block wrapper of the HID based BLTC protocol */
+struct sdps_cbw {
+	be8_t		id;
+	uint32_t	signature;
+	uint32_t	tag;
+	uint32_t	xfer_length;
+	uint8_t		flags;
+	uint8_t		reserved[2];
+	struct {
+		uint8_t		command;
+		be32_t		length;
+		uint8_t		reserved[11];
+	} __packed	cdb;
+} __packed;
+
+bool	sdps_write_image(struct sdp *sdp, void const *data, size_t count)
 {
-	uint8_t		ports[8];
-	int		num_ports;
-	char		*path;
-	char		*ptr;
+	struct sdps_cbw		cbw = {
+		.id		= 1,
+		.signature	= htole32(SDPS_BLTC_SIGNATURE),
+		.tag		= htole32(1),
+		.xfer_length	= htole32(count),
+		.cdb		= {
+			.command	= SDPS_BLTC_DOWNLOAD_FW,
+			.length		= htobe32(count),
+		},
+	};
+	int			rc;
 
-	if (sdp->devpath)
-		return sdp->devpath;
+	if (sdp->cpu_info->protocol != SDP_PROTO_SDPS) {
+		fprintf(stderr, "%s does not support SDPS\n",
+			sdp->cpu_info->name);
+		return false;
+	}
 
-	if (!sdp->dev)
-		return NULL;
+	rc = sdp_set_report(sdp, &cbw, sizeof cbw);
+	if (rc < 0) {
+		fprintf(stderr, "libusb_control_transfer(<cbw>): %s\n",
+			libusb_error_name(rc));
+		metrics_error(METRICS_SITE_REPORT1, rc);
+		return false;
+	}
 
-	num_ports = libusb_get_port_numbers(sdp->dev, ports, 8);
-	if (num_ports < 0)
-		return NULL;
+	/* there is no per command HAB status; the ROM starts booting
+	 * after the last chunk and might drop off the bus immediately */
+	return sdp_send_payload_report2(sdp, data, count);
+}
 
-	path = malloc(num_ports * (sizeof "XXX." - 1));
-	if (!path)
-		return NULL;
+bool sdp_poll_can_dcd(struct sdp_cpu_info const *cpu,
+		      struct sdp_poll const *p)
+{
+	/* DCD checks can only test for "all bits set" or "all bits clear" */
+	if (p->val != 0 && p->val != p->mask)
+		return false;
+
+	if (cpu->dcd_check_rate == 0)
+		return false;
+
+	return sdp_cpu_check_region(cpu, p->addr, 4, SDP_MEM_DCD);
+}
+
+static bool sdp_poll_dcd(struct sdp *sdp, struct sdp_poll const *p,
+			 unsigned int ms)
+{
+	struct sdp_dcd	dcd;
+	uint8_t		flags = SDP_DCD_WIDTH_32;
+	bool		rc;
+
+	if (p->val != 0)
+		flags |= SDP_DCD_FLAG_SET;
+
+	if (!sdp_dcd_init(&dcd))
+		return false;
+
+	rc = (sdp_dcd_check(&dcd, flags, p->addr, p->mask,
+			    MAX(1u, ms * sdp->cpu_info->dcd_check_rate)) &&
+	      sdp_write_dcd(sdp, dcd.buf, dcd.sz));
+
+	sdp_dcd_free(&dcd);
+	return rc;
+}
+
+/* AUTO: compares the latency until a change is seen.  A host read sees
+ * it after one round trip plus the current backoff delay.  The ROM sees
+ * it within one check iteration but the DCD_WRITE costs a round trip
+ * with an additional report2 (estimated as two READ_REGISTER round
+ * trips) and the result is verified by another host read. */
+static bool sdp_poll_prefer_dcd(struct sdp const *sdp, uint64_t t_read,
+				unsigned int delay_us)
+{
+	uint64_t	t_host = t_read + delay_us * 1000ull;
+	uint64_t	t_dcd = (3 * t_read +
+				 1000000u / sdp->cpu_info->dcd_check_rate);
+
+	return t_dcd < t_host;
+}
+
+bool sdp_poll(struct sdp *sdp, struct sdp_poll const *p,
+	      struct sdp_poll_result *res)
+{
+	uint64_t		t_start = monotonic_ns();
+	uint64_t		deadline = 0;
+	unsigned int		delay = p->backoff_us;
+	enum sdp_poll_mode	mode = p->mode;
+	bool			dcd_done = false;
+	/* time spent in host reads */
+	uint64_t		t_reads = 0;
+
+	if (p->timeout_ms)
+		deadline = t_start + p->timeout_ms * 1000000ull;
+
+	if (mode == SDP_POLL_DCD && !sdp_poll_can_dcd(sdp->cpu_info, p)) {
+		fprintf(stderr, "poll of %08x can not be done by DCD\n",
+			p->addr);
+		return false;
+	}
 
-	ptr = path;
-	for (int i = 0; i < num_ports; ++i)
-		ptr += sprintf(ptr, "%s%u", i == 0 ? "" : ".", ports[i]);
+	*res = (struct sdp_poll_result) {
+		.mode	= SDP_POLL_HOST,
+	};
+
+	for (;;) {
+		uint64_t	now;
+
+		/* AUTO stays with DCD checks once they are faster; the
+		 * backoff delay only grows */
+		if (mode == SDP_POLL_AUTO &&
+		    res->num_reads >= SDP_POLL_SPIN_READS &&
+		    sdp_poll_can_dcd(sdp->cpu_info, p) &&
+		    sdp_poll_prefer_dcd(sdp, t_reads / res->num_reads, delay))
+			mode = SDP_POLL_DCD;
+
+		/* the host read after each DCD check verifies the result
+		 * because a DCD check with exhausted count is not reported
+		 * reliably */
+		if (!dcd_done && mode == SDP_POLL_DCD) {
+			unsigned int	ms = SDP_POLL_DCD_MAX_MS;
+
+			now = monotonic_ns();
+			if (deadline)
+				ms = MIN(ms, (deadline - MIN(deadline, now)) / 1000000);
+
+			/* less than 1ms left; the final host read decides */
+			if (ms > 0 && !sdp_poll_dcd(sdp, p, ms))
+				return false;
+
+			if (ms > 0)
+				res->mode = SDP_POLL_DCD;
+
+			dcd_done = true;
+		}
+
+		now = monotonic_ns();
+		if (!sdp_read_regl(sdp, p->addr, &res->val, 1))
+			return false;
+
+		++res->num_reads;
+		t_reads += monotonic_ns() - now;
+		now = monotonic_ns();
+
+		if ((res->val & p->mask) == p->val) {
+			res->latency_ns = now - t_start;
+			return true;
+		}
 
-	sdp->devpath = path;
-	return sdp->devpath;
+		if (deadline && now >= deadline) {
+			fprintf(stderr,
+				"timeout while polling %08x (%08x & %08x != %08x)\n",
+				p->addr, res->val, p->mask, p->val);
+			res->latency_ns = now - t_start;
+			return false;
+		}
+
+		/* the previous DCD check ran into its count limit (which is
+		 * capped to SDP_POLL_DCD_MAX_MS); issue a new one for the
+		 * remaining time */
+		dcd_done = false;
+
+		if (delay > 0) {
+			usleep(delay);
+			delay = MIN(2 * delay, MAX(p->backoff_max_us, delay));
+		}
+	}
+}
+
+char const *sdp_get_devpath(struct sdp *sdp)
+{
+	return sdp->info.port_path;
+}
+
+struct sdp_device_info const *sdp_get_device_info(struct sdp const *sdp)
+{
+	return &sdp->info;
 }
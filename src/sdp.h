@@ -21,15 +21,86 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
+/* maximum size of a DCD accepted by DCD_WRITE */
+#define SDP_DCD_MAX_SIZE	1768u
+/* payload bytes per report2 */
+#define SDP_REPORT2_SIZE	1024u
+
 struct sdp;
+struct iovec;
 struct libusb_context;
 
+enum {
+	SDP_MEM_LOAD		= (1u << 0),	/* WRITE_FILE, JUMP_ADDRESS */
+	SDP_MEM_REG		= (1u << 1),	/* READ_/WRITE_REGISTER */
+	SDP_MEM_DCD		= (1u << 2),	/* target of DCD write commands */
+	SDP_MEM_DDR		= (1u << 3),	/* external DRAM */
+};
+
+struct sdp_mem_region {
+	uint32_t		start;
+	uint32_t		end;		/* inclusive */
+	unsigned int		flags;
+};
+
+enum sdp_protocol {
+	/* HID command set (WRITE_FILE, DCD_WRITE, JUMP_ADDRESS, ...) */
+	SDP_PROTO_SDP,
+	/* stream download; the ROM receives the whole image by a single
+	 * BLTC download command and boots it */
+	SDP_PROTO_SDPS,
+};
+
+struct sdp_cpu_info {
+	char const		*name;
+	char const		*id;
+	uint16_t		vid;
+	uint16_t		pid;
+	enum sdp_protocol	protocol;
+	/* 0 when the ROM does not support DCD_WRITE */
+	uint32_t		dcd_addr;
+	/* lower bound of DCD check iterations the ROM runs per ms */
+	unsigned int		dcd_check_rate;
+	/* terminated by an entry with empty 'flags' */
+	struct sdp_mem_region const	*regions;
+
+	/* OCRAM scratch area for stubs */
+	uint32_t		stub_addr;
+	uint32_t		stub_size;
+
+	/* WDOG1 used for resets; 0 when unknown */
+	uint32_t		wdog_addr;
+
+	/* '(*addr & mask) == val' when the DDR controller is configured */
+	struct {
+		uint32_t	addr;
+		uint32_t	mask;
+		uint32_t	val;
+	}			ddr_ready;
+};
+
+struct sdp_device_info {
+	uint16_t			vid;
+	uint16_t			pid;
+	uint8_t				bus;
+	uint8_t				addr;
+	char				port_path[32];
+	struct sdp_cpu_info const	*cpu;
+};
+
 struct sdp_context {
 	struct libusb_context	*usb;
-	bool			(*match)(struct sdp_context *, void *);
+	/* called for every detected SDP device; returning false skips it */
+	bool			(*match)(struct sdp_context *,
+					 struct sdp_device_info const *);
 	bool			(*wait_for_device)(struct sdp_context *);
 };
 
+/* creates a libusb context in 'info' which is shared by all sdp_open()
+ * calls with this 'info' */
+bool	sdp_context_init(struct sdp_context *info);
+void	sdp_context_destroy(struct sdp_context *info);
+
 struct sdp *sdp_open(struct sdp_context *info);
 void	sdp_close(struct sdp *sdp);
 
@@ -43,12 +114,75 @@ bool	sdp_read_writel(struct sdp *, uint32_t val, uint32_t addr);
 
 bool	sdp_write_file(struct sdp *, uint32_t addr,
 		       void const *data, size_t count);
+/* like sdp_write_file() but gathers the payload from 'iov' */
+bool	sdp_write_filev(struct sdp *, uint32_t addr,
+			struct iovec const *iov, size_t iov_cnt);
 
 //bool	sdp_write_dcd(struct sdp *, struct sdp_dcd const *dcd);
 bool	sdp_write_dcd(struct sdp *, void const *dcd, size_t len);
 
 bool	sdp_jump(struct sdp *, uint32_t addr);
 
+/* SDPS devices only; the ROM boots the image after the last chunk */
+bool	sdps_write_image(struct sdp *, void const *data, size_t count);
+
+bool	sdp_read_error_status(struct sdp *sdp, int *status);
+
+/* enables the watchdog; the board resets 'timeout_ms' later unless
+ * sdp_reset() was called before.  The watchdog can not be stopped. */
+bool	sdp_wdog_arm(struct sdp *, unsigned int timeout_ms);
+/* restarts the timeout of an armed watchdog */
+bool	sdp_wdog_service(struct sdp *);
+/* triggers a software reset by the watchdog; the device disconnects and
+ * must be closed */
+bool	sdp_reset(struct sdp *);
+
+enum sdp_poll_mode {
+	/* host reads until the measured round trip plus the backoff delay
+	 * exceed the estimated latency of a DCD check; requires a condition
+	 * which can be expressed by one */
+	SDP_POLL_AUTO,
+	/* READ_REGISTER round trips from the host */
+	SDP_POLL_HOST,
+	/* DCD check command; the ROM polls on-chip */
+	SDP_POLL_DCD,
+};
+
+/* waits until '(*addr & mask) == val' */
+struct sdp_poll {
+	uint32_t		addr;
+	uint32_t		mask;
+	uint32_t		val;
+	enum sdp_poll_mode	mode;
+	/* 0 means no deadline */
+	unsigned int		timeout_ms;
+	/* delay between host reads; doubled after every miss up to
+	 * 'backoff_max_us'.  0 means back-to-back requests */
+	unsigned int		backoff_us;
+	unsigned int		backoff_max_us;
+};
+
+struct sdp_poll_result {
+	uint32_t		val;
+	unsigned int		num_reads;
+	enum sdp_poll_mode	mode;
+	uint64_t		latency_ns;
+};
+
+bool	sdp_poll(struct sdp *, struct sdp_poll const *p,
+		 struct sdp_poll_result *res);
+bool	sdp_poll_can_dcd(struct sdp_cpu_info const *cpu,
+			 struct sdp_poll const *p);
+
 char const	*sdp_get_devpath(struct sdp *);
+struct sdp_device_info const	*sdp_get_device_info(struct sdp const *);
+
+struct sdp_cpu_info const	*sdp_get_cpu_info(struct sdp const *);
+struct sdp_cpu_info const	*sdp_find_cpu_info(char const *id);
+/* returns NULL for devices which are not a known SDP boot ROM */
+struct sdp_cpu_info const	*sdp_find_cpu_by_usb_id(uint16_t vid,
+							 uint16_t pid);
+bool	sdp_cpu_check_region(struct sdp_cpu_info const *cpu,
+			     uint32_t addr, size_t len, unsigned int flags);
 
 #endif	/* H_MX6_LOAD_SDP_H */
@@ -0,0 +1,711 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "server.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sysexits.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <libudev.h>
+
+#include "sdp.h"
+#include "util.h"
+#include "image.h"
+#include "upload.h"
+#include "metrics.h"
+#include "cache.h"
+#include "bundle.h"
+
+#define SERVER_MAX_IMAGES	16u
+/* upper bound for sleeping between two bus scans while a job waits for
+ * its device; udev events wake up waiting jobs earlier */
+#define SERVER_WAIT_SLICE_MS	250u
+
+struct cached_image {
+	struct cached_image	*next;
+
+	char			*path;
+	unsigned int		offset;
+	dev_t			dev;
+	ino_t			ino;
+	off_t			size;
+	struct timespec		mtime;
+
+	unsigned int		refcnt;
+	/* file was changed; entry is freed when last user is gone */
+	bool			stale;
+	/* placeholder while one job parses the image without holding
+	 * srv->lock; other jobs wait on srv->cond */
+	bool			loading;
+	uint64_t		last_use;
+
+	struct mx6_image	img;
+};
+
+enum server_dev_state {
+	SERVER_DEV_FREE,
+	/* claimed by a job */
+	SERVER_DEV_BUSY,
+	/* flashed successfully; ignored until it vanishes from the bus */
+	SERVER_DEV_DONE,
+};
+
+struct server_dev {
+	enum server_dev_state	state;
+	uint8_t			bus;
+	uint8_t			addr;
+};
+
+struct server {
+	struct server_opts const	*opts;
+	struct sdp_context		ctx;
+
+	pthread_mutex_t			lock;
+	/* signaled on udev events, when devices are released and when
+	 * an image finished loading */
+	pthread_cond_t			cond;
+	unsigned int			event_gen;
+
+	struct cached_image		*images;
+	unsigned int			num_images;
+
+	struct server_dev		devs[64];
+};
+
+struct server_job {
+	struct sdp_context		sdp;
+	struct server			*srv;
+	int				fd;
+
+	char				*image;
+	unsigned int			offset;
+	char				*port;
+	bool				delta;
+	unsigned int			retries;
+	unsigned int			timeout_ms;
+
+	uint64_t			deadline;
+	struct server_dev		*dev;
+};
+
+static void cached_image_free(struct cached_image *ci)
+{
+	image_close(&ci->img);
+	free(ci->path);
+	free(ci);
+}
+
+/* must be called with srv->lock held */
+static void cache_unlink(struct server *srv, struct cached_image *ci)
+{
+	for (struct cached_image **p = &srv->images; *p; p = &(*p)->next) {
+		if (*p == ci) {
+			*p = ci->next;
+			--srv->num_images;
+			break;
+		}
+	}
+}
+
+/* must be called with srv->lock held */
+static void cache_evict(struct server *srv)
+{
+	struct cached_image	*victim = NULL;
+
+	for (struct cached_image *ci = srv->images; ci; ci = ci->next) {
+		if (ci->refcnt == 0 &&
+		    (!victim || ci->last_use < victim->last_use))
+			victim = ci;
+	}
+
+	if (victim) {
+		cache_unlink(srv, victim);
+		cached_image_free(victim);
+	}
+}
+
+/* returns a referenced image; concurrent requests for the same file are
+ * served by a single load */
+static int cache_get(struct server *srv, char const *path,
+		     unsigned int offset, struct cached_image **res)
+{
+	struct cached_image	*ci;
+	struct stat		st;
+	uint64_t		t0;
+	int			rc = 0;
+
+	if (stat(path, &st) < 0)
+		return EX_NOINPUT;
+
+	pthread_mutex_lock(&srv->lock);
+
+again:
+	for (ci = srv->images; ci; ci = ci->next) {
+		if (ci->stale || ci->offset != offset ||
+		    strcmp(ci->path, path) != 0)
+			continue;
+
+		if (ci->dev == st.st_dev && ci->ino == st.st_ino &&
+		    ci->size == st.st_size &&
+		    ci->mtime.tv_sec == st.st_mtim.tv_sec &&
+		    ci->mtime.tv_nsec == st.st_mtim.tv_nsec)
+			break;
+
+		ci->stale = true;
+		if (ci->refcnt == 0) {
+			cache_unlink(srv, ci);
+			cached_image_free(ci);
+		}
+
+		ci = NULL;
+		break;
+	}
+
+	if (ci && ci->loading) {
+		/* the entry might be gone after the wakeup when loading
+		 * failed; look it up again */
+		pthread_cond_wait(&srv->cond, &srv->lock);
+		goto again;
+	}
+
+	if (ci)
+		goto found;
+
+	if (srv->num_images >= SERVER_MAX_IMAGES)
+		cache_evict(srv);
+
+	ci = calloc(1, sizeof *ci);
+	if (ci)
+		ci->path = strdup(path);
+
+	if (!ci || !ci->path) {
+		free(ci);
+		rc = EX_OSERR;
+		goto out;
+	}
+
+	ci->offset  = offset;
+	ci->dev     = st.st_dev;
+	ci->ino     = st.st_ino;
+	ci->size    = st.st_size;
+	ci->mtime   = st.st_mtim;
+	ci->refcnt  = 1;
+	ci->loading = true;
+	ci->next    = srv->images;
+
+	srv->images = ci;
+	++srv->num_images;
+
+	pthread_mutex_unlock(&srv->lock);
+
+	t0 = monotonic_ns();
+	if (srv->opts->cache)
+		rc = image_cache_open(srv->opts->cache, &ci->img, path, offset);
+	else
+		rc = image_open(&ci->img, path, offset);
+
+	if (rc == 0) {
+		image_strip_dcd(&ci->img);
+		image_pin(&ci->img);
+		metrics_phase(METRICS_PHASE_PREPARE, monotonic_ns() - t0);
+	}
+
+	pthread_mutex_lock(&srv->lock);
+	ci->loading = false;
+	pthread_cond_broadcast(&srv->cond);
+
+	if (rc) {
+		cache_unlink(srv, ci);
+		free(ci->path);
+		free(ci);
+		goto out;
+	}
+
+	/* the reference was taken with the placeholder */
+	--ci->refcnt;
+
+found:
+	++ci->refcnt;
+	ci->last_use = monotonic_ns();
+	*res = ci;
+
+out:
+	pthread_mutex_unlock(&srv->lock);
+	return rc;
+}
+
+static void cache_put(struct server *srv, struct cached_image *ci)
+{
+	pthread_mutex_lock(&srv->lock);
+	if (--ci->refcnt == 0 && ci->stale) {
+		cache_unlink(srv, ci);
+		cached_image_free(ci);
+	}
+	pthread_mutex_unlock(&srv->lock);
+}
+
+/* must be called with srv->lock held */
+static struct server_dev *server_find_dev(struct server *srv,
+					  uint8_t bus, uint8_t addr,
+					  bool create)
+{
+	struct server_dev	*res = NULL;
+
+	for (size_t i = 0; i < ARRAY_SIZE(srv->devs); ++i) {
+		struct server_dev	*d = &srv->devs[i];
+
+		if (d->state == SERVER_DEV_FREE) {
+			if (!res)
+				res = d;
+		} else if (d->bus == bus && d->addr == addr) {
+			return d;
+		}
+	}
+
+	if (!create || !res)
+		return NULL;
+
+	*res = (struct server_dev) {
+		.state	= SERVER_DEV_FREE,
+		.bus	= bus,
+		.addr	= addr,
+	};
+
+	return res;
+}
+
+static bool job_match(struct sdp_context *info,
+		      struct sdp_device_info const *dev)
+{
+	struct server_job	*job = container_of(info, struct server_job, sdp);
+	struct server		*srv = job->srv;
+	struct server_dev	*d;
+
+	if (job->port && strcmp(dev->port_path, job->port) != 0)
+		return false;
+
+	/* reserve the device here; sdp_open() takes the first accepted
+	 * one so that concurrent jobs never try to claim the same device */
+	pthread_mutex_lock(&srv->lock);
+	d = server_find_dev(srv, dev->bus, dev->addr, true);
+	if (d && d->state == SERVER_DEV_FREE)
+		d->state = SERVER_DEV_BUSY;
+	else
+		d = NULL;
+	pthread_mutex_unlock(&srv->lock);
+
+	job->dev = d;
+	return d != NULL;
+}
+
+static bool job_wait_for_device(struct sdp_context *info)
+{
+	struct server_job	*job = container_of(info, struct server_job, sdp);
+	struct server		*srv = job->srv;
+	uint64_t		now = monotonic_ns();
+	uint64_t		until;
+	struct timespec		ts;
+	unsigned int		gen;
+
+	if (now >= job->deadline)
+		return false;
+
+	until = MIN(job->deadline, now + SERVER_WAIT_SLICE_MS * 1000000ull);
+	ts = (struct timespec) {
+		.tv_sec		= until / 1000000000u,
+		.tv_nsec	= until % 1000000000u,
+	};
+
+	pthread_mutex_lock(&srv->lock);
+	gen = srv->event_gen;
+	while (gen == srv->event_gen &&
+	       pthread_cond_timedwait(&srv->cond, &srv->lock, &ts) == 0)
+		;
+	pthread_mutex_unlock(&srv->lock);
+
+	return true;
+}
+
+static void job_release_dev(struct server_job *job, bool done)
+{
+	struct server	*srv = job->srv;
+
+	if (!job->dev)
+		return;
+
+	pthread_mutex_lock(&srv->lock);
+	job->dev->state = done ? SERVER_DEV_DONE : SERVER_DEV_FREE;
+	++srv->event_gen;
+	pthread_cond_broadcast(&srv->cond);
+	pthread_mutex_unlock(&srv->lock);
+
+	job->dev = NULL;
+}
+
+static int job_parse(struct server_job *job, FILE *in, FILE *out)
+{
+	char		*line = NULL;
+	size_t		len = 0;
+	ssize_t		l;
+	int		rc = EX_PROTOCOL;
+
+	while ((l = getline(&line, &len, in)) > 0) {
+		char	*arg;
+
+		if (line[l - 1] == '\n')
+			line[l - 1] = '\0';
+
+		arg = strchr(line, ' ');
+		if (arg)
+			*arg++ = '\0';
+
+		if (strcmp(line, "run") == 0) {
+			rc = 0;
+			break;
+		} else if (strcmp(line, "image") == 0 && arg) {
+			free(job->image);
+			job->image = strdup(arg);
+		} else if (strcmp(line, "offset") == 0 && arg) {
+			job->offset = strtoul(arg, NULL, 0);
+		} else if (strcmp(line, "port") == 0 && arg) {
+			free(job->port);
+			job->port = strdup(arg);
+		} else if (strcmp(line, "delta") == 0 && !arg) {
+			job->delta = true;
+		} else if (strcmp(line, "retries") == 0 && arg) {
+			job->retries = strtoul(arg, NULL, 0);
+		} else if (strcmp(line, "timeout") == 0 && arg) {
+			job->timeout_ms = strtoul(arg, NULL, 0);
+		} else {
+			fprintf(out, "bad request '%s'\n", line);
+			break;
+		}
+	}
+
+	free(line);
+
+	if (rc == 0 && (!job->image || job->image[0] != '/')) {
+		fprintf(out, "missing or relative image path\n");
+		rc = EX_USAGE;
+	}
+
+	return rc;
+}
+
+static int job_execute(struct server_job *job, FILE *out)
+{
+	struct server			*srv = job->srv;
+	struct server_opts const	*opts = srv->opts;
+	struct cached_image		*ci;
+	struct upload_opts		uopts;
+	int				rc;
+
+	if (job->delta && !opts->delta_stub) {
+		fprintf(out, "server does not support delta uploads\n");
+		return EX_UNAVAILABLE;
+	}
+
+	/* like --daemon, the server keeps one parsed image per file and
+	 * can not select bundle variants */
+	if (bundle_probe(job->image)) {
+		fprintf(out, "bundles are not supported by the server\n");
+		return EX_USAGE;
+	}
+
+	rc = cache_get(srv, job->image, job->offset, &ci);
+	if (rc) {
+		fprintf(out, "failed to load image '%s'\n", job->image);
+		return rc;
+	}
+
+	uopts = (struct upload_opts) {
+		.file_name	= job->image,
+		.offset		= job->offset,
+		.delta_stub	= job->delta ? opts->delta_stub : NULL,
+		.block_size	= opts->block_size,
+		.profile	= opts->profile,
+	};
+
+	job->deadline = monotonic_ns() + job->timeout_ms * 1000000ull;
+
+	rc = EX_UNAVAILABLE;
+	for (unsigned int i = 0; i <= job->retries && rc != 0; ++i) {
+		struct sdp	*sdp;
+
+		if (i > 0)
+			metrics_retry(METRICS_RETRY_UPLOAD);
+
+		sdp = sdp_open(&job->sdp);
+		if (!sdp && !job->dev) {
+			fprintf(out, "no matching device found\n");
+			break;
+		} else if (!sdp) {
+			/* device was reserved but could not be opened */
+			job_release_dev(job, false);
+			continue;
+		}
+
+		rc = upload_image(sdp, &ci->img, &uopts, out);
+		sdp_close(sdp);
+
+		job_release_dev(job, rc == 0);
+	}
+
+	cache_put(srv, ci);
+
+	return rc;
+}
+
+static void *job_thread(void *job_)
+{
+	struct server_job	*job = job_;
+	FILE			*in = fdopen(job->fd, "r");
+	FILE			*out = NULL;
+	int			fd_out = dup(job->fd);
+	int			rc;
+
+	if (fd_out >= 0)
+		out = fdopen(fd_out, "w");
+
+	if (!in || !out) {
+		perror("fdopen()");
+		goto out;
+	}
+
+	rc = job_parse(job, in, out);
+	if (rc == 0)
+		rc = job_execute(job, out);
+
+	fprintf(out, SERVER_RESULT_TAG " %d\n", rc);
+
+out:
+	if (out)
+		fclose(out);
+	else if (fd_out >= 0)
+		close(fd_out);
+
+	if (in)
+		fclose(in);
+	else
+		close(job->fd);
+
+	free(job->image);
+	free(job->port);
+	free(job);
+
+	return NULL;
+}
+
+static void server_accept(struct server *srv, int lfd)
+{
+	struct server_job	*job;
+	pthread_t		thread;
+	int			fd;
+	int			rc;
+
+	fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	job = malloc(sizeof *job);
+	if (!job) {
+		close(fd);
+		return;
+	}
+
+	*job = (struct server_job) {
+		.sdp	= {
+			.usb		 = srv->ctx.usb,
+			.match		 = job_match,
+			.wait_for_device = job_wait_for_device,
+		},
+		.srv		= srv,
+		.fd		= fd,
+		.offset		= 0x400,
+		.timeout_ms	= SERVER_DEFAULT_TIMEOUT_MS,
+	};
+
+	rc = pthread_create(&thread, NULL, job_thread, job);
+	if (rc != 0) {
+		fprintf(stderr, "pthread_create(): %s\n", strerror(rc));
+		close(fd);
+		free(job);
+		return;
+	}
+
+	pthread_detach(thread);
+}
+
+static void server_handle_udev(struct server *srv, struct udev_monitor *mon)
+{
+	struct udev_device	*dev = udev_monitor_receive_device(mon);
+	char const		*bus;
+	char const		*addr;
+
+	if (!dev)
+		return;
+
+	/* BUSNUM and DEVNUM are part of the uevent and available for
+	 * 'remove' too */
+	bus  = udev_device_get_property_value(dev, "BUSNUM");
+	addr = udev_device_get_property_value(dev, "DEVNUM");
+
+	pthread_mutex_lock(&srv->lock);
+
+	if (bus && addr) {
+		struct server_dev	*d;
+
+		d = server_find_dev(srv, strtoul(bus, NULL, 10),
+				    strtoul(addr, NULL, 10), false);
+
+		/* a flashed device vanished or its address was reused */
+		if (d && d->state == SERVER_DEV_DONE)
+			d->state = SERVER_DEV_FREE;
+	}
+
+	++srv->event_gen;
+	pthread_cond_broadcast(&srv->cond);
+	pthread_mutex_unlock(&srv->lock);
+
+	udev_device_unref(dev);
+}
+
+static int server_listen(char const *path)
+{
+	struct sockaddr_un	addr = {
+		.sun_family	= AF_UNIX,
+	};
+	int			fd;
+
+	if (strlen(path) >= sizeof addr.sun_path) {
+		fprintf(stderr, "server socket path too long\n");
+		return -1;
+	}
+
+	strcpy(addr.sun_path, path);
+	unlink(path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("socket()");
+		return -1;
+	}
+
+	if (bind(fd, (void *)&addr, sizeof addr) < 0) {
+		fprintf(stderr, "bind(%s): %m\n", path);
+		close(fd);
+		return -1;
+	}
+
+	if (listen(fd, 32) < 0) {
+		perror("listen()");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int server_run(struct server_opts const *opts)
+{
+	struct server		srv = {
+		.opts	= opts,
+		.lock	= PTHREAD_MUTEX_INITIALIZER,
+	};
+	pthread_condattr_t	cattr;
+	struct udev		*udev;
+	struct udev_monitor	*mon = NULL;
+	int			lfd = -1;
+	int			rc;
+
+	/* clients might go away while a job is running */
+	signal(SIGPIPE, SIG_IGN);
+
+	pthread_condattr_init(&cattr);
+	pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&srv.cond, &cattr);
+	pthread_condattr_destroy(&cattr);
+
+	udev = udev_new();
+	if (!udev) {
+		fprintf(stderr, "udev_new() failed\n");
+		return EX_OSERR;
+	}
+
+	if (!sdp_context_init(&srv.ctx)) {
+		rc = EX_UNAVAILABLE;
+		goto out;
+	}
+
+	mon = udev_monitor_new_from_netlink(udev, "udev");
+	if (!mon ||
+	    udev_monitor_filter_add_match_subsystem_devtype(
+		    mon, "usb", "usb_device") < 0 ||
+	    udev_monitor_enable_receiving(mon) < 0) {
+		fprintf(stderr, "failed to setup udev monitor\n");
+		rc = EX_OSERR;
+		goto out;
+	}
+
+	lfd = server_listen(opts->socket_path);
+	if (lfd < 0) {
+		rc = EX_UNAVAILABLE;
+		goto out;
+	}
+
+	for (;;) {
+		struct pollfd	fds[] = {
+			{ .fd = lfd, .events = POLLIN },
+			{ .fd = udev_monitor_get_fd(mon), .events = POLLIN },
+		};
+
+		if (poll(fds, ARRAY_SIZE(fds), -1) < 0)
+			continue;
+
+		if (fds[0].revents & POLLIN)
+			server_accept(&srv, lfd);
+
+		if (fds[1].revents & POLLIN)
+			server_handle_udev(&srv, mon);
+	}
+
+out:
+	if (lfd >= 0)
+		close(lfd);
+
+	if (mon)
+		udev_monitor_unref(mon);
+
+	sdp_context_destroy(&srv.ctx);
+	udev_unref(udev);
+	pthread_cond_destroy(&srv.cond);
+
+	return rc;
+}
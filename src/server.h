@@ -0,0 +1,60 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_MX6_LOAD_SERVER_H
+#define H_ENSC_MX6_LOAD_SERVER_H
+
+#include <stdlib.h>
+
+struct stub;
+struct image_cache;
+
+/* Jobs are submitted over a unix stream socket with a line based
+ * protocol.  The client sends
+ *
+ *   image <absolute path>
+ *   [offset <n>]
+ *   [port <port path>]
+ *   [delta]
+ *   [retries <n>]
+ *   [timeout <ms>]
+ *   run
+ *
+ * and receives the progress output of the job followed by a final
+ * "@result <code>" line where <code> is a sysexits(3) value. */
+#define SERVER_RESULT_TAG	"@result"
+
+/* time a job waits for a matching device when no timeout was given */
+#define SERVER_DEFAULT_TIMEOUT_MS	30000u
+
+struct server_opts {
+	char const		*socket_path;
+
+	/* when NULL, jobs requesting delta uploads are rejected */
+	struct stub const	*delta_stub;
+	size_t			block_size;
+
+	/* when set, images are loaded through this cache */
+	struct image_cache	*cache;
+	/* see upload_opts */
+	char const		*profile;
+};
+
+/* does not return unless setting up the socket, udev or libusb failed;
+ * the result is a sysexits(3) code then */
+int	server_run(struct server_opts const *opts);
+
+#endif	/* H_ENSC_MX6_LOAD_SERVER_H */
@@ -0,0 +1,144 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "stub.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <endian.h>
+#include <sysexits.h>
+
+#include "util.h"
+#include "sdp.h"
+#include "image.h"
+
+int stub_load(struct stub *stub, char const *dir, char const *name)
+{
+	char	*path;
+	int	rc;
+
+	if (strchr(name, '/') || !dir)
+		path = strdup(name);
+	else if (asprintf(&path, "%s/%s", dir, name) < 0)
+		path = NULL;
+
+	if (!path)
+		return EX_OSERR;
+
+	*stub = (struct stub) {
+		.name	= name,
+	};
+
+	rc = read_file(path, &stub->code, &stub->code_len);
+	free(path);
+
+	return rc;
+}
+
+void stub_free(struct stub *stub)
+{
+	free(stub->code);
+	stub->code = NULL;
+}
+
+uint32_t stub_end_addr(struct sdp *sdp, struct stub const *stub)
+{
+	uint32_t	addr = sdp_get_cpu_info(sdp)->stub_addr;
+
+	return (addr + STUB_CODE_OFFSET + stub->code_len + 63) & ~63u;
+}
+
+bool stub_run(struct sdp *sdp, struct stub const *stub,
+	      void *params, size_t params_len)
+{
+	struct sdp_cpu_info const	*cpu = sdp_get_cpu_info(sdp);
+	uint32_t			addr = cpu->stub_addr;
+	size_t				len = STUB_CODE_OFFSET + stub->code_len;
+	uint32_t			*words = params;
+	size_t				num_words = params_len / 4;
+	uint8_t				*buf;
+	struct ivt			*ivt;
+	struct bdata			*bdata;
+	bool				rc = false;
+
+	if (params_len > STUB_PARAMS_SIZE || params_len % 4 != 0 ||
+	    params_len < sizeof(struct stub_params_hdr)) {
+		fprintf(stderr, "internal error; bad stub parameters\n");
+		abort();
+	}
+
+	if (len > cpu->stub_size) {
+		fprintf(stderr, "stub '%s' too large (%zu)\n", stub->name,
+			stub->code_len);
+		return false;
+	}
+
+	buf = calloc(1, len);
+	if (!buf)
+		return false;
+
+	ivt   = (void *)buf;
+	bdata = (void *)(buf + sizeof *ivt);
+
+	*ivt = (struct ivt) {
+		.header		= htole32(0x402000d1),
+		.entry		= htole32(addr + STUB_CODE_OFFSET),
+		.boot_data	= htole32(addr + sizeof *ivt),
+		.self		= htole32(addr),
+	};
+
+	*bdata = (struct bdata) {
+		.start		= htole32(addr),
+		.length		= htole32(len),
+		.flag		= htole32(1),	/* plugin */
+	};
+
+	words[0] = STUB_MAGIC_REQUEST;
+	for (size_t i = 0; i < num_words; ++i) {
+		uint32_t	v = htole32(words[i]);
+
+		memcpy(buf + STUB_PARAMS_OFFSET + 4 * i, &v, sizeof v);
+	}
+
+	memcpy(buf + STUB_CODE_OFFSET, stub->code, stub->code_len);
+
+	/* the register read blocks until the ROM returned from the stub */
+	if (!sdp_write_file(sdp, addr, buf, len) ||
+	    !sdp_jump(sdp, addr) ||
+	    !sdp_read_regl(sdp, addr + STUB_PARAMS_OFFSET, words, num_words))
+		goto out;
+
+	if (words[0] != STUB_MAGIC_DONE) {
+		fprintf(stderr, "stub '%s' did not finish (%08x)\n",
+			stub->name, words[0]);
+		goto out;
+	}
+
+	if (words[1] != 0) {
+		fprintf(stderr, "stub '%s' failed with %u\n", stub->name,
+			words[1]);
+		goto out;
+	}
+
+	rc = true;
+
+out:
+	free(buf);
+	return rc;
+}
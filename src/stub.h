@@ -0,0 +1,50 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_MX6_LOAD_STUB_H
+#define H_ENSC_MX6_LOAD_STUB_H
+
+/* host side of target stubs; see stub/stub-abi.h for the protocol */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "stub/stub-abi.h"
+
+struct sdp;
+
+struct stub {
+	char const	*name;
+	void		*code;
+	size_t		code_len;
+};
+
+/* 'name' is either a path or the name of a stub in 'dir'; returns 0 or a
+ * sysexits(3) code */
+int	stub_load(struct stub *stub, char const *dir, char const *name);
+void	stub_free(struct stub *stub);
+
+/* first free, 64 byte aligned address behind the stub image */
+uint32_t	stub_end_addr(struct sdp *sdp, struct stub const *stub);
+
+/* runs the stub with the given parameter block which must start with a
+ * 'struct stub_params_hdr'; it is updated with the values from the target
+ * afterwards */
+bool	stub_run(struct sdp *sdp, struct stub const *stub,
+		 void *params, size_t params_len);
+
+#endif	/* H_ENSC_MX6_LOAD_STUB_H */
@@ -0,0 +1,79 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "stub-abi.h"
+
+void stub_main(struct stub_ddr_bench_params *p);
+
+static void ccnt_start(void)
+{
+	uint32_t	pmcr;
+
+	/* plugins run in a privileged mode; enable the PMU with a reset
+	 * cycle counter which counts every cycle */
+	__asm__ volatile("mrc p15, 0, %0, c9, c12, 0" : "=r"(pmcr));
+	pmcr |= (1u << 0) | (1u << 2);
+	pmcr &= ~(1u << 3);
+	__asm__ volatile("mcr p15, 0, %0, c9, c12, 0" : : "r"(pmcr));
+	__asm__ volatile("mcr p15, 0, %0, c9, c12, 1" : : "r"(1u << 31));
+}
+
+static uint32_t ccnt_read(void)
+{
+	uint32_t	v;
+
+	__asm__ volatile("mrc p15, 0, %0, c9, c13, 0" : "=r"(v));
+	return v;
+}
+
+void stub_main(struct stub_ddr_bench_params *p)
+{
+	uint32_t volatile	*mem = (void *)(uintptr_t)p->base;
+	uint32_t		num = p->length / 4;
+	uint32_t		seed = p->seed;
+	uint32_t		t0;
+
+	if (p->length == 0 || (p->length % 4) != 0) {
+		p->hdr.status = 1;
+		goto out;
+	}
+
+	ccnt_start();
+
+	t0 = ccnt_read();
+	for (uint32_t i = 0; i < num; ++i)
+		mem[i] = stub_ddr_pattern(i, seed);
+	p->write_cycles = ccnt_read() - t0;
+
+	p->errors = 0;
+	p->first_error = 0;
+
+	t0 = ccnt_read();
+	for (uint32_t i = 0; i < num; ++i) {
+		if (mem[i] == stub_ddr_pattern(i, seed))
+			continue;
+
+		if (p->errors++ == 0)
+			p->first_error = p->base + 4 * i;
+	}
+	p->read_cycles = ccnt_read() - t0;
+
+	p->hdr.status = 0;
+
+out:
+	p->hdr.magic = STUB_MAGIC_DONE;
+}
@@ -0,0 +1,46 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stub-abi.h"
+
+void stub_main(struct stub_delta_params *p);
+
+void stub_main(struct stub_delta_params *p)
+{
+	uint8_t const	*data = (void const *)(uintptr_t)p->base;
+	uint32_t	*out = (void *)(uintptr_t)p->digests;
+	uint32_t	pos = 0;
+
+	if (p->block_size == 0 || (p->block_size % 4) != 0) {
+		p->hdr.status = 1;
+		goto out;
+	}
+
+	while (pos < p->length) {
+		uint32_t	l = p->length - pos;
+
+		if (l > p->block_size)
+			l = p->block_size;
+
+		*out++ = stub_fnv1a(data + pos, l);
+		pos += l;
+	}
+
+	p->hdr.status = 0;
+
+out:
+	p->hdr.magic = STUB_MAGIC_DONE;
+}
@@ -0,0 +1,104 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_MX6_LOAD_STUB_ABI_H
+#define H_ENSC_MX6_LOAD_STUB_ABI_H
+
+/* Interface between the host and the small programs ("stubs") which are
+ * executed on the target as plugins of the boot ROM.  This file is used
+ * by both sides and must stay freestanding.
+ *
+ * Target memory layout of a stub image:
+ *
+ *   0x000  IVT
+ *   0x020  boot data with plugin flag
+ *   0x040  parameter block; starts with 'struct stub_params_hdr'
+ *   0x100  code; entry point
+ *
+ * The host fills the parameter block and jumps to the IVT.  The ROM
+ * calls the entry point and returns into serial download mode when the
+ * stub is done.  The stub sets 'magic' to STUB_MAGIC_DONE; the host
+ * reads back the parameter block afterwards.  Stubs must finish well
+ * within the 2s USB transfer timeout. */
+
+#include <stdint.h>
+
+#define STUB_PARAMS_OFFSET	0x40u
+#define STUB_PARAMS_SIZE	0xc0u
+#define STUB_CODE_OFFSET	0x100u
+
+#define STUB_MAGIC_REQUEST	0x53545542u	/* 'STUB' */
+#define STUB_MAGIC_DONE		0x444f4e45u	/* 'DONE' */
+
+struct stub_params_hdr {
+	uint32_t	magic;
+	uint32_t	status;
+};
+
+/* delta-hash: writes stub_fnv1a() of every 'block_size' bytes of
+ * [base, base + length) as an uint32_t array to 'digests' */
+struct stub_delta_params {
+	struct stub_params_hdr	hdr;
+	uint32_t		base;
+	uint32_t		length;
+	uint32_t		block_size;
+	uint32_t		digests;
+};
+
+/* ddr-bench: writes an address dependent pattern derived from 'seed' to
+ * [base, base + length), reads it back and counts the mismatching words.
+ * Durations are measured in CPU cycles. */
+struct stub_ddr_bench_params {
+	struct stub_params_hdr	hdr;
+	uint32_t		base;
+	uint32_t		length;
+	uint32_t		seed;
+	/* results */
+	uint32_t		write_cycles;
+	uint32_t		read_cycles;
+	uint32_t		errors;
+	uint32_t		first_error;
+};
+
+inline static uint32_t stub_ddr_pattern(uint32_t idx, uint32_t seed)
+{
+	return (idx * 0x9e3779b1u) ^ seed;
+}
+
+inline static uint32_t stub_fnv1a(void const *data, uint32_t len)
+{
+	uint32_t const	*w = data;
+	uint8_t const	*b;
+	uint32_t	h = 0x811c9dc5u;
+
+	/* hashes little endian words and the unaligned tail bytewise */
+	for (; len >= 4; len -= 4) {
+		uint32_t	v;
+
+		__builtin_memcpy(&v, w++, sizeof v);
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+		v = __builtin_bswap32(v);
+#endif
+		h = (h ^ v) * 0x01000193u;
+	}
+
+	for (b = (void const *)w; len > 0; --len)
+		h = (h ^ *b++) * 0x01000193u;
+
+	return h;
+}
+
+#endif	/* H_ENSC_MX6_LOAD_STUB_ABI_H */
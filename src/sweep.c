@@ -0,0 +1,737 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "sweep.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sysexits.h>
+#include <sys/param.h>
+
+#include "util.h"
+#include "sdp.h"
+#include "dcd.h"
+#include "stub.h"
+
+/* interval of device scans while waiting for the board after a reset */
+#define SWEEP_POLL_US		20000u
+/* number of candidates shown in the final ranking */
+#define SWEEP_RANK_SHOW		20u
+
+enum sweep_state {
+	SWEEP_STATE_OK,
+	SWEEP_STATE_ERRORS,
+	SWEEP_STATE_FAIL_BENCH,
+	SWEEP_STATE_FAIL_DCD,
+};
+
+struct sweep_result {
+	size_t			idx;
+	enum sweep_state	state;
+	uint64_t		write_cycles;
+	uint64_t		read_cycles;
+	uint64_t		errors;
+	uint32_t		first_error;
+};
+
+struct sweep_ctx {
+	struct sdp_context	sdp;
+	char			port[32];
+	uint64_t		deadline;
+
+	/* the device which was reset last; ignored until it vanished */
+	bool			have_last;
+	uint8_t			last_bus;
+	uint8_t			last_addr;
+};
+
+static void parse_error(struct sweep_template const *t, unsigned int line,
+			char const *fmt, ...)
+	__attribute__((__format__(printf, 3, 4)));
+
+static void parse_error(struct sweep_template const *t, unsigned int line,
+			char const *fmt, ...)
+{
+	va_list		ap;
+
+	fprintf(stderr, "%s:%u: ", t->file_name, line);
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+
+	fputc('\n', stderr);
+}
+
+static bool parse_u32(char const *str, uint32_t *val)
+{
+	unsigned long long	v;
+	char			*end;
+
+	errno = 0;
+	v = strtoull(str, &end, 0);
+	if (errno != 0 || end == str || *end || v > UINT32_MAX)
+		return false;
+
+	*val = v;
+	return true;
+}
+
+static int sweep_find_param(struct sweep_template const *t, char const *name,
+			    size_t len)
+{
+	for (unsigned int i = 0; i < t->num_params; ++i) {
+		if (strlen(t->params[i].name) == len &&
+		    strncmp(t->params[i].name, name, len) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+/* parses '<name>@<lsb>[:<width>]' */
+static bool sweep_parse_field(struct sweep_template const *t,
+			      char const *spec, struct sweep_field *f)
+{
+	char const	*at = strchr(spec, '@');
+	char		*end;
+	int		param;
+
+	if (!at)
+		return false;
+
+	param = sweep_find_param(t, spec, at - spec);
+	if (param < 0)
+		return false;
+
+	f->param = param;
+	f->lsb   = strtoul(at + 1, &end, 0);
+	f->width = 32 - f->lsb;
+
+	if (*end == ':')
+		f->width = strtoul(end + 1, &end, 0);
+
+	return (*end == '\0' && f->lsb < 32 && f->width > 0 &&
+		f->lsb + f->width <= 32);
+}
+
+static int sweep_add_cmd(struct sweep_template *t, struct sweep_cmd const *cmd)
+{
+	void	*tmp;
+
+	tmp = realloc(t->cmds, (t->num_cmds + 1) * sizeof t->cmds[0]);
+	if (!tmp)
+		return EX_OSERR;
+
+	t->cmds = tmp;
+	t->cmds[t->num_cmds++] = *cmd;
+
+	return 0;
+}
+
+static int sweep_parse_line(struct sweep_template *t, unsigned int line,
+			    char *str)
+{
+	char			*args[2 + SWEEP_MAX_FIELDS];
+	unsigned int		num_args = 0;
+	char			*tok;
+	char			*saveptr;
+	char			*cmd;
+	struct sweep_cmd	c = { };
+
+	tok = strchr(str, '#');
+	if (tok)
+		*tok = '\0';
+
+	cmd = strtok_r(str, " \t\r\n", &saveptr);
+	if (!cmd)
+		return 0;
+
+	while ((tok = strtok_r(NULL, " \t\r\n", &saveptr)) != NULL) {
+		if (num_args == ARRAY_SIZE(args)) {
+			parse_error(t, line, "too many arguments");
+			return EX_DATAERR;
+		}
+
+		args[num_args++] = tok;
+	}
+
+	if (strcmp(cmd, "param") == 0) {
+		struct sweep_param	*p = &t->params[t->num_params];
+
+		if (num_args < 3 || num_args > 4) {
+			parse_error(t, line, "bad number of arguments for 'param'");
+			return EX_DATAERR;
+		}
+
+		if (t->num_params == SWEEP_MAX_PARAMS) {
+			parse_error(t, line, "too many parameters");
+			return EX_DATAERR;
+		}
+
+		if (sweep_find_param(t, args[0], strlen(args[0])) >= 0) {
+			parse_error(t, line, "duplicate parameter '%s'", args[0]);
+			return EX_DATAERR;
+		}
+
+		p->step = 1;
+		if (!parse_u32(args[1], &p->first) ||
+		    !parse_u32(args[2], &p->last) ||
+		    (num_args > 3 && !parse_u32(args[3], &p->step)) ||
+		    p->step == 0 || p->last < p->first) {
+			parse_error(t, line, "bad range for '%s'", args[0]);
+			return EX_DATAERR;
+		}
+
+		p->name = strdup(args[0]);
+		if (!p->name)
+			return EX_OSERR;
+
+		++t->num_params;
+		return 0;
+	}
+
+	if (strcmp(cmd, "write") == 0) {
+		if (num_args < 2 ||
+		    !parse_u32(args[0], &c.addr) ||
+		    !parse_u32(args[1], &c.val)) {
+			parse_error(t, line, "bad 'write' command");
+			return EX_DATAERR;
+		}
+
+		for (unsigned int i = 2; i < num_args; ++i) {
+			if (!sweep_parse_field(t, args[i], &c.fields[i - 2])) {
+				parse_error(t, line, "bad field '%s'", args[i]);
+				return EX_DATAERR;
+			}
+		}
+
+		c.num_fields = num_args - 2;
+		return sweep_add_cmd(t, &c);
+	}
+
+	if (strcmp(cmd, "check") == 0) {
+		c.check = true;
+		c.flags = SDP_DCD_WIDTH_32;
+
+		if (num_args < 2 || num_args > 4 ||
+		    !parse_u32(args[0], &c.addr) ||
+		    !parse_u32(args[1], &c.val)) {
+			parse_error(t, line, "bad 'check' command");
+			return EX_DATAERR;
+		}
+
+		for (unsigned int i = 2; i < num_args; ++i) {
+			if (strcmp(args[i], "set") == 0) {
+				c.flags |= SDP_DCD_FLAG_SET;
+			} else if (strcmp(args[i], "clear") == 0) {
+				; /* noop */
+			} else if (!parse_u32(args[i], &c.count)) {
+				parse_error(t, line, "bad argument '%s'", args[i]);
+				return EX_DATAERR;
+			}
+		}
+
+		return sweep_add_cmd(t, &c);
+	}
+
+	if (strcmp(cmd, "bench") == 0) {
+		uint32_t	passes = 1;
+
+		if (num_args < 2 || num_args > 3 ||
+		    !parse_u32(args[0], &t->bench_addr) ||
+		    !parse_u32(args[1], &t->bench_len) ||
+		    (num_args > 2 && !parse_u32(args[2], &passes)) ||
+		    t->bench_len == 0 || t->bench_len % 4 != 0 ||
+		    passes == 0) {
+			parse_error(t, line, "bad 'bench' command");
+			return EX_DATAERR;
+		}
+
+		t->passes = passes;
+		return 0;
+	}
+
+	if (strcmp(cmd, "clock") == 0 || strcmp(cmd, "watchdog") == 0) {
+		uint32_t	v;
+
+		if (num_args != 1 || !parse_u32(args[0], &v) || v == 0) {
+			parse_error(t, line, "bad '%s' command", cmd);
+			return EX_DATAERR;
+		}
+
+		if (cmd[0] == 'c')
+			t->clock_hz = v;
+		else
+			t->watchdog_ms = v;
+
+		return 0;
+	}
+
+	parse_error(t, line, "unknown command '%s'", cmd);
+	return EX_DATAERR;
+}
+
+int sweep_load(struct sweep_template *t, char const *file_name)
+{
+	FILE		*f;
+	char		*line = NULL;
+	size_t		line_sz = 0;
+	unsigned int	lineno = 0;
+	int		rc = 0;
+
+	*t = (struct sweep_template) {
+		.file_name	= file_name,
+		.watchdog_ms	= SWEEP_DEFAULT_WATCHDOG_MS,
+	};
+
+	f = fopen(file_name, "r");
+	if (!f) {
+		fprintf(stderr, "failed to open '%s': %m\n", file_name);
+		return EX_NOINPUT;
+	}
+
+	while (rc == 0 && getline(&line, &line_sz, f) >= 0)
+		rc = sweep_parse_line(t, ++lineno, line);
+
+	if (rc == 0 && ferror(f)) {
+		fprintf(stderr, "failed to read '%s'\n", file_name);
+		rc = EX_IOERR;
+	}
+
+	free(line);
+	fclose(f);
+
+	if (rc == 0 && t->passes == 0) {
+		fprintf(stderr, "%s: missing 'bench' command\n", file_name);
+		rc = EX_DATAERR;
+	}
+
+	if (rc == 0 && sweep_num_candidates(t) > SWEEP_MAX_CANDIDATES) {
+		fprintf(stderr, "%s: too many candidates\n", file_name);
+		rc = EX_DATAERR;
+	}
+
+	if (rc)
+		sweep_free(t);
+
+	return rc;
+}
+
+void sweep_free(struct sweep_template *t)
+{
+	for (unsigned int i = 0; i < t->num_params; ++i)
+		free(t->params[i].name);
+
+	free(t->cmds);
+	t->cmds = NULL;
+	t->num_params = 0;
+}
+
+static size_t sweep_param_count(struct sweep_param const *p)
+{
+	return (p->last - p->first) / p->step + 1;
+}
+
+size_t sweep_num_candidates(struct sweep_template const *t)
+{
+	size_t	res = 1;
+
+	for (unsigned int i = 0; i < t->num_params; ++i) {
+		res *= sweep_param_count(&t->params[i]);
+
+		/* avoid overflows; sweep_load() rejects this */
+		if (res > SWEEP_MAX_CANDIDATES)
+			return SIZE_MAX;
+	}
+
+	return res;
+}
+
+/* the first parameter varies fastest */
+static void sweep_values(struct sweep_template const *t, size_t idx,
+			 uint32_t values[])
+{
+	for (unsigned int i = 0; i < t->num_params; ++i) {
+		struct sweep_param const	*p = &t->params[i];
+		size_t				cnt = sweep_param_count(p);
+
+		values[i] = p->first + (idx % cnt) * p->step;
+		idx /= cnt;
+	}
+}
+
+bool sweep_build_dcd(struct sweep_template const *t, size_t idx,
+		     struct sdp_dcd *dcd)
+{
+	uint32_t			values[SWEEP_MAX_PARAMS];
+	struct sdp_dcd_write_data	*writes;
+	size_t				num_writes = 0;
+	bool				rc = true;
+
+	writes = calloc(t->num_cmds ? t->num_cmds : 1, sizeof writes[0]);
+	if (!writes)
+		return false;
+
+	sweep_values(t, idx, values);
+
+	for (size_t i = 0; i < t->num_cmds && rc; ++i) {
+		struct sweep_cmd const	*c = &t->cmds[i];
+		uint32_t		v = c->val;
+
+		if (c->check) {
+			/* flush pending writes into a single command */
+			if (num_writes > 0)
+				rc = sdp_dcd_data(dcd, SDP_DCD_WIDTH_32,
+						  writes, num_writes);
+
+			num_writes = 0;
+			rc = rc && sdp_dcd_check(dcd, c->flags, c->addr, c->val,
+						 c->count);
+			continue;
+		}
+
+		for (unsigned int k = 0; k < c->num_fields; ++k) {
+			struct sweep_field const	*f = &c->fields[k];
+			uint32_t			m = (f->width == 32 ? ~0u :
+							     (1u << f->width) - 1);
+
+			v &= ~(m << f->lsb);
+			v |= (values[f->param] & m) << f->lsb;
+		}
+
+		writes[num_writes++] = (struct sdp_dcd_write_data) {
+			.addr		= c->addr,
+			.val_mask	= v,
+		};
+	}
+
+	if (rc && num_writes > 0)
+		rc = sdp_dcd_data(dcd, SDP_DCD_WIDTH_32, writes, num_writes);
+
+	free(writes);
+	return rc;
+}
+
+static bool sweep_match(struct sdp_context *info,
+			struct sdp_device_info const *dev)
+{
+	struct sweep_ctx	*ctx = container_of(info, struct sweep_ctx, sdp);
+
+	if (ctx->port[0] && strcmp(ctx->port, dev->port_path) != 0)
+		return false;
+
+	/* the reset device might still be listed for a short time */
+	if (ctx->have_last && dev->bus == ctx->last_bus &&
+	    dev->addr == ctx->last_addr)
+		return false;
+
+	return true;
+}
+
+static bool sweep_wait_for_device(struct sdp_context *info)
+{
+	struct sweep_ctx	*ctx = container_of(info, struct sweep_ctx, sdp);
+
+	if (monotonic_ns() >= ctx->deadline)
+		return false;
+
+	usleep(SWEEP_POLL_US);
+	return true;
+}
+
+static struct sdp *sweep_open(struct sweep_ctx *ctx, unsigned int timeout_ms)
+{
+	struct sdp_device_info const	*dev;
+	struct sdp			*sdp;
+
+	ctx->deadline = monotonic_ns() + timeout_ms * 1000000ull;
+
+	sdp = sdp_open(&ctx->sdp);
+	if (!sdp)
+		return NULL;
+
+	/* stay on the same board for the whole sweep */
+	dev = sdp_get_device_info(sdp);
+	if (!ctx->port[0])
+		strncpy(ctx->port, dev->port_path, sizeof ctx->port - 1);
+
+	return sdp;
+}
+
+static int sweep_check_cpu(struct sweep_template const *t,
+			   struct sdp_cpu_info const *cpu)
+{
+	if (cpu->dcd_addr == 0 || cpu->wdog_addr == 0 || cpu->stub_size == 0) {
+		fprintf(stderr, "%s does not support DDR sweeps\n", cpu->name);
+		return EX_UNAVAILABLE;
+	}
+
+	if (!sdp_cpu_check_region(cpu, t->bench_addr, t->bench_len,
+				  SDP_MEM_LOAD | SDP_MEM_DDR)) {
+		fprintf(stderr, "bench area %08x+%u is not in DDR\n",
+			t->bench_addr, t->bench_len);
+		return EX_DATAERR;
+	}
+
+	/* the bench would overwrite itself */
+	if (t->bench_addr < (uint64_t)cpu->stub_addr + cpu->stub_size &&
+	    (uint64_t)t->bench_addr + t->bench_len > cpu->stub_addr) {
+		fprintf(stderr, "bench area %08x+%u overlaps the stub area\n",
+			t->bench_addr, t->bench_len);
+		return EX_DATAERR;
+	}
+
+	return 0;
+}
+
+/* returns 0 when the candidate was run (successfully or not) and an
+ * error code when the sweep must be aborted */
+static int sweep_candidate(struct sweep_template const *t,
+			   struct sweep_opts const *opts,
+			   struct sweep_ctx *ctx, struct sdp_dcd const *dcd,
+			   struct sweep_result *res)
+{
+	struct sdp_device_info const	*dev;
+	struct sdp			*sdp;
+	int				rc;
+
+	sdp = sweep_open(ctx, opts->timeout_ms);
+	if (!sdp)
+		return EX_UNAVAILABLE;
+
+	rc = sweep_check_cpu(t, sdp_get_cpu_info(sdp));
+	if (rc)
+		goto out;
+
+	if (!sdp_wdog_arm(sdp, t->watchdog_ms)) {
+		rc = EX_PROTOCOL;
+		goto out;
+	}
+
+	/* from now on the board resets in any case */
+	dev = sdp_get_device_info(sdp);
+	ctx->have_last = true;
+	ctx->last_bus  = dev->bus;
+	ctx->last_addr = dev->addr;
+
+	if (!sdp_write_dcd(sdp, dcd->buf, dcd->sz)) {
+		res->state = SWEEP_STATE_FAIL_DCD;
+		goto out;
+	}
+
+	for (unsigned int pass = 0; pass < t->passes; ++pass) {
+		struct stub_ddr_bench_params	p = {
+			.base	= t->bench_addr,
+			.length	= t->bench_len,
+			/* invert the pattern in every second pass so that
+			 * every bit is tested with both levels */
+			.seed	= (res->idx * t->passes + pass) ^
+				  (pass % 2 ? 0xffffffffu : 0),
+		};
+
+		/* 'watchdog_ms' covers a single pass; a slow candidate
+		 * must not reset the board while it is still fine */
+		if (!sdp_wdog_service(sdp) ||
+		    !stub_run(sdp, opts->stub, &p, sizeof p)) {
+			res->state = SWEEP_STATE_FAIL_BENCH;
+			goto out;
+		}
+
+		res->write_cycles += p.write_cycles;
+		res->read_cycles  += p.read_cycles;
+
+		if (p.errors > 0 && res->errors == 0)
+			res->first_error = p.first_error;
+
+		res->errors += p.errors;
+	}
+
+	res->state = res->errors ? SWEEP_STATE_ERRORS : SWEEP_STATE_OK;
+	sdp_reset(sdp);
+
+out:
+	sdp_close(sdp);
+	return rc;
+}
+
+static double sweep_bandwidth(struct sweep_template const *t, uint64_t cycles)
+{
+	double	bytes = (double)t->bench_len * t->passes;
+
+	if (cycles == 0)
+		return 0;
+
+	if (t->clock_hz)
+		/* MB/s */
+		return bytes * t->clock_hz / cycles / 1e6;
+	else
+		/* bytes per kcycle */
+		return bytes * 1000 / cycles;
+}
+
+static int sweep_cmp(void const *a_, void const *b_, void *t_)
+{
+	struct sweep_template const	*t = t_;
+	struct sweep_result const	*a = a_;
+	struct sweep_result const	*b = b_;
+	double				bw_a;
+	double				bw_b;
+
+	if (a->state != b->state)
+		return a->state < b->state ? -1 : 1;
+
+	if (a->state == SWEEP_STATE_ERRORS && a->errors != b->errors)
+		return a->errors < b->errors ? -1 : 1;
+
+	/* combined bandwidth of the read and write phase */
+	bw_a = sweep_bandwidth(t, a->write_cycles + a->read_cycles);
+	bw_b = sweep_bandwidth(t, b->write_cycles + b->read_cycles);
+
+	if (bw_a != bw_b)
+		return bw_a > bw_b ? -1 : 1;
+
+	return a->idx < b->idx ? -1 : a->idx > b->idx;
+}
+
+static void sweep_print_values(struct sweep_template const *t, size_t idx)
+{
+	uint32_t	values[SWEEP_MAX_PARAMS];
+
+	sweep_values(t, idx, values);
+
+	for (unsigned int i = 0; i < t->num_params; ++i)
+		printf("%s%s=%u", i ? " " : "", t->params[i].name, values[i]);
+}
+
+static void sweep_print_result(struct sweep_template const *t,
+			       struct sweep_result const *res)
+{
+	char const	*unit = t->clock_hz ? "MB/s" : "B/kcyc";
+
+	switch (res->state) {
+	case SWEEP_STATE_OK:
+	case SWEEP_STATE_ERRORS:
+		printf("W %.1f R %.1f %s, %llu errors",
+		       sweep_bandwidth(t, res->write_cycles),
+		       sweep_bandwidth(t, res->read_cycles), unit,
+		       (unsigned long long)res->errors);
+
+		if (res->errors)
+			printf(" (first at %08x)", res->first_error);
+		break;
+
+	case SWEEP_STATE_FAIL_BENCH:
+		printf("bench failed");
+		break;
+
+	case SWEEP_STATE_FAIL_DCD:
+		printf("DCD failed");
+		break;
+	}
+}
+
+int sweep_run(struct sweep_template const *t, struct sweep_opts const *opts)
+{
+	struct sweep_ctx	ctx = {
+		.sdp	= {
+			.match		 = sweep_match,
+			.wait_for_device = sweep_wait_for_device,
+		},
+	};
+	size_t			num = sweep_num_candidates(t);
+	struct sweep_result	*results;
+	size_t			cnt[4] = { };
+	size_t			done = 0;
+	uint64_t		t0 = monotonic_ns();
+	int			rc = 0;
+
+	if (opts->port)
+		strncpy(ctx.port, opts->port, sizeof ctx.port - 1);
+
+	results = calloc(num, sizeof results[0]);
+	if (!results)
+		return EX_OSERR;
+
+	if (!sdp_context_init(&ctx.sdp)) {
+		free(results);
+		return EX_UNAVAILABLE;
+	}
+
+	for (size_t i = 0; i < num && rc == 0; ++i) {
+		struct sweep_result	*res = &results[i];
+		struct sdp_dcd		dcd;
+
+		res->idx = i;
+
+		if (!sdp_dcd_init(&dcd)) {
+			rc = EX_OSERR;
+			break;
+		}
+
+		if (!sweep_build_dcd(t, i, &dcd) || dcd.sz > SDP_DCD_MAX_SIZE) {
+			fprintf(stderr, "failed to build DCD for candidate %zu\n", i);
+			rc = EX_DATAERR;
+		} else {
+			rc = sweep_candidate(t, opts, &ctx, &dcd, res);
+		}
+
+		sdp_dcd_free(&dcd);
+
+		if (rc)
+			break;
+
+		printf("[%*zu/%zu] ", (int)snprintf(NULL, 0, "%zu", num),
+		       i + 1, num);
+		sweep_print_values(t, i);
+		printf(": ");
+		sweep_print_result(t, res);
+		printf("\n");
+		fflush(stdout);
+
+		++cnt[res->state];
+		++done;
+	}
+
+	sdp_context_destroy(&ctx.sdp);
+
+	/* rank the finished candidates even when the sweep was aborted */
+	qsort_r(results, done, sizeof results[0], sweep_cmp, (void *)t);
+
+	printf("\n%zu of %zu candidates in %.1f s: %zu stable, %zu with errors, %zu failed\n",
+	       done, num, (monotonic_ns() - t0) / 1e9,
+	       cnt[SWEEP_STATE_OK], cnt[SWEEP_STATE_ERRORS],
+	       cnt[SWEEP_STATE_FAIL_BENCH] + cnt[SWEEP_STATE_FAIL_DCD]);
+
+	for (size_t i = 0; i < MIN(done, SWEEP_RANK_SHOW); ++i) {
+		printf("%3zu. ", i + 1);
+		sweep_print_values(t, results[i].idx);
+		printf(": ");
+		sweep_print_result(t, &results[i]);
+		printf("\n");
+	}
+
+	free(results);
+	return rc;
+}
@@ -0,0 +1,122 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef H_ENSC_MX6_LOAD_SWEEP_H
+#define H_ENSC_MX6_LOAD_SWEEP_H
+
+/* DDR timing sweeps.  A template describes a DCD whose register values
+ * depend on parameters.  Every combination of parameter values is
+ * applied to a freshly reset board and measured by the ddr-bench stub;
+ * the results are ranked by stability and bandwidth.
+ *
+ *   param    <name> <first> <last> [<step>]
+ *                                  parameter range (inclusive)
+ *   write    <addr> <val> [<name>@<lsb>[:<width>]]...
+ *                                  32 bit register write; parameters
+ *                                  replace bit fields of <val>
+ *   check    <addr> <mask> [set|clear] [<count>]
+ *                                  DCD check; by default until all bits
+ *                                  in <mask> are clear
+ *   bench    <addr> <length> [<passes>]
+ *                                  memory tested by the stub (required)
+ *   clock    <hz>                  CPU clock; bandwidths are reported in
+ *                                  bytes per kcycle without it
+ *   watchdog <ms>                  reset timeout for hanging candidates;
+ *                                  must cover the DCD and one bench pass
+ *
+ * The board is reset by the watchdog after every candidate.  The
+ * watchdog is armed before the DCD is sent and serviced before every
+ * bench pass so that settings which hang the DDR controller or the stub
+ * reset the board too.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+struct stub;
+struct sdp_dcd;
+
+#define SWEEP_STUB_NAME			"ddr-bench.bin"
+#define SWEEP_MAX_PARAMS		8u
+#define SWEEP_MAX_FIELDS		4u
+#define SWEEP_MAX_CANDIDATES		100000u
+#define SWEEP_DEFAULT_TIMEOUT_MS	10000u
+#define SWEEP_DEFAULT_WATCHDOG_MS	4000u
+
+struct sweep_param {
+	char			*name;
+	uint32_t		first;
+	uint32_t		last;
+	uint32_t		step;
+};
+
+struct sweep_field {
+	unsigned int		param;
+	unsigned int		lsb;
+	unsigned int		width;
+};
+
+struct sweep_cmd {
+	bool			check;
+	uint32_t		addr;
+	/* value for writes, mask for checks */
+	uint32_t		val;
+	uint8_t			flags;
+	uint32_t		count;
+
+	unsigned int		num_fields;
+	struct sweep_field	fields[SWEEP_MAX_FIELDS];
+};
+
+struct sweep_template {
+	char const		*file_name;
+
+	struct sweep_param	params[SWEEP_MAX_PARAMS];
+	unsigned int		num_params;
+
+	struct sweep_cmd	*cmds;
+	size_t			num_cmds;
+
+	uint32_t		bench_addr;
+	uint32_t		bench_len;
+	unsigned int		passes;
+	uint64_t		clock_hz;
+	unsigned int		watchdog_ms;
+};
+
+struct sweep_opts {
+	/* USB port path of the board; NULL selects the first device */
+	char const		*port;
+	struct stub const	*stub;
+	/* time to wait for the board after a reset */
+	unsigned int		timeout_ms;
+};
+
+/* returns 0 or a sysexits(3) code */
+int	sweep_load(struct sweep_template *t, char const *file_name);
+void	sweep_free(struct sweep_template *t);
+
+size_t	sweep_num_candidates(struct sweep_template const *t);
+/* 'dcd' must be initialized by sdp_dcd_init() */
+bool	sweep_build_dcd(struct sweep_template const *t, size_t idx,
+			struct sdp_dcd *dcd);
+
+int	sweep_run(struct sweep_template const *t,
+		  struct sweep_opts const *opts);
+
+#endif	/* H_ENSC_MX6_LOAD_SWEEP_H */
@@ -0,0 +1,276 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "upload.h"
+
+#include <sysexits.h>
+
+#include "sdp.h"
+#include "util.h"
+#include "image.h"
+#include "metrics.h"
+#include "delta.h"
+#include "profile.h"
+
+enum upload_init {
+	UPLOAD_INIT_NONE,
+	UPLOAD_INIT_DCD,
+	UPLOAD_INIT_PLUGIN,
+};
+
+static char const * const	INIT_NAMES[] = {
+	[UPLOAD_INIT_NONE]	= "init",
+	[UPLOAD_INIT_DCD]	= "dcd",
+	[UPLOAD_INIT_PLUGIN]	= "plugin",
+};
+
+struct upload_result {
+	/* DDR setup by DCD or plugin */
+	enum upload_init	init;
+	uint64_t		t_init;
+	size_t			init_len;
+	/* DCD sent before a plugin; included in 't_init' */
+	uint64_t		t_dcd;
+	size_t			dcd_len;
+	/* only changed blocks were uploaded by --delta */
+	bool			warm;
+	uint64_t		t_file;
+	uint64_t		t_jump;
+	size_t			bytes_sent;
+};
+
+/* SDPS: the ROM receives the whole file including the containers and
+ * boots it without an explicit jump */
+static int upload_sdps(struct sdp *sdp, struct mx6_image const *img,
+		       FILE *out, struct upload_result *res)
+{
+	uint64_t	t0;
+
+	if (img->iov) {
+		fprintf(out, " bundle variants not supported by SDPS");
+		return EX_DATAERR;
+	}
+
+	fprintf(out, " STREAM[%zu]", img->fsize);
+	fflush(out);
+
+	t0 = monotonic_ns();
+	if (!sdps_write_image(sdp, img->data, img->fsize))
+		return EX_OSERR;
+
+	res->t_file = monotonic_ns() - t0;
+	res->bytes_sent = img->fsize;
+	metrics_phase(METRICS_PHASE_FILE, res->t_file);
+
+	return 0;
+}
+
+static bool upload_dcd(struct sdp *sdp, struct mx6_image const *img,
+		       FILE *out)
+{
+	fprintf(out, " DCD[%zu]", img->dcd_len);
+	fflush(out);
+
+	return sdp_write_dcd(sdp, img->dcd, img->dcd_len);
+}
+
+/* the plugin initializes the DDR at CPU speed instead of the ROM which
+ * interprets the DCD command by command */
+static bool upload_plugin(struct sdp *sdp, struct mx6_image const *img,
+			  FILE *out)
+{
+	int	status;
+
+	fprintf(out, " PLUGIN[%08lx+%zu]", (unsigned long)img->load_addr,
+		img->main_offset);
+	fflush(out);
+
+	/* the status request blocks until the plugin returned to the ROM */
+	return (sdp_write_file(sdp, img->load_addr, img->data,
+			       img->main_offset) &&
+		sdp_jump(sdp, image_ivt_addr(img)) &&
+		sdp_read_error_status(sdp, &status));
+}
+
+static int upload_sdp(struct sdp *sdp, struct mx6_image const *img,
+		      struct upload_opts const *opts, FILE *out,
+		      struct upload_result *res)
+{
+	struct mx6_image	main_img;
+	uint64_t		t0;
+	bool			warm;
+	bool			ok;
+
+	if (!img->ivt) {
+		fprintf(out, " no IVT at offset %#x", img->offset);
+		return EX_DATAERR;
+	}
+
+	if (img->plugin && img->iov) {
+		fprintf(out, " plugin images not supported in bundles");
+		return EX_DATAERR;
+	}
+
+	if (img->plugin && image_main(img, &main_img) != 0) {
+		fprintf(out, " no main image behind the plugin");
+		return EX_DATAERR;
+	}
+
+	/* a DDR controller which is still configured from the previous
+	 * boot means that DDR content survived the reset.  Digests are
+	 * calculated over contiguous images only. */
+	warm = (opts->delta_stub && !img->iov && !img->plugin &&
+		delta_ddr_ready(sdp));
+
+	t0 = monotonic_ns();
+	if (warm) {
+		fprintf(out, " DCD[skipped]");
+	} else if (img->plugin) {
+		if (img->dcd) {
+			if (!upload_dcd(sdp, img, out))
+				return EX_OSERR;
+
+			res->t_dcd   = monotonic_ns() - t0;
+			res->dcd_len = img->dcd_len;
+		}
+
+		if (!upload_plugin(sdp, img, out))
+			return EX_OSERR;
+
+		res->init     = UPLOAD_INIT_PLUGIN;
+		res->t_init   = monotonic_ns() - t0;
+		res->init_len = img->main_offset;
+		metrics_phase(METRICS_PHASE_PLUGIN, res->t_init);
+
+		/* a DCD of the main image is run by the ROM on the jump */
+		img = &main_img;
+	} else if (img->dcd) {
+		if (!upload_dcd(sdp, img, out))
+			return EX_OSERR;
+
+		res->init     = UPLOAD_INIT_DCD;
+		res->t_init   = monotonic_ns() - t0;
+		res->init_len = img->dcd_len;
+		metrics_phase(METRICS_PHASE_DCD, res->t_init);
+	}
+
+	fprintf(out, " FILE[%08lx+%zu]", (unsigned long)img->load_addr,
+		img->fsize);
+	fflush(out);
+
+	t0 = monotonic_ns();
+	if (warm) {
+		struct delta_stats	st = { };
+
+		ok = delta_write(sdp, img, opts->delta_stub,
+				 opts->block_size, &st);
+		if (ok)
+			fprintf(out, " DELTA[%zu/%zu blocks in %zu writes]",
+				st.num_dirty, st.num_blocks, st.num_writes);
+
+		res->bytes_sent = st.bytes_sent;
+		res->warm       = true;
+	} else {
+		ok = image_write(sdp, img);
+		res->bytes_sent = img->fsize;
+	}
+
+	if (!ok)
+		return EX_OSERR;
+
+	res->t_file = monotonic_ns() - t0;
+	metrics_phase(METRICS_PHASE_FILE, res->t_file);
+
+	t0 = monotonic_ns();
+	if (!sdp_jump(sdp, image_ivt_addr(img)))
+		return EX_OSERR;
+	res->t_jump = monotonic_ns() - t0;
+	metrics_phase(METRICS_PHASE_JUMP, res->t_jump);
+
+	return 0;
+}
+
+static void upload_record_profile(struct sdp *sdp, char const *file_name,
+				  struct upload_result const *res)
+{
+	struct profile_sample	s = {
+		.cpu		= sdp_get_cpu_info(sdp)->id,
+		.t_jump		= res->t_jump,
+		.t_file		= res->t_file,
+		.file_len	= res->bytes_sent,
+	};
+
+	switch (res->init) {
+	case UPLOAD_INIT_NONE:
+		break;
+	case UPLOAD_INIT_DCD:
+		s.t_dcd   = res->t_init;
+		s.dcd_len = res->init_len;
+		break;
+	case UPLOAD_INIT_PLUGIN:
+		/* the DCD of the plugin image is a sample of its own */
+		s.t_dcd      = res->t_dcd;
+		s.dcd_len    = res->dcd_len;
+		s.t_plugin   = res->t_init - res->t_dcd;
+		s.plugin_len = res->init_len;
+		break;
+	}
+
+	/* failures are reported but do not fail the upload */
+	profile_record(file_name, sdp_get_devpath(sdp), &s);
+}
+
+int upload_image(struct sdp *sdp, struct mx6_image const *img,
+		 struct upload_opts const *opts, FILE *out)
+{
+	struct metrics_port	*port = metrics_port_get(sdp_get_devpath(sdp));
+	uint64_t		t_start = monotonic_ns();
+	struct upload_result	res = { };
+	int			rc;
+
+	fprintf(out, "Uploading image to %s...", sdp_get_devpath(sdp));
+
+	if (sdp_get_cpu_info(sdp)->protocol == SDP_PROTO_SDPS)
+		rc = upload_sdps(sdp, img, out, &res);
+	else
+		rc = upload_sdp(sdp, img, opts, out, &res);
+
+	if (rc) {
+		fprintf(out, " FAILED\n");
+	} else {
+		metrics_phase(METRICS_PHASE_TOTAL, monotonic_ns() - t_start);
+		fprintf(out, " done (%.3f ms)\n",
+			(monotonic_ns() - t_start) / 1e6);
+
+		if (opts->timing)
+			fprintf(out, "  %s: %.3f ms, file: %.3f ms, jump: %.3f ms\n",
+				INIT_NAMES[res.init],
+				res.t_init / 1e6, res.t_file / 1e6,
+				res.t_jump / 1e6);
+	}
+
+	/* delta uploads say nothing about the transfer rate */
+	if (rc == 0 && opts->profile && !res.warm)
+		upload_record_profile(sdp, opts->profile, &res);
+
+	metrics_upload(port, rc == 0, rc == 0 ? res.bytes_sent : 0,
+		       res.t_file);
+	return rc;
+}
@@ -0,0 +1,56 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H_ENSC_MX6_LOAD_UPLOAD_H
+#define H_ENSC_MX6_LOAD_UPLOAD_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+struct sdp;
+struct stub;
+struct mx6_image;
+struct image_cache;
+
+struct upload_opts {
+	char const		*file_name;
+	unsigned int		offset;
+
+	/* set in --delta mode */
+	struct stub const	*delta_stub;
+	size_t			block_size;
+
+	/* set in --cache mode */
+	struct image_cache	*cache;
+
+	/* print the duration of DDR setup (by DCD or plugin), upload and
+	 * jump; allows to compare both setup methods for a board */
+	bool			timing;
+
+	/* when set, the durations of successful uploads are merged into
+	 * this profile; see profile.h */
+	char const		*profile;
+};
+
+/* sends DCD, image and jump command for an image which was opened by
+ * image_open() before; 'img' is not modified so that it can be shared
+ * between concurrent uploads.  Progress is written to 'out'.  Returns 0
+ * or a sysexits(3) code. */
+int	upload_image(struct sdp *sdp, struct mx6_image const *img,
+		     struct upload_opts const *opts, FILE *out);
+
+#endif	/* H_ENSC_MX6_LOAD_UPLOAD_H */
@@ -0,0 +1,81 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "util.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sysexits.h>
+#include <sys/stat.h>
+
+int read_file(char const *path, void **data, size_t *len)
+{
+	struct stat	st;
+	uint8_t		*buf = NULL;
+	size_t		pos = 0;
+	int		fd;
+	int		rc;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "failed to open '%s': %m\n", path);
+		return EX_NOINPUT;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		perror("fstat()");
+		rc = EX_OSERR;
+		goto out;
+	}
+
+	buf = malloc(st.st_size ? st.st_size : 1);
+	if (!buf) {
+		rc = EX_OSERR;
+		goto out;
+	}
+
+	while (pos < (size_t)st.st_size) {
+		ssize_t	l = read(fd, buf + pos, st.st_size - pos);
+
+		if (l < 0 && errno == EINTR)
+			continue;
+
+		if (l <= 0) {
+			fprintf(stderr, "failed to read '%s': %m\n", path);
+			rc = EX_IOERR;
+			goto out;
+		}
+
+		pos += l;
+	}
+
+	*data = buf;
+	*len = pos;
+	buf = NULL;
+	rc = 0;
+
+out:
+	free(buf);
+	close(fd);
+	return rc;
+}
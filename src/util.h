@@ -17,6 +17,10 @@
 #ifndef H_ENSC_MX6_LOAD_UTIL_H
 #define H_ENSC_MX6_LOAD_UTIL_H
 
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
 #ifndef __packed
 #  define __packed	__attribute__((__packed__))
 #endif
@@ -25,6 +29,8 @@ typedef uint8_t		be8_t;
 typedef uint16_t	be16_t;
 typedef uint32_t	be32_t;
 
+#define ARRAY_SIZE(_a)	(sizeof (_a) / sizeof (_a)[0])
+
 #define container_of(_ptr, _type, _attr) __extension__		\
 	({								\
 		__typeof__( ((_type *)0)->_attr) *_tmp_mptr = (_ptr);	\
@@ -32,6 +38,16 @@ typedef uint32_t	be32_t;
 			  __builtin_offsetof(_type, _attr));		\
 	})
 
+static inline uint64_t monotonic_ns(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
 
+/* reads a whole file into a malloc()ed buffer; returns 0 or a
+ * sysexits(3) code */
+int	read_file(char const *path, void **data, size_t *len);
 
 #endif	/* H_ENSC_MX6_LOAD_UTIL_H */
@@ -0,0 +1,158 @@
+/*	--*- c -*--
+ * Copyright (C) 2013 Enrico Scholz <enrico.scholz@informatik.tu-chemnitz.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* Regression checks of the image parser with images laid out the way
+ * U-Boot's mkimage creates them and with truncated ones.  Run by
+ * 'make check'. */
+
+#include <stdio.h>
+#include <string.h>
+#include <endian.h>
+#include <sysexits.h>
+
+#include "../src/image.h"
+#include "../src/sdp.h"
+
+/* image_write() is not exercised */
+bool sdp_write_file(struct sdp *sdp, uint32_t addr, void const *data,
+		    size_t len)
+{
+	abort();
+}
+
+bool sdp_write_filev(struct sdp *sdp, uint32_t addr,
+		     struct iovec const *iov, size_t iov_cnt)
+{
+	abort();
+}
+
+#define PLUGIN_BASE	0x00907000u
+#define MAIN_BASE	0x177ff000u
+#define MAIN_IVT	0x1000u
+#define IMAGE_SIZE	0x3000u
+
+static unsigned int	num_failed;
+
+#define CHECK(_cond) do {						\
+		if (!(_cond)) {						\
+			fprintf(stderr, "%s:%d: %s failed\n",		\
+				__func__, __LINE__, #_cond);		\
+			++num_failed;					\
+		}							\
+	} while (0)
+
+static void put_ivt(uint8_t *buf, size_t pos, uint32_t base, uint32_t entry,
+		    uint32_t dcd, uint32_t bd_start, uint32_t bd_len,
+		    uint32_t flag)
+{
+	struct ivt	ivt = {
+		.header		= htole32(0x402000d1),
+		.entry		= htole32(entry),
+		.dcd		= htole32(dcd),
+		.boot_data	= htole32(base + pos + sizeof ivt),
+		.self		= htole32(base + pos),
+	};
+	struct bdata	bd = {
+		.start		= htole32(bd_start),
+		.length		= htole32(bd_len),
+		.flag		= htole32(flag),
+	};
+
+	memcpy(buf + pos, &ivt, sizeof ivt);
+	memcpy(buf + pos + sizeof ivt, &bd, sizeof bd);
+}
+
+/* plugin IVT at 0x400, main IVT behind the plugin code; the boot data of
+ * the main image starts at the image base in front of its IVT */
+static void build_plugin_image(uint8_t *buf, uint32_t main_entry)
+{
+	memset(buf, 0, IMAGE_SIZE);
+
+	put_ivt(buf, 0x400, PLUGIN_BASE, PLUGIN_BASE + 0x440, 0,
+		PLUGIN_BASE, MAIN_IVT, BDATA_FLAG_PLUGIN);
+	put_ivt(buf, MAIN_IVT, MAIN_BASE, main_entry, 0,
+		MAIN_BASE, IMAGE_SIZE, 0);
+}
+
+static void test_plugin_mkimage(void)
+{
+	static uint8_t		buf[IMAGE_SIZE];
+	struct mx6_image	img;
+	struct mx6_image	main_img;
+
+	build_plugin_image(buf, MAIN_BASE + MAIN_IVT + 0x100);
+
+	CHECK(image_parse(&img, buf, sizeof buf, 0x400) == 0);
+	CHECK(img.plugin);
+	CHECK(img.main_offset == MAIN_IVT);
+
+	CHECK(image_main(&img, &main_img) == 0);
+	CHECK(image_ivt_addr(&main_img) == MAIN_BASE + MAIN_IVT);
+}
+
+static void test_plugin_bad_entry(void)
+{
+	static uint8_t		buf[IMAGE_SIZE];
+	struct mx6_image	img;
+	struct mx6_image	main_img;
+
+	/* entry behind the image; not a main IVT */
+	build_plugin_image(buf, MAIN_BASE + IMAGE_SIZE);
+
+	CHECK(image_parse(&img, buf, sizeof buf, 0x400) == 0);
+	CHECK(img.plugin);
+	CHECK(img.main_offset == 0);
+	CHECK(image_main(&img, &main_img) == EX_DATAERR);
+}
+
+/* image with a DCD of 'dcd_len' bytes at 0x440; 'fsize' might cut it */
+static int parse_dcd_image(uint8_t *buf, size_t fsize, uint16_t dcd_len)
+{
+	struct mx6_image	img;
+	be32_t			dcd_hdr = htobe32(0xd2000040 | (dcd_len << 8));
+
+	memset(buf, 0, IMAGE_SIZE);
+	put_ivt(buf, 0x400, MAIN_BASE, MAIN_BASE + 0x1000, MAIN_BASE + 0x440,
+		MAIN_BASE, IMAGE_SIZE, 0);
+	memcpy(buf + 0x440, &dcd_hdr, sizeof dcd_hdr);
+
+	return image_parse(&img, buf, fsize, 0x400);
+}
+
+static void test_dcd_bounds(void)
+{
+	static uint8_t		buf[IMAGE_SIZE];
+
+	CHECK(parse_dcd_image(buf, IMAGE_SIZE, 0x20) == 0);
+	CHECK(parse_dcd_image(buf, 0x460, 0x20) == 0);
+
+	/* truncated DCD, e.g. a bundle head clipped to the variant size */
+	CHECK(parse_dcd_image(buf, 0x45f, 0x20) == EX_DATAERR);
+	CHECK(parse_dcd_image(buf, IMAGE_SIZE, 0xfff0) == EX_DATAERR);
+
+	/* DCD header not within the image */
+	CHECK(parse_dcd_image(buf, 0x442, 0x20) == EX_DATAERR);
+}
+
+int main(void)
+{
+	test_plugin_mkimage();
+	test_plugin_bad_entry();
+	test_dcd_bounds();
+
+	return num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}